@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <vector>
+
+#include "algebra.h"
+#include "utils.h"
+
+// a fixed seed, so runs on different commits see the same matrices
+static Rand rng(82);
+
+static std::vector<double> random_matrix(int m, int n) {
+  std::vector<double> A(m * n);
+  rng.fill_uniform(A.data(), A.size(), -0.5, 0.5);
+  return A;
+}
+
+// state.range(0): order n of the matrices
+static void orders(benchmark::internal::Benchmark* b) {
+  for (int64_t n : {8, 32, 128, 512}) b->Arg(n);
+}
+
+// the copy of A is part of the time, it is O(n^2) against O(n^3)
+static void BM_pludec(benchmark::State& state) {
+  const int n = state.range(0);
+  const std::vector<double> A = random_matrix(n, n);
+  std::vector<double> LU(n * n);
+  std::vector<int> perm(2 * n);  // the permutation and its inverse
+  for (auto _ : state) {
+    LU = A;
+    pludec<double>(n, LU.data(), perm.data());
+    benchmark::DoNotOptimize(LU.data());
+  }
+  state.SetItemsProcessed(state.iterations() * 2 * int64_t(n) * n * n / 3);
+}
+BENCHMARK(BM_pludec)->Apply(orders);
+
+// factor and solve for n right hand sides
+static void BM_plusolve(benchmark::State& state) {
+  const int n = state.range(0);
+  const std::vector<double> A = random_matrix(n, n), B = random_matrix(n, n);
+  std::vector<double> X(n * n);
+  for (auto _ : state) {
+    plusolve<double>(n, A.data(), n, X.data(), B.data());
+    benchmark::DoNotOptimize(X.data());
+  }
+  state.SetItemsProcessed(state.iterations() * 8 * int64_t(n) * n * n / 3);
+}
+BENCHMARK(BM_plusolve)->Apply(orders);
+
+// state.range(0): number m of basis functions, fitted on 64 m samples
+static void BM_lls(benchmark::State& state) {
+  const int m = state.range(0), n = 64 * m;
+  std::vector<double> f(m * n), y(n), c(m);
+  for (int i = 0; i < n; ++i) {
+    const double x = double(i) / n;
+    for (int a = 0; a < m; ++a) f[a + m * i] = std::cos(a * x);
+    y[i] = std::exp(x);
+  }
+  for (auto _ : state) {
+    lls<double>(m, n, f.data(), y.data(), c.data());
+    benchmark::DoNotOptimize(c.data());
+  }
+  state.SetItemsProcessed(state.iterations() * int64_t(n) * m * m);
+}
+BENCHMARK(BM_lls)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+
+BENCHMARK_MAIN();
@@ -5,15 +5,32 @@
  */
 #pragma once
 
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "stats.h"
+#include "thread_pool.h"
 
+// x^n by binary powering
 template <typename T>
 T npow(T x, int n) {
   if (n == 0) return 1;
-  int nn = n > 0 ? n : -n;
-  T res = x;
-  for (int i = 0; i < nn; i++) {
-    res *= x;
+  unsigned nn = n > 0 ? n : -static_cast<unsigned>(n);
+  T res = 1;
+  while (true) {
+    if (nn & 1) res *= x;
+    nn >>= 1;
+    if (nn == 0) break;
+    x *= x;
   }
   if (n < 0) res = 1 / res;
   return res;
@@ -42,112 +59,491 @@ void swaprowT(const int n, const int i1, const int i2, T* AT) {
   }
 }
 
-// LU decomposition with partial pivoting
-// A[i][j] = A[i + n*j] is the matrix to be LU decomped
-// perm is the permutation matrix, perm[1] = 2 means move row 1 of A to row 2 etc
+// storage order of a MatrixView, ColMajor is the A[i + n*j] layout taken by
+// the raw pointer routines of this file
+enum class Layout { ColMajor, RowMajor };
+
+// non-owning view of a rows by cols matrix
+// ld is the distance between two columns (ColMajor) or two rows (RowMajor)
 template <typename T>
-void pludec(const int n, T* A, int* perm) {
-  if (n < 2) return;
-  int i, j, k, imax;
-  T piv, tmax, tmp;
-  T* TA = new T[n * n];
-  for (i = 0; i < n; i++)
-    for (j = 0; j < n; j++) TA[i * n + j] = A[i + n * j];  // TA is A but with "transposed" storing
+struct MatrixView {
+  T* data;
+  int rows, cols, ld;
+  Layout layout;
+
+  MatrixView(T* data, int rows, int cols, Layout layout = Layout::ColMajor)
+      : MatrixView(data, rows, cols,
+                   layout == Layout::ColMajor ? rows : cols, layout) {}
+  MatrixView(T* data, int rows, int cols, int ld, Layout layout)
+      : data{data}, rows{rows}, cols{cols}, ld{ld}, layout{layout} {}
+  // a view of T converts to a view of const T
+  template <typename U, typename = typename std::enable_if<
+                            std::is_same<const U, T>::value>::type>
+  MatrixView(const MatrixView<U>& rhs)
+      : MatrixView(rhs.data, rhs.rows, rhs.cols, rhs.ld, rhs.layout) {}
+
+  bool col_major() const noexcept { return layout == Layout::ColMajor; }
+  // distance between (i, j) and (i + 1, j), resp. (i, j + 1)
+  ptrdiff_t rs() const noexcept { return col_major() ? 1 : ld; }
+  ptrdiff_t cs() const noexcept { return col_major() ? ld : 1; }
+  T& operator()(int i, int j) const noexcept {
+    return data[i * rs() + j * cs()];
+  }
+  MatrixView block(int i, int j, int r, int c) const noexcept {
+    return MatrixView(data + i * rs() + j * cs(), r, c, ld, layout);
+  }
+  // the transpose shares the storage, only the layout flips
+  MatrixView t() const noexcept {
+    return MatrixView(data, cols, rows, ld,
+                      col_major() ? Layout::RowMajor : Layout::ColMajor);
+  }
+};
 
-  int* index = new int[i];
-  for (i = 0; i < n; i++) index[i] = i;
+// The kernels below take views and pick their loop order from the layout of
+// the operand they write, so the innermost loop runs with unit stride on
+// either layout and no transposed copy is ever made.
 
-  for (i = 0; i < n; i++) {
-    // pick pivot
-    tmax = -1.0;
-    imax = i;
-    int ni = n * i;
-    for (j = i; j < n; j++) {
-      tmp = 0.0;
-      for (k = 0; k < i; k++) tmp += TA[j * n + k] * A[k + ni];
-      tmp = A[j + ni] - tmp;
+// dst = src
+template <typename T>
+void copymat(MatrixView<const T> src, MatrixView<T> dst) {
+  if (dst.col_major()) {
+    for (int col = 0; col < dst.cols; col++)
+      for (int row = 0; row < dst.rows; row++) dst(row, col) = src(row, col);
+  } else {
+    for (int row = 0; row < dst.rows; row++)
+      for (int col = 0; col < dst.cols; col++) dst(row, col) = src(row, col);
+  }
+}
 
-      if (ABS<T>(tmp) > tmax) {
-        tmax = ABS<T>(tmp);
-        imax = j;
+// dst = src converted to another precision
+template <typename T, typename U>
+void castmat(MatrixView<const U> src, MatrixView<T> dst) {
+  if (dst.col_major()) {
+    for (int col = 0; col < dst.cols; col++)
+      for (int row = 0; row < dst.rows; row++)
+        dst(row, col) = static_cast<T>(src(row, col));
+  } else {
+    for (int row = 0; row < dst.rows; row++)
+      for (int col = 0; col < dst.cols; col++)
+        dst(row, col) = static_cast<T>(src(row, col));
+  }
+}
+
+// apply the row swaps ipiv[k1..k2) (row i <-> row ipiv[i]) to A
+template <typename T>
+void laswp(MatrixView<T> A, const int k1, const int k2, const int* ipiv) {
+  if (A.col_major()) {
+    for (int col = 0; col < A.cols; col++) {
+      T* a = &A(0, col);
+      for (int i = k1; i < k2; i++) {
+        if (ipiv[i] != i) std::swap(a[i], a[ipiv[i]]);
       }
     }
-    perm[i] = index[imax];  // index[imax] row of original A is mapped to row i of LU
-    perm[n + index[imax]] = i;
+  } else {
+    for (int i = k1; i < k2; i++) {
+      if (ipiv[i] == i) continue;
+      T *a = &A(i, 0), *b = &A(ipiv[i], 0);
+      std::swap_ranges(a, a + A.cols, b);
+    }
+  }
+}
 
-    // swap rows
-    if (i != imax) {
-      int idx = index[imax];
-      index[imax] = index[i];
-      index[i] = idx;
-      swaprow<T>(n, i, imax, A);
-      swaprowT<T>(n, i, imax, TA);
+// unblocked right looking LU of the m by nb panel P
+// with partial pivoting ipiv[j] is the panel row swapped with row j,
+// a null ipiv factors without pivoting
+template <typename T>
+void pludec_panel(MatrixView<T> P, int* ipiv) {
+  const int m = P.rows, nb = P.cols;
+  const ptrdiff_t rs = P.rs();
+  for (int j = 0; j < nb && j < m; j++) {
+    T* pj = &P(0, j);
+    if (ipiv) {
+      T tmax = -1.0;
+      int imax = j;
+      for (int i = j; i < m; i++) {
+        if (ABS<T>(pj[i * rs]) > tmax) {
+          tmax = ABS<T>(pj[i * rs]);
+          imax = i;
+        }
+      }
+      ipiv[j] = imax;
+      if (imax != j)
+        for (int col = 0; col < nb; col++) std::swap(P(j, col), P(imax, col));
     }
 
-    tmp = 0.0;
-    for (k = 0; k < i; k++) tmp += TA[ni + k] * A[k + ni];
-    A[i + ni] -= tmp;  // first calc. the pivot
-    piv = A[i + ni];
-    TA[ni + i] = A[i + ni];  // update TA too
+    const T piv = pj[j * rs];
+    KL_STATS_ADD(flops, uint64_t(m - j - 1) * (2 * (nb - j) - 1));
+    for (int i = j + 1; i < m; i++) pj[i * rs] /= piv;
+    if (P.col_major()) {
+      for (int col = j + 1; col < nb; col++) {
+        T* pc = &P(0, col);
+        const T u = pc[j];
+        if (u == 0.0) continue;
+        for (int i = j + 1; i < m; i++) pc[i] -= pj[i] * u;
+      }
+    } else {
+      const T* uj = &P(j, 0);
+      for (int i = j + 1; i < m; i++) {
+        T* pi = &P(i, 0);
+        const T l = pi[j];
+        if (l == 0.0) continue;
+        for (int col = j + 1; col < nb; col++) pi[col] -= l * uj[col];
+      }
+    }
+  }
+}
 
-    // now update column i from row i+1
-    for (int row = i + 1; row < n; ++row) {
-      tmp = 0.0;
-      for (k = 0; k < i; k++) tmp += TA[row * n + k] * A[k + ni];
-      A[row + ni] = (A[row + ni] - tmp) / piv;
-      TA[row * n + i] = A[row + ni];
+// B := L**-1 * B with L n by n lower triangular, B n by m
+// unit means L has an implicit unit diagonal
+template <typename T>
+void trsm_low(MatrixView<const T> L, MatrixView<T> B, const bool unit) {
+  const int n = B.rows, m = B.cols;
+  KL_STATS_ADD(flops, uint64_t(m) * n * (unit ? n - 1 : n));
+  if (!B.col_major()) {  // rows of B are updated with rows of B
+    for (int j = 0; j < n; j++) {
+      T* bj = &B(j, 0);
+      if (!unit) {
+        const T d = L(j, j);
+        for (int col = 0; col < m; col++) bj[col] /= d;
+      }
+      for (int i = j + 1; i < n; i++) {
+        const T l = L(i, j);
+        if (l == 0.0) continue;
+        T* bi = &B(i, 0);
+        for (int col = 0; col < m; col++) bi[col] -= l * bj[col];
+      }
+    }
+    return;
+  }
+  if (!L.col_major()) {  // dot products along the rows of L
+    for (int col = 0; col < m; col++) {
+      T* b = &B(0, col);
+      for (int i = 0; i < n; i++) {
+        const T* l = &L(i, 0);
+        T sum = 0.0;
+        for (int j = 0; j < i; j++) sum += l[j] * b[j];
+        b[i] -= sum;
+        if (!unit) b[i] /= l[i];
+      }
+    }
+    return;
+  }
+  // four right hand sides are swept together so each column of L is read
+  // once per four columns of B
+  int col = 0;
+  for (; col + 4 <= m; col += 4) {
+    T *b0 = &B(0, col), *b1 = b0 + B.ld, *b2 = b1 + B.ld, *b3 = b2 + B.ld;
+    for (int j = 0; j < n; j++) {
+      const T* l = &L(0, j);
+      if (!unit) {
+        b0[j] /= l[j];
+        b1[j] /= l[j];
+        b2[j] /= l[j];
+        b3[j] /= l[j];
+      }
+      const T x0 = b0[j], x1 = b1[j], x2 = b2[j], x3 = b3[j];
+      if (x0 == 0.0 && x1 == 0.0 && x2 == 0.0 && x3 == 0.0) continue;
+      for (int i = j + 1; i < n; i++) {
+        const T li = l[i];
+        b0[i] -= li * x0;
+        b1[i] -= li * x1;
+        b2[i] -= li * x2;
+        b3[i] -= li * x3;
+      }
+    }
+  }
+  for (; col < m; col++) {
+    T* b = &B(0, col);
+    for (int j = 0; j < n; j++) {
+      const T* l = &L(0, j);
+      if (!unit) b[j] /= l[j];
+      const T bj = b[j];
+      if (bj == 0.0) continue;
+      for (int i = j + 1; i < n; i++) b[i] -= l[i] * bj;
     }
+  }
+}
+
+// B := L**-1 * B with L n by n unit lower triangular, B n by m
+template <typename T>
+void trsm_low1(MatrixView<const T> L, MatrixView<T> B) {
+  trsm_low<T>(L, B, true);
+}
 
-    for (int col = i + 1; col < n; col++) {
-      tmp = 0.0;
-      for (k = 0; k < i; k++) tmp += TA[ni + k] * A[k + n * col];
-      A[i + n * col] -= tmp;
-      TA[ni + col] = A[i + n * col];
+// B := U**-1 * B with U n by n upper triangular, B n by m
+template <typename T>
+void trsm_up(MatrixView<const T> U, MatrixView<T> B, const bool unit = false) {
+  const int n = B.rows, m = B.cols;
+  KL_STATS_ADD(flops, uint64_t(m) * n * (unit ? n - 1 : n));
+  if (!B.col_major()) {
+    for (int j = n - 1; j >= 0; j--) {
+      T* bj = &B(j, 0);
+      if (!unit) {
+        const T d = U(j, j);
+        for (int col = 0; col < m; col++) bj[col] /= d;
+      }
+      for (int i = 0; i < j; i++) {
+        const T u = U(i, j);
+        if (u == 0.0) continue;
+        T* bi = &B(i, 0);
+        for (int col = 0; col < m; col++) bi[col] -= u * bj[col];
+      }
+    }
+    return;
+  }
+  if (!U.col_major()) {
+    for (int col = 0; col < m; col++) {
+      T* b = &B(0, col);
+      for (int i = n - 1; i >= 0; i--) {
+        const T* u = &U(i, 0);
+        T sum = 0.0;
+        for (int j = i + 1; j < n; j++) sum += u[j] * b[j];
+        b[i] -= sum;
+        if (!unit) b[i] /= u[i];
+      }
+    }
+    return;
+  }
+  int col = 0;
+  for (; col + 4 <= m; col += 4) {
+    T *b0 = &B(0, col), *b1 = b0 + B.ld, *b2 = b1 + B.ld, *b3 = b2 + B.ld;
+    for (int j = n - 1; j >= 0; j--) {
+      const T* u = &U(0, j);
+      if (!unit) {
+        b0[j] /= u[j];
+        b1[j] /= u[j];
+        b2[j] /= u[j];
+        b3[j] /= u[j];
+      }
+      const T x0 = b0[j], x1 = b1[j], x2 = b2[j], x3 = b3[j];
+      for (int i = 0; i < j; i++) {
+        const T ui = u[i];
+        b0[i] -= ui * x0;
+        b1[i] -= ui * x1;
+        b2[i] -= ui * x2;
+        b3[i] -= ui * x3;
+      }
+    }
+  }
+  for (; col < m; col++) {
+    T* b = &B(0, col);
+    for (int j = n - 1; j >= 0; j--) {
+      const T* u = &U(0, j);
+      if (!unit) b[j] /= u[j];
+      const T bj = b[j];
+      for (int i = 0; i < j; i++) b[i] -= u[i] * bj;
     }
   }
-  delete[] index;
-  delete[] TA;
 }
 
-// decompose A = LU
-// note A[i][j] = A[i + n*j]
+// C += alpha * A * B with A m by k, B k by n, C m by n
+// the operands are processed in slabs of 256 rows (ColMajor C) or columns
+// (RowMajor C) and 256 inner indices so that the slab of B (resp. A) being
+// swept stays in cache; every C(i, j) still sums its terms in order of p
 template <typename T>
-void ludec(const int n, T* A) {
-  int i, j, k;
-  T* Aik = new T[n];
-  T sum;
-  for (i = 1; i < n; i++) {
-    for (k = 0; k < n; k++) Aik[k] = A[i + n * k];
-    for (j = 0; j < n; j++) {
-      sum = 0.0;
-      if (i > j) {  // cal L
-        for (k = 0; k < j; k++) sum += Aik[k] * A[k + n * j];
-        A[i + n * j] = (A[i + n * j] - sum) / A[j + n * j];
-      } else {  // cal U
-        for (k = 0; k < i; k++) sum += Aik[k] * A[k + n * j];
-        A[i + n * j] -= sum;
+void gemm_acc(MatrixView<const T> A, MatrixView<const T> B, MatrixView<T> C,
+              const T alpha) {
+  const int m = C.rows, n = C.cols, k = A.cols;
+  const int slab = 256;
+  KL_STATS_ADD(flops, 2 * uint64_t(m) * n * k);
+  if (C.col_major() && A.col_major()) {
+    for (int i0 = 0; i0 < m; i0 += slab) {
+      const int i1 = std::min(m, i0 + slab);
+      for (int p0 = 0; p0 < k; p0 += slab) {
+        const int p1 = std::min(k, p0 + slab);
+        for (int col = 0; col < n; col++) {
+          T* c = &C(0, col);
+          for (int p = p0; p < p1; p++) {
+            const T b = alpha * B(p, col);
+            if (b == 0.0) continue;
+            const T* a = &A(0, p);
+            for (int i = i0; i < i1; i++) c[i] += a[i] * b;
+          }
+        }
+      }
+    }
+  } else if (!C.col_major() && !B.col_major()) {
+    for (int j0 = 0; j0 < n; j0 += slab) {
+      const int j1 = std::min(n, j0 + slab);
+      for (int p0 = 0; p0 < k; p0 += slab) {
+        const int p1 = std::min(k, p0 + slab);
+        for (int row = 0; row < m; row++) {
+          T* c = &C(row, 0);
+          for (int p = p0; p < p1; p++) {
+            const T a = alpha * A(row, p);
+            if (a == 0.0) continue;
+            const T* b = &B(p, 0);
+            for (int j = j0; j < j1; j++) c[j] += a * b[j];
+          }
+        }
       }
-      Aik[j] = A[i + n * j];  // update
     }
+  } else {
+    for (int col = 0; col < n; col++)
+      for (int row = 0; row < m; row++)
+        for (int p = 0; p < k; p++)
+          C(row, col) += alpha * A(row, p) * B(p, col);
   }
-  delete[] Aik;
 }
 
+// C -= A * B
 template <typename T>
-T det(const int n, const T* A) {
-  // if (same_type<T>())
-  // 	mpreal::set_default_prec(prec);
-  T res = 0.0;
-  int i;
-  T* tA = new T[n * n];
-  for (i = 0; i < n * n; i++) tA[i] = A[i];
-  ludec<T>(n, tA);
-  res = 1.0;
-  for (i = 0; i < n; i++) res *= tA[i + n * i];
-  delete[] tA;
+void gemm_sub(MatrixView<const T> A, MatrixView<const T> B, MatrixView<T> C) {
+  gemm_acc<T>(A, B, C, T(-1));
+}
+
+// turn LAPACK style row swaps into the perm layout of pludec
+inline void ipiv2perm(const int n, const int* ipiv, int* perm) {
+  std::vector<int> index(n);
+  for (int i = 0; i < n; i++) index[i] = i;
+  for (int i = 0; i < n; i++) std::swap(index[i], index[ipiv[i]]);
+  for (int i = 0; i < n; i++) {
+    perm[i] = index[i];
+    perm[n + index[i]] = i;
+  }
+}
+
+// blocked right looking LU with partial pivoting of the n by n matrix A
+// LAPACK style pivots: row i of A was swapped with row ipiv[i] at step i.
+// Each block column goes through the same operations as in the parallel
+// version below, so both give bitwise identical factors
+template <typename T>
+void pludec_blocked(MatrixView<T> A, int* ipiv, int nb = 64) {
+  nb = std::max(1, nb);
+  const int n = A.rows;
+  for (int k0 = 0; k0 < n; k0 += nb) {
+    const int kb = std::min(nb, n - k0), k1 = k0 + kb;
+    pludec_panel<T>(A.block(k0, k0, n - k0, kb), ipiv + k0);
+    for (int i = k0; i < k1; i++) ipiv[i] += k0;
+    laswp<T>(A.block(0, 0, n, k0), k0, k1, ipiv);
+    laswp<T>(A.block(0, k1, n, n - k1), k0, k1, ipiv);
+    trsm_low1<T>(A.block(k0, k0, kb, kb), A.block(k0, k1, kb, n - k1));
+    gemm_sub<T>(A.block(k1, k0, n - k1, kb), A.block(k0, k1, kb, n - k1),
+                A.block(k1, k1, n - k1, n - k1));
+  }
+}
+
+// parallel version of pludec_blocked
+// block column k is factored by a panel task, every block column j > k is
+// then updated (row swaps, triangular solve, gemm) by its own task that waits
+// for the panel and for the previous update of the same block column;
+// the panel of k + 1 can thus start while the rest of step k is running.
+// Each block column sees the same operations in the same order whatever
+// thread runs them, so results are bitwise identical for any pool size.
+template <typename T>
+void pludec_blocked(MatrixView<T> A, int* piv, kl::ThreadPool& pool,
+                    int nb = 64) {
+  nb = std::max(1, nb);
+  const int n = A.rows;
+  if (n < 1) return;
+  const int nblk = (n + nb - 1) / nb;
+  kl::TaskGraph graph;
+  std::vector<kl::TaskGraph::task_id> last(nblk);
+
+  for (int k = 0; k < nblk; k++) {
+    const int k0 = k * nb, kb = std::min(nb, n - k0);
+    std::vector<kl::TaskGraph::task_id> deps;
+    if (k > 0) deps.push_back(last[k]);
+    const auto panel = graph.add(
+        [=] {
+          pludec_panel<T>(A.block(k0, k0, n - k0, kb), piv + k0);
+          for (int i = k0; i < k0 + kb; i++) piv[i] += k0;
+        },
+        deps);
+    last[k] = panel;
+
+    for (int j = k + 1; j < nblk; j++) {
+      const int j0 = j * nb, jb = std::min(nb, n - j0);
+      deps = {panel};
+      if (k > 0) deps.push_back(last[j]);
+      last[j] = graph.add(
+          [=] {
+            const int k1 = k0 + kb;
+            laswp<T>(A.block(0, j0, n, jb), k0, k1, piv);
+            trsm_low1<T>(A.block(k0, k0, kb, kb), A.block(k0, j0, kb, jb));
+            gemm_sub<T>(A.block(k1, k0, n - k1, kb), A.block(k0, j0, kb, jb),
+                        A.block(k1, j0, n - k1, jb));
+          },
+          deps);
+    }
+  }
+
+  // swaps of the later panels still have to reach the columns on their left
+  const auto final_panel = last[nblk - 1];
+  for (int j = 0; j < nblk - 1; j++) {
+    const int j0 = j * nb, jb = std::min(nb, n - j0);
+    graph.add([=] { laswp<T>(A.block(0, j0, n, jb), j0 + jb, n, piv); },
+              {final_panel});
+  }
+
+  graph.run(pool);
+}
+
+// LU decomposition with partial pivoting
+// A[i][j] = A[i + n*j] is the matrix to be LU decomped
+// perm is the permutation matrix, perm[1] = 2 means move row 1 of A to row 2 etc
+template <typename T>
+void pludec(MatrixView<T> A, int* perm) {
+  KL_STATS_TIMER("pludec");
+  const int n = A.rows;
+  if (n < 1) return;
+  std::vector<int> ipiv(n);
+  pludec_blocked<T>(A, ipiv.data());
+  ipiv2perm(n, ipiv.data(), perm);
+}
+
+template <typename T>
+void pludec(const int n, T* A, int* perm) {
+  pludec<T>(MatrixView<T>(A, n, n), perm);
+}
+
+// parallel LU decomposition with partial pivoting, same layout as pludec
+template <typename T>
+void pludec(MatrixView<T> A, int* perm, kl::ThreadPool& pool,
+            const int nb = 64) {
+  KL_STATS_TIMER("pludec");
+  const int n = A.rows;
+  if (n < 1) return;
+  std::vector<int> ipiv(n);
+  pludec_blocked<T>(A, ipiv.data(), pool, nb);
+  ipiv2perm(n, ipiv.data(), perm);
+}
+
+template <typename T>
+void pludec(const int n, T* A, int* perm, kl::ThreadPool& pool,
+            const int nb = 64) {
+  pludec<T>(MatrixView<T>(A, n, n), perm, pool, nb);
+}
+
+// decompose A = LU
+// note A[i][j] = A[i + n*j]
+template <typename T>
+void ludec(MatrixView<T> A) {
+  pludec_panel<T>(A, nullptr);
+}
+
+template <typename T>
+void ludec(const int n, T* A) {
+  ludec<T>(MatrixView<T>(A, n, n));
+}
+
+template <typename T>
+T det(MatrixView<const T> A) {
+  const int n = A.rows;
+  std::vector<T> buf(n * n);
+  MatrixView<T> tA(buf.data(), n, n, A.layout);
+  copymat<T>(A, tA);
+  ludec<T>(tA);
+  T res = 1.0;
+  for (int i = 0; i < n; i++) res *= tA(i, i);
   return res;
 }
 
+template <typename T>
+T det(const int n, const T* A) {
+  return det<T>(MatrixView<const T>(A, n, n));
+}
+
 // solve for Ax = y with lower triangle A
 // A[i][j] = A[i * n + j]
 template <typename T>
@@ -187,96 +583,594 @@ void upsub(const int n, const T* A, T* x, const T* y) {
   }
 }
 
+// PA = LU factorization kept around to solve against the same A many times
+// L (unit diagonal) and U share the n by n storage, which keeps the layout of
+// the factored matrix. The factors either live in the object or in
+// caller-owned buffers of n * n values and n pivots;
+// solve, determinant and inverse never allocate.
+template <typename T>
+class LUFactorization final {
+ public:
+  LUFactorization() : lu_{nullptr, 0, 0}, piv_{nullptr} {}
+  explicit LUFactorization(MatrixView<const T> A) : LUFactorization() {
+    this->factor(A);
+  }
+  LUFactorization(const int n, const T* A)
+      : LUFactorization(MatrixView<const T>(A, n, n)) {}
+  LUFactorization(MatrixView<const T> A, kl::ThreadPool& pool)
+      : LUFactorization() {
+    this->factor(A, pool);
+  }
+  LUFactorization(const int n, const T* A, kl::ThreadPool& pool)
+      : LUFactorization(MatrixView<const T>(A, n, n), pool) {}
+  // factors go to lu and ipiv, both owned by the caller
+  LUFactorization(MatrixView<const T> A, MatrixView<T> lu, int* ipiv)
+      : lu_{lu}, piv_{ipiv} {
+    if (lu_.data != A.data) copymat<T>(A, lu_);
+    pludec_blocked<T>(lu_, piv_);
+  }
+  LUFactorization(const int n, const T* A, T* lu, int* ipiv)
+      : LUFactorization(MatrixView<const T>(A, n, n), MatrixView<T>(lu, n, n),
+                        ipiv) {}
+  LUFactorization(const LUFactorization&) = delete;
+  LUFactorization& operator=(const LUFactorization&) = delete;
+  LUFactorization(LUFactorization&&) = default;
+  LUFactorization& operator=(LUFactorization&&) = default;
+
+  // refactor, the storage is reused when n does not grow beyond a former n
+  void factor(MatrixView<const T> A) {
+    this->load(A);
+    pludec_blocked<T>(lu_, piv_);
+  }
+  void factor(const int n, const T* A) {
+    this->factor(MatrixView<const T>(A, n, n));
+  }
+
+  void factor(MatrixView<const T> A, kl::ThreadPool& pool) {
+    this->load(A);
+    pludec_blocked<T>(lu_, piv_, pool);
+  }
+  void factor(const int n, const T* A, kl::ThreadPool& pool) {
+    this->factor(MatrixView<const T>(A, n, n), pool);
+  }
+
+  int size() const noexcept { return lu_.rows; }
+  MatrixView<const T> lu() const noexcept { return lu_; }
+  const int* pivots() const noexcept { return piv_; }
+
+  // solve AX = B, X and B are n by m and may be the same view
+  void solve(MatrixView<T> X, MatrixView<const T> B) const {
+    if (X.data != B.data) copymat<T>(B, X);
+    laswp<T>(X, 0, X.rows, piv_);  // get P*B
+    trsm_low1<T>(lu_, X);          // solve for L*Y = P*B
+    trsm_up<T>(lu_, X);            // solve for U*X = Y
+  }
+  void solve(const int m, T* X, const T* B) const {
+    const int n = this->size();
+    this->solve(MatrixView<T>(X, n, m), MatrixView<const T>(B, n, m));
+  }
+
+  // same as above with blocks of right hand sides spread over the pool
+  void solve(MatrixView<T> X, MatrixView<const T> B,
+             kl::ThreadPool& pool) const {
+    const int n = this->size(), rhs_block = 16;
+    kl::parallel_for(pool, 0, X.cols, rhs_block, [&](size_t lo, size_t hi) {
+      this->solve(X.block(0, lo, n, hi - lo), B.block(0, lo, n, hi - lo));
+    });
+  }
+  void solve(const int m, T* X, const T* B, kl::ThreadPool& pool) const {
+    const int n = this->size();
+    this->solve(MatrixView<T>(X, n, m), MatrixView<const T>(B, n, m), pool);
+  }
+
+  T determinant() const {
+    T res = 1.0;
+    for (int i = 0; i < this->size(); i++) {
+      res *= lu_(i, i);
+      if (piv_[i] != i) res = -res;
+    }
+    return res;
+  }
+
+  // Ainv = A**-1, n by n
+  void inverse(MatrixView<T> Ainv) const {
+    const int n = this->size();
+    for (int col = 0; col < n; col++)
+      for (int row = 0; row < n; row++) Ainv(row, col) = (row == col);
+    this->solve(Ainv, Ainv);
+  }
+  void inverse(T* Ainv) const {
+    const int n = this->size();
+    this->inverse(MatrixView<T>(Ainv, n, n));
+  }
+
+ private:
+  void load(MatrixView<const T> A) {
+    const int n = A.rows;
+    own_lu_.resize(n * n);
+    own_piv_.resize(n);
+    lu_ = MatrixView<T>(own_lu_.data(), n, n, A.layout);
+    piv_ = own_piv_.data();
+    copymat<T>(A, lu_);
+  }
+
+  MatrixView<T> lu_;
+  int* piv_;
+  std::vector<T> own_lu_;
+  std::vector<int> own_piv_;
+};
+
 // take inverse of A
 // A[i][j] = A[i + n*j]
 template <typename T>
-void pluinverse(const int n, T* A) {  // use pludec
-  int row, col;
-  int* perm = new int[2 * n];
-  T* tA = new T[n * n];
-  T* tAA = new T[n * n];
-  T* tcol = new T[n];
-  T* icol = new T[n];
-  pludec<T>(n, A, perm);  // now PA = LU
-
-  // store LU of PA to tA with 'transposed' storage
-  for (int row = 0; row < n; row++)
-    for (int col = 0; col < n; col++) tA[row * n + col] = A[row + n * col];
-
-  for (col = 0; col < n; col++) {
-    for (row = 0; row < n; row++) icol[row] = 0.0;
-    icol[col] = 1.0;
-    low1sub<T>(n, tA, tcol, icol);                                 // now tcol is UA**-1
-    upsub<T>(n, tA, icol, tcol);                                   // now icol is A**-1
-    for (row = 0; row < n; row++) tAA[row + n * col] = icol[row];  // update icol to A**-1
-  }                                                                // now tAA is inverse of LU
-
-  // assign A ---> AP
-  for (col = 0; col < n; col++) {
-    int lucol = perm[n + col];
-    for (row = 0; row < n; row++) A[row + n * col] = tAA[row + n * lucol];
-  }
-  delete[] tA;
-  delete[] tAA;
-  delete[] tcol;
-  delete[] icol;
-  delete[] perm;
+void pluinverse(MatrixView<T> A) {
+  LUFactorization<T> lu(A);
+  lu.inverse(A);
+}
+
+template <typename T>
+void pluinverse(const int n, T* A) {
+  pluinverse<T>(MatrixView<T>(A, n, n));
 }
 
 // solve AX = B for matrix X
 // where A is n by n, B and X are n by m matrices
+template <typename T>
+void plusolve(MatrixView<const T> A, MatrixView<T> X, MatrixView<const T> B) {
+  KL_STATS_TIMER("plusolve");
+  if (A.rows < 1) return;
+  LUFactorization<T> lu(A);
+  lu.solve(X, B);
+}
+
 template <typename T>
 void plusolve(const int n, const T* A, const int m, T* X, const T* B) {
-  int row, col;
-  int* perm = new int[2 * n];
-  T* tA = new T[n * n];
-  T* tAA = new T[n * n];
-  T* tcol = new T[n];
-  T* icol = new T[n];
+  plusolve<T>(MatrixView<const T>(A, n, n), MatrixView<T>(X, n, m),
+              MatrixView<const T>(B, n, m));
+}
 
-  for (int i = 0; i < n * n; i++) tAA[i] = A[i];
-  pludec<T>(n, tAA, perm);  // now PA = LU
+// parallel version of plusolve, the right hand sides are solved in blocks
+// of columns on the same pool once A is factored
+template <typename T>
+void plusolve(MatrixView<const T> A, MatrixView<T> X, MatrixView<const T> B,
+              kl::ThreadPool& pool) {
+  KL_STATS_TIMER("plusolve");
+  if (A.rows < 1 || X.cols < 1) return;
+  LUFactorization<T> lu(A, pool);
+  lu.solve(X, B, pool);
+}
 
-  // store LU of PA to tA with 'transposed' storage
-  for (int row = 0; row < n; row++)
-    for (int col = 0; col < n; col++) tA[row * n + col] = tAA[row + n * col];
+template <typename T>
+void plusolve(const int n, const T* A, const int m, T* X, const T* B,
+              kl::ThreadPool& pool) {
+  plusolve<T>(MatrixView<const T>(A, n, n), MatrixView<T>(X, n, m),
+              MatrixView<const T>(B, n, m), pool);
+}
 
-  for (col = 0; col < m; col++) {
-    for (row = 0; row < n; row++) icol[perm[n + row]] = B[row + n * col];  // get P*b_col
-    low1sub<T>(n, tA, tcol, icol);                                         // solve for L*y = P*b_col
-    upsub<T>(n, tA, icol, tcol);                                           // solve for U*x_col = y
-    for (row = 0; row < n; row++) X[row + n * col] = icol[row];            // store x_col
+// outcome of a mixed precision solve
+struct RefineInfo {
+  int iterations = 0;           // refinement steps taken
+  double backward_error = 0.0;  // max_j |b_j - A x_j| / (|A| |x_j| + |b_j|)
+  bool converged = false;       // backward error reached sqrt(n) eps
+  bool fallback = false;        // solved with a working precision LU
+};
+
+// normwise backward error of the n by m X in the inf norm, R = B - A X
+template <typename T>
+double backward_error(const double anorm, MatrixView<const T> R,
+                      MatrixView<const T> X, MatrixView<const T> B) {
+  double res = 0.0;
+  for (int col = 0; col < X.cols; col++) {
+    double r = 0.0, x = 0.0, b = 0.0;
+    for (int row = 0; row < X.rows; row++) {
+      r = std::max<double>(r, ABS<T>(R(row, col)));
+      x = std::max<double>(x, ABS<T>(X(row, col)));
+      b = std::max<double>(b, ABS<T>(B(row, col)));
+    }
+    const double d = anorm * x + b;
+    if (r > 0.0) res = std::max(res, (d > 0.0) ? r / d : HUGE_VAL);
   }
+  return res;
+}
 
-  delete[] tA;
-  delete[] tAA;
-  delete[] tcol;
-  delete[] icol;
-  delete[] perm;
+// solve AX = B by an LU factorization in the lower precision L and
+// iterative refinement with residuals in the working precision T
+// (LAPACK dsgesv): X += (LU)**-1 (B - AX) until the backward error is at
+// most sqrt(n) eps(T); if that fails within max_iter steps, or the
+// factorization in L overflows, A is factored again in T
+template <typename T, typename L = float>
+RefineInfo plusolve_mixed(MatrixView<const T> A, MatrixView<T> X,
+                          MatrixView<const T> B, kl::ThreadPool& pool,
+                          const int max_iter = 30) {
+  RefineInfo info;
+  const int n = A.rows, m = X.cols, rhs_block = 16;
+  if (n < 1 || m < 1) return info;
+  using std::sqrt;
+  const double eps = std::numeric_limits<T>::epsilon(), tol = sqrt(n) * eps;
+  double anorm = 0.0;
+  for (int row = 0; row < n; row++) {
+    double s = 0.0;
+    for (int col = 0; col < n; col++) s += ABS<T>(A(row, col));
+    anorm = std::max(anorm, s);
+  }
+
+  std::vector<T> rbuf(n * m);
+  std::vector<L> abuf(n * n), dbuf(n * m);
+  MatrixView<T> R(rbuf.data(), n, m, X.layout);
+  MatrixView<L> Al(abuf.data(), n, n, A.layout), D(dbuf.data(), n, m, X.layout);
+  // R = B - A X, in blocks of columns
+  auto residual = [&] {
+    copymat<T>(B, R);
+    kl::parallel_for(pool, 0, m, rhs_block, [&](size_t lo, size_t hi) {
+      gemm_sub<T>(A, X.block(0, lo, n, hi - lo), R.block(0, lo, n, hi - lo));
+    });
+    return backward_error<T>(anorm, R, X, B);
+  };
+  auto finite = [](MatrixView<const L> M) {
+    for (int col = 0; col < M.cols; col++)
+      for (int row = 0; row < M.rows; row++)
+        if (!std::isfinite(static_cast<double>(M(row, col)))) return false;
+    return true;
+  };
+
+  castmat<L, T>(A, Al);
+  bool ok = finite(Al);
+  if (ok) {
+    LUFactorization<L> lu(Al, pool);
+    castmat<L, T>(B, D);
+    lu.solve(D, D, pool);
+    ok = finite(D);
+    if (ok) castmat<T, L>(D, X);
+    while (ok) {
+      info.backward_error = residual();
+      if (info.backward_error <= tol) {
+        info.converged = true;
+        return info;
+      }
+      if (info.iterations == max_iter) break;
+      castmat<L, T>(R, D);
+      lu.solve(D, D, pool);
+      if (!(ok = finite(D))) break;
+      for (int col = 0; col < m; col++)
+        for (int row = 0; row < n; row++) X(row, col) += D(row, col);
+      info.iterations++;
+    }
+  }
+
+  info.fallback = true;
+  LUFactorization<T> lu(A, pool);
+  lu.solve(X, B, pool);
+  info.backward_error = residual();
+  info.converged = info.backward_error <= tol;
+  return info;
+}
+
+template <typename T, typename L = float>
+RefineInfo plusolve_mixed(MatrixView<const T> A, MatrixView<T> X,
+                          MatrixView<const T> B, const int max_iter = 30) {
+  kl::ThreadPool serial(1);
+  return plusolve_mixed<T, L>(A, X, B, serial, max_iter);
+}
+
+template <typename T, typename L = float>
+RefineInfo plusolve_mixed(const int n, const T* A, const int m, T* X,
+                          const T* B, const int max_iter = 30) {
+  return plusolve_mixed<T, L>(MatrixView<const T>(A, n, n),
+                              MatrixView<T>(X, n, m),
+                              MatrixView<const T>(B, n, m), max_iter);
+}
+
+template <typename T, typename L = float>
+RefineInfo plusolve_mixed(const int n, const T* A, const int m, T* X,
+                          const T* B, kl::ThreadPool& pool,
+                          const int max_iter = 30) {
+  return plusolve_mixed<T, L>(MatrixView<const T>(A, n, n),
+                              MatrixView<T>(X, n, m),
+                              MatrixView<const T>(B, n, m), pool, max_iter);
 }
 
 // take inverse of A
 // A[i][j] = A[i + n*j]
+template <typename T>
+void luinverse(MatrixView<T> A) {
+  const int n = A.rows;
+  std::vector<T> buf(n * n);
+  MatrixView<T> LU(buf.data(), n, n, A.layout);
+  copymat<T>(A, LU);
+  ludec<T>(LU);
+  for (int col = 0; col < n; col++)
+    for (int row = 0; row < n; row++) A(row, col) = (row == col);
+  trsm_low1<T>(LU, A);  // now A is L**-1
+  trsm_up<T>(LU, A);    // now A is U**-1 L**-1
+}
+
 template <typename T>
 void luinverse(const int n, T* A) {
-  int row, col;
-  T* tA = new T[n * n];
-  T* tcol = new T[n];
-  T* icol = new T[n];
-  ludec<T>(n, A);
-  for (int row = 0; row < n; row++)
-    for (int col = 0; col < n; col++) tA[row * n + col] = A[row + n * col];
-
-  for (col = 0; col < n; col++) {
-    for (row = 0; row < n; row++) icol[row] = 0.0;
-    icol[col] = 1.0;
-    low1sub<T>(n, tA, tcol, icol);                               // now tcol is UA**-1
-    upsub<T>(n, tA, icol, tcol);                                 // now icol is A**-1
-    for (row = 0; row < n; row++) A[row + n * col] = icol[row];  // update icol to A**-1
-  }
-  delete[] tA;
-  delete[] tcol;
-  delete[] icol;
+  luinverse<T>(MatrixView<T>(A, n, n));
+}
+
+// C -= A * diag(d) * B**T with A m by k, B n by k, a null d means identity
+// lower only updates C(i, j) with i >= j
+template <typename T>
+void gemm_nt_sub(MatrixView<const T> A, MatrixView<const T> B, const T* d,
+                 MatrixView<T> C, const bool lower) {
+  const int m = C.rows, n = C.cols, k = A.cols;
+  // lower is only used on square diagonal tiles
+  KL_STATS_ADD(flops, 2 * uint64_t(k) *
+                          (lower ? uint64_t(n) * (n + 1) / 2 : uint64_t(m) * n));
+  if (C.col_major() && A.col_major()) {
+    const int slab = 256;
+    for (int i0 = 0; i0 < m; i0 += slab) {
+      const int i1 = std::min(m, i0 + slab);
+      for (int col = 0; col < n; col++) {
+        T* c = &C(0, col);
+        const int ilo = lower ? std::max(i0, col) : i0;
+        for (int p = 0; p < k; p++) {
+          T b = B(col, p);
+          if (d) b *= d[p];
+          if (b == 0.0) continue;
+          const T* a = &A(0, p);
+          for (int i = ilo; i < i1; i++) c[i] -= a[i] * b;
+        }
+      }
+    }
+  } else {  // dot products along the rows of A and B
+    for (int row = 0; row < m; row++) {
+      const int jhi = lower ? std::min(n, row + 1) : n;
+      for (int col = 0; col < jhi; col++) {
+        T sum = 0.0;
+        for (int p = 0; p < k; p++)
+          sum += (d ? A(row, p) * d[p] : A(row, p)) * B(col, p);
+        C(row, col) -= sum;
+      }
+    }
+  }
+}
+
+// unblocked right looking Cholesky A = L L**T on the lower triangle of A
+// returns false when A is not positive definite
+template <typename T>
+bool choldec_panel(MatrixView<T> A) {
+  using std::sqrt;
+  const int n = A.rows;
+  for (int j = 0; j < n; j++) {
+    T d = A(j, j);
+    if (!(d > 0.0)) return false;
+    KL_STATS_ADD(flops, uint64_t(n - j) * (n - j));
+    d = sqrt(d);
+    A(j, j) = d;
+    for (int i = j + 1; i < n; i++) A(i, j) /= d;
+    for (int col = j + 1; col < n; col++) {
+      const T l = A(col, j);
+      for (int i = col; i < n; i++) A(i, col) -= A(i, j) * l;
+    }
+  }
+  return true;
+}
+
+// unblocked right looking A = L D L**T on the lower triangle of A
+// L has a unit diagonal, D is stored on the diagonal of A
+// returns false on a zero pivot
+template <typename T>
+bool ldldec_panel(MatrixView<T> A) {
+  const int n = A.rows;
+  for (int j = 0; j < n; j++) {
+    const T d = A(j, j);
+    if (d == 0.0) return false;
+    KL_STATS_ADD(flops, uint64_t(n - j - 1) * (n - j + 2));
+    for (int col = j + 1; col < n; col++) {
+      const T l = A(col, j) / d;
+      for (int i = col; i < n; i++) A(i, col) -= A(i, j) * l;
+    }
+    for (int i = j + 1; i < n; i++) A(i, j) /= d;
+  }
+  return true;
+}
+
+// tiled right looking Cholesky (ldl false) or LDL**T (ldl true) of the
+// lower triangle of the n by n matrix A, scheduled as a task DAG on pool
+// per step k: factor the diagonal tile, solve the tiles below it, then
+// update every trailing tile (i, j) once both of its panel tiles are ready.
+// Updates of a tile are chained in k order, so the result does not depend
+// on the pool size. Without a pool the tasks run inline in the same order
+// and the factorization stops at the first bad pivot; with one, the tasks
+// left once a bad pivot is found do nothing.
+// The strict upper triangle of A is not referenced.
+template <typename T>
+bool symdec(MatrixView<T> A, const bool ldl, kl::ThreadPool* pool,
+            int nb = 64) {
+  KL_STATS_TIMER(ldl ? "ldldec" : "choldec");
+  nb = std::max(1, nb);
+  const int n = A.rows;
+  if (n < 1) return true;
+  const int nt = (n + nb - 1) / nb;
+  std::vector<T> D(ldl ? n : 0);
+  std::atomic<bool> ok{true};
+  kl::TaskGraph graph;
+  const size_t none = -1;
+  std::vector<size_t> last(nt * nt, none);  // last task on tile (i, j)
+  auto tile = [=](int i, int j) {
+    return A.block(i * nb, j * nb, std::min(nb, n - i * nb),
+                   std::min(nb, n - j * nb));
+  };
+  auto after = [&](std::vector<size_t> deps, int i, int j) {
+    if (last[i + nt * j] != none) deps.push_back(last[i + nt * j]);
+    return deps;
+  };
+  auto add = [&](std::function<void()> fn, std::vector<size_t> deps) {
+    if (pool) return graph.add(std::move(fn), std::move(deps));
+    fn();
+    return none;
+  };
+  T* d = D.data();
+
+  std::vector<size_t> solved(nt);
+  for (int k = 0; k < nt; k++) {
+    const auto diag = add(
+        [=, &ok] {
+          if (!ok) return;
+          MatrixView<T> Akk = tile(k, k);
+          if (!(ldl ? ldldec_panel<T>(Akk) : choldec_panel<T>(Akk))) ok = false;
+          if (ldl)
+            for (int i = 0; i < Akk.rows; i++) d[k * nb + i] = Akk(i, i);
+        },
+        after({}, k, k));
+    if (!pool && !ok) return false;
+
+    for (int i = k + 1; i < nt; i++) {
+      solved[i] = add(
+          [=, &ok] {
+            if (!ok) return;
+            MatrixView<T> Aik = tile(i, k);
+            trsm_low<T>(tile(k, k), Aik.t(), ldl);  // Aik := Aik L**-T
+            if (ldl)
+              for (int col = 0; col < Aik.cols; col++)
+                for (int row = 0; row < Aik.rows; row++)
+                  Aik(row, col) /= d[k * nb + col];
+          },
+          after({diag}, i, k));
+    }
+
+    for (int i = k + 1; i < nt; i++) {
+      for (int j = k + 1; j <= i; j++) {
+        std::vector<size_t> deps = {solved[i]};
+        if (j != i) deps.push_back(solved[j]);
+        last[i + nt * j] = add(
+            [=, &ok] {
+              if (!ok) return;
+              gemm_nt_sub<T>(tile(i, k), tile(j, k), ldl ? d + k * nb : nullptr,
+                             tile(i, j), i == j);
+            },
+            after(deps, i, j));
+      }
+    }
+  }
+
+  if (pool) graph.run(*pool);
+  return ok;
+}
+
+// Cholesky decomposition A = L L**T of a symmetric positive definite A
+// only the lower triangle of A is read and overwritten by L,
+// returns false when A is not positive definite
+template <typename T>
+bool choldec(MatrixView<T> A, kl::ThreadPool& pool, const int nb = 64) {
+  return symdec<T>(A, false, &pool, nb);
+}
+
+template <typename T>
+bool choldec(MatrixView<T> A, const int nb = 64) {
+  return symdec<T>(A, false, nullptr, nb);
+}
+
+template <typename T>
+bool choldec(const int n, T* A) {
+  return choldec<T>(MatrixView<T>(A, n, n));
+}
+
+// LDL**T decomposition of a symmetric A without pivoting
+// the lower triangle of A is overwritten by the unit L and D (on the
+// diagonal), returns false on a zero pivot
+template <typename T>
+bool ldldec(MatrixView<T> A, kl::ThreadPool& pool, const int nb = 64) {
+  return symdec<T>(A, true, &pool, nb);
+}
+
+template <typename T>
+bool ldldec(MatrixView<T> A, const int nb = 64) {
+  return symdec<T>(A, true, nullptr, nb);
+}
+
+template <typename T>
+bool ldldec(const int n, T* A) {
+  return ldldec<T>(MatrixView<T>(A, n, n));
+}
+
+// solve AX = B in place (B := X) given the factor L of choldec
+template <typename T>
+void cholsub(MatrixView<const T> L, MatrixView<T> B) {
+  trsm_low<T>(L, B, false);  // solve for L*Y = B
+  trsm_up<T>(L.t(), B);      // solve for L**T*X = Y
+}
+
+// solve AX = B in place (B := X) given the factors of ldldec
+template <typename T>
+void ldlsub(MatrixView<const T> LD, MatrixView<T> B) {
+  trsm_low1<T>(LD, B);  // solve for L*Y = B
+  for (int col = 0; col < B.cols; col++)
+    for (int row = 0; row < B.rows; row++) B(row, col) /= LD(row, row);
+  trsm_up<T>(LD.t(), B, true);  // solve for L**T*X = D**-1*Y
+}
+
+// solve AX = B for a symmetric positive definite A (n by n, lower triangle
+// read), B and X are n by m; returns false when A is not positive definite
+template <typename T>
+bool cholsolve(MatrixView<const T> A, MatrixView<T> X, MatrixView<const T> B) {
+  const int n = A.rows;
+  std::vector<T> buf(n * n);
+  MatrixView<T> L(buf.data(), n, n, A.layout);
+  copymat<T>(A, L);
+  if (!choldec<T>(L)) return false;
+  if (X.data != B.data) copymat<T>(B, X);
+  cholsub<T>(L, X);
+  return true;
+}
+
+template <typename T>
+bool cholsolve(const int n, const T* A, const int m, T* X, const T* B) {
+  return cholsolve<T>(MatrixView<const T>(A, n, n), MatrixView<T>(X, n, m),
+                      MatrixView<const T>(B, n, m));
+}
+
+// same as cholsolve for a symmetric A with nonzero LDL**T pivots
+template <typename T>
+bool ldlsolve(MatrixView<const T> A, MatrixView<T> X, MatrixView<const T> B) {
+  const int n = A.rows;
+  std::vector<T> buf(n * n);
+  MatrixView<T> LD(buf.data(), n, n, A.layout);
+  copymat<T>(A, LD);
+  if (!ldldec<T>(LD)) return false;
+  if (X.data != B.data) copymat<T>(B, X);
+  ldlsub<T>(LD, X);
+  return true;
+}
+
+template <typename T>
+bool ldlsolve(const int n, const T* A, const int m, T* X, const T* B) {
+  return ldlsolve<T>(MatrixView<const T>(A, n, n), MatrixView<T>(X, n, m),
+                     MatrixView<const T>(B, n, m));
+}
+
+// X (n by k) minimizing |A X - B| for an m by n A (m >= n) by Householder
+// QR; unlike the normal equations it does not square the condition number
+// of A. A is overwritten by R and the reflectors, B (m by k) by Q**T B;
+// a rank deficient A gives infinities or NaNs
+template <typename T>
+void qrsolve(MatrixView<T> A, MatrixView<T> B, MatrixView<T> X) {
+  using std::sqrt;
+  const int m = A.rows, n = A.cols, k = B.cols;
+  for (int j = 0; j < n; j++) {
+    KL_STATS_ADD(flops, uint64_t(m - j) * (4 * (n - j - 1 + k) + 2));
+    T norm = 0.0;
+    for (int i = j; i < m; i++) norm += A(i, j) * A(i, j);
+    norm = sqrt(norm);
+    if (norm == 0.0) continue;  // zero column, R(j, j) = 0
+    // H = I - tau v v**T maps column j to alpha e_j, v is kept in place
+    const T alpha = (A(j, j) > 0.0) ? -norm : norm;
+    A(j, j) -= alpha;
+    const T tau = -1.0 / (alpha * A(j, j));
+    auto reflect = [&](MatrixView<T> C, int col) {
+      T dot = 0.0;
+      for (int i = j; i < m; i++) dot += A(i, j) * C(i, col);
+      dot *= tau;
+      for (int i = j; i < m; i++) C(i, col) -= dot * A(i, j);
+    };
+    for (int col = j + 1; col < n; col++) reflect(A, col);
+    for (int col = 0; col < k; col++) reflect(B, col);
+    A(j, j) = alpha;
+  }
+  copymat<T>(B.block(0, 0, n, k), X);
+  trsm_up<T>(A.block(0, 0, n, n), X);
 }
 
 // linear least squares fit y = sum_c[i]*f[i](x)
@@ -287,35 +1181,236 @@ void lls(const int m, const int n, const T* _f, const T* _y, T* coefs) {
     std::cout << "Invalid LLS parameters!\n";
     return;
   }
+  KL_STATS_TIMER("lls");
+  KL_STATS_ADD(flops, uint64_t(n) * m * (m + 3));
+
+  // accumulate the normal equations sample by sample, _f[a + m * i] is
+  // contiguous in a; only the lower triangle of f is needed
+  std::vector<T> f(m * m, 0.0), y(m, 0.0);
+  for (int i = 0; i < n; ++i) {
+    const T* fi = _f + m * i;
+    for (int b = 0; b < m; ++b) {
+      y[b] += _y[i] * fi[b];
+      for (int a = b; a < m; ++a) f[a + m * b] += fi[a] * fi[b];
+    }
+  }
+
+  // f is positive definite unless the basis is degenerate on the samples,
+  // then fall back to pivoted LU on the full matrix
+  if (!cholsolve<T>(m, f.data(), 1, coefs, y.data())) {
+    for (int b = 0; b < m; ++b)
+      for (int a = 0; a < b; ++a) f[a + m * b] = f[b + m * a];
+    plusolve<T>(m, f.data(), 1, coefs, y.data());
+  }
+}
+
+// least squares fit y = sum_c[a]*f[a](x) over a stream of samples
+// keeps the triangular factor R of the QR decomposition of the samples seen
+// so far together with z = Q**T y, i.e. O(m^2) memory whatever the number
+// of samples. Rows are rotated in with Givens rotations (LINPACK dchud) and
+// out with the LINPACK dchdd downdate, so the fit never forms the normal
+// equations. Partial accumulators built on separate chunks merge into one.
+template <typename T>
+class StreamingLLS final {
+ public:
+  explicit StreamingLLS(const int m)
+      : m_{m}, count_{0}, rho_{0.0}, R_(m * (m + 1), 0.0), c_(m), s_(m) {}
+
+  int size() const noexcept { return m_; }
+  long count() const noexcept { return count_; }
+  // norm of the residual y - F*c of the current least squares solution
+  T residual() const noexcept { return rho_; }
+
+  // add k samples, same layout as lls: f[a + m*i] is f[a](x_i), y[i] = y_i
+  void add(const int k, const T* f, const T* y) {
+    for (int i = 0; i < k; ++i) this->rotate_in(f + m_ * i, y[i], 0);
+    count_ += k;
+  }
 
-  T* f = new T[m * m];
-  T* y = new T[m];
+  // same as above, the chunk is cut into pieces that are accumulated in
+  // parallel and merged in a fixed order, the result does not depend on the
+  // pool size
+  void add(const int k, const T* f, const T* y, kl::ThreadPool& pool) {
+    const int grain = std::max(1024, (k + 63) / 64);
+    const int nparts = (k + grain - 1) / grain;
+    std::vector<StreamingLLS> parts(nparts, StreamingLLS(m_));
+    kl::parallel_for(pool, 0, nparts, 1, [&](size_t lo, size_t hi) {
+      for (size_t p = lo; p < hi; ++p) {
+        const int i0 = p * grain, i1 = std::min(k, i0 + grain);
+        parts[p].add(i1 - i0, f + m_ * i0, y + i0);
+      }
+    });
+    for (const auto& part : parts) this->merge(part);
+  }
 
-  for (int a = 0; a < m; ++a) {
-    y[a] = 0.0;
-    for (int i = 0; i < n; ++i) y[a] += _y[i] * _f[a + m * i];
+  // remove k samples that were added before; stops and returns false at the
+  // first sample that cannot be removed, that sample is left in
+  bool remove(const int k, const T* f, const T* y) {
+    for (int i = 0; i < k; ++i) {
+      if (!this->rotate_out(f + m_ * i, y[i])) return false;
+      --count_;
+    }
+    return true;
   }
 
-  for (int a = 0; a < m; ++a) {
-    f[a + m * a] = 0.0;
-    for (int i = 0; i < n; ++i) f[a + m * a] += _f[a + m * i] * _f[a + m * i];
-    for (int b = a + 1; b < m; ++b) {
-      f[a + m * b] = 0.0;
-      for (int i = 0; i < n; ++i) f[a + m * b] += _f[a + m * i] * _f[b + m * i];
-      f[b + m * a] = f[a + m * b];
+  // fold in the samples of another accumulator of the same size
+  void merge(const StreamingLLS& rhs) {
+    std::vector<T> row(m_);
+    for (int i = 0; i < m_; ++i) {
+      for (int j = i; j < m_; ++j) row[j] = rhs.R_[i + m_ * j];
+      this->rotate_in(row.data(), rhs.R_[i + m_ * m_], i);
     }
+    rho_ = hypot(rho_, rhs.rho_);
+    count_ += rhs.count_;
   }
 
-  luinverse<T>(m, f);
-  for (int a = 0; a < m; ++a) {
-    coefs[a] = 0.0;
-    for (int b = 0; b < m; ++b) coefs[a] += f[a + m * b] * y[b];
+  // coefs := R**-1 z, returns false while R is singular
+  bool solve(T* coefs) const {
+    for (int a = 0; a < m_; ++a) {
+      if (R_[a + m_ * a] == 0.0) return false;
+      coefs[a] = R_[a + m_ * m_];
+    }
+    trsm_up<T>(MatrixView<const T>(R_.data(), m_, m_),
+               MatrixView<T>(coefs, m_, 1));
+    return true;
   }
 
-  delete[] f;
-  delete[] y;
+ private:
+  static T hypot(T a, T b) {
+    using std::sqrt;
+    const T scale = ABS<T>(a) + ABS<T>(b);
+    if (scale == 0.0) return scale;
+    a /= scale;
+    b /= scale;
+    return scale * sqrt(a * a + b * b);
+  }
+
+  // rotate the row [x | y] into [R | z], x[0..first) are zero
+  void rotate_in(const T* x, const T y, const int first) {
+    for (int j = first; j <= m_; ++j) {
+      T xj = (j < m_) ? x[j] : y;
+      T* r = &R_[m_ * j];
+      for (int i = first; i < std::min(j, m_); ++i) {
+        const T t = c_[i] * r[i] + s_[i] * xj;
+        xj = c_[i] * xj - s_[i] * r[i];
+        r[i] = t;
+      }
+      if (j == m_) {
+        rho_ = hypot(rho_, xj);
+      } else if (xj == 0.0) {
+        c_[j] = 1.0;
+        s_[j] = 0.0;
+      } else {
+        const T h = hypot(r[j], xj);
+        c_[j] = r[j] / h;
+        s_[j] = xj / h;
+        r[j] = h;
+      }
+    }
+  }
+
+  // downdate [R | z] by the row [x | y]
+  bool rotate_out(const T* x, const T y) {
+    using std::sqrt;
+    // solve R**T a = x into s_
+    T norm = 0.0;
+    for (int j = 0; j < m_; ++j) {
+      const T* r = &R_[m_ * j];
+      if (r[j] == 0.0) return false;
+      T sum = x[j];
+      for (int i = 0; i < j; ++i) sum -= r[i] * s_[i];
+      s_[j] = sum / r[j];
+      norm += s_[j] * s_[j];
+    }
+    if (norm >= 1.0) return false;
+
+    T alpha = sqrt(1.0 - norm);
+    for (int i = m_ - 1; i >= 0; --i) {
+      const T scale = alpha + ABS<T>(s_[i]);
+      const T a = alpha / scale, b = s_[i] / scale;
+      const T h = sqrt(a * a + b * b);
+      c_[i] = a / h;
+      s_[i] = b / h;
+      alpha = scale * h;
+    }
+    for (int j = 0; j < m_; ++j) {
+      T* r = &R_[m_ * j];
+      T xx = 0.0;
+      for (int i = j; i >= 0; --i) {
+        const T t = c_[i] * xx + s_[i] * r[i];
+        r[i] = c_[i] * r[i] - s_[i] * xx;
+        xx = t;
+      }
+    }
+    T* z = &R_[m_ * m_];
+    T zeta = y;
+    for (int i = 0; i < m_; ++i) {
+      z[i] = (z[i] - s_[i] * zeta) / c_[i];
+      zeta = c_[i] * zeta - s_[i] * z[i];
+    }
+    const T azeta = ABS<T>(zeta);
+    rho_ = (azeta < rho_) ? rho_ * sqrt(1.0 - (azeta / rho_) * (azeta / rho_))
+                          : T(0.0);
+    return true;
+  }
+
+  int m_;
+  long count_;
+  T rho_;
+  std::vector<T> R_;  // [R | z], m by m + 1 column-major
+  std::vector<T> c_, s_;
+};
+
+// power sums S[k] = sum_i x_i^k for k < 2 * deg - 1 and moments
+// t[a] = sum_i x_i^a f_i for a < deg, in a single pass over the samples.
+// The powers are running products kept for a block of lanes samples at a
+// time, so the inner loops run over independent lanes and vectorize.
+template <typename T>
+void polysums(const int deg, const int n, const T* x, const T* f, T* S, T* t) {
+  const int ns = 2 * deg - 1, lanes = 8;
+  std::vector<T> acc(ns * lanes, 0.0), mom(deg * lanes, 0.0);
+  T p[lanes], fp[lanes];
+  int i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    const T* xi = x + i;
+    for (int l = 0; l < lanes; l++) {
+      p[l] = 1.0;
+      fp[l] = f[i + l];
+    }
+    for (int k = 0; k < ns; k++) {
+      T* ak = &acc[k * lanes];
+      for (int l = 0; l < lanes; l++) ak[l] += p[l];
+      if (k < deg) {
+        T* mk = &mom[k * lanes];
+        for (int l = 0; l < lanes; l++) mk[l] += fp[l];
+        for (int l = 0; l < lanes; l++) fp[l] *= xi[l];
+      }
+      for (int l = 0; l < lanes; l++) p[l] *= xi[l];
+    }
+  }
+  for (int l = 0; i < n; i++, l++) {  // leftover samples, one lane each
+    T pp = 1.0, ff = f[i];
+    for (int k = 0; k < ns; k++) {
+      acc[k * lanes + l] += pp;
+      if (k < deg) {
+        mom[k * lanes + l] += ff;
+        ff *= x[i];
+      }
+      pp *= x[i];
+    }
+  }
+  for (int k = 0; k < ns; k++) {
+    S[k] = 0.0;
+    for (int l = 0; l < lanes; l++) S[k] += acc[k * lanes + l];
+  }
+  for (int a = 0; a < deg; a++) {
+    t[a] = 0.0;
+    for (int l = 0; l < lanes; l++) t[a] += mom[a * lanes + l];
+  }
 }
 
+// fit f = sum_a coefs[a] * x^a with deg coefficients
+// M[a][b] = S[a + b] is built from the power sums, then solved by Cholesky
 template <typename T>
 void polyfit(const int deg, const int n, const T* x, const T* f, T* coefs) {
   if (deg >= n) {
@@ -323,37 +1418,112 @@ void polyfit(const int deg, const int n, const T* x, const T* f, T* coefs) {
     return;
   }
 
-  T* u = new T[deg];
-  T* M = new T[deg * deg];
+  std::vector<T> S(2 * deg - 1), u(deg), M(deg * deg);
+  polysums<T>(deg, n, x, f, S.data(), u.data());
+  for (int b = 0; b < deg; ++b)
+    for (int a = 0; a < deg; ++a) M[a + deg * b] = S[a + b];
+
+  if (!cholsolve<T>(deg, M.data(), 1, coefs, u.data()))
+    plusolve<T>(deg, M.data(), 1, coefs, u.data());
+}
 
-  for (int a = 0; a < deg; ++a) {
-    T val = 0.0;
-    for (int i = 0; i < n; ++i) val += npow<T>(x[i], a * 2);
-    M[a + deg * a] = val;
-    for (int b = a + 1; b < deg; ++b) {
-      T earl = 0.0;
-      for (int i = 0; i < n; ++i) earl += npow<T>(x[i], a + b);
-      M[a + deg * b] = earl;
-      M[b + deg * a] = earl;
+// batched polyfit of nseries independent series of n samples each
+// series s has samples x[s * ldx + i], f[s * n + i] and gets its deg
+// coefficients in coefs[s * deg + a]; ldx = 0 shares one x among all series.
+// The series are spread over the pool.
+template <typename T>
+void polyfit(const int deg, const int n, const int nseries, const T* x,
+             const int ldx, const T* f, T* coefs, kl::ThreadPool& pool) {
+  if (deg >= n) {
+    std::cout << "Invalid parameters in polyfit!\n";
+    return;
+  }
+  const int grain = 64;
+  kl::parallel_for(pool, 0, nseries, grain, [&](size_t lo, size_t hi) {
+    std::vector<T> S(2 * deg - 1), u(deg), M(deg * deg), L(deg * deg);
+    for (size_t s = lo; s < hi; ++s) {
+      T* c = coefs + deg * s;
+      polysums<T>(deg, n, x + ldx * s, f + n * s, S.data(), u.data());
+      for (int b = 0; b < deg; ++b)
+        for (int a = 0; a < deg; ++a) M[a + deg * b] = S[a + b];
+      L = M;
+      for (int a = 0; a < deg; ++a) c[a] = u[a];
+      if (choldec_panel<T>(MatrixView<T>(L.data(), deg, deg)))
+        cholsub<T>(MatrixView<const T>(L.data(), deg, deg),
+                   MatrixView<T>(c, deg, 1));
+      else
+        plusolve<T>(deg, M.data(), 1, c, u.data());
+    }
+  });
+}
+
+// least squares polynomial fit with deg coefficients in the basis of the
+// polynomials orthogonal on the sample points (Forsythe, 1957)
+// p_0 = 1, p_1 = x - a_0, p_k+1 = (x - a_k) p_k - b_k p_k-1
+// the fit is sum_k c_k p_k(x); no linear system is solved, so the
+// conditioning of the monomial normal equations never enters
+template <typename T>
+class OrthoPolyFit final {
+ public:
+  OrthoPolyFit(const int deg, const int n, const T* x, const T* f)
+      : a_(deg, 0.0), b_(deg, 0.0), c_(deg, 0.0) {
+    std::vector<T> prev(n, 0.0), p(n, 1.0), r(f, f + n);
+    T norm_prev = 1.0;
+    for (int k = 0; k < deg; k++) {
+      T norm = 0.0, xpp = 0.0, rp = 0.0;
+      for (int i = 0; i < n; i++) {
+        const T pp = p[i] * p[i];
+        norm += pp;
+        xpp += x[i] * pp;
+        rp += r[i] * p[i];
+      }
+      if (norm == 0.0) break;  // fewer distinct points than coefficients
+      c_[k] = rp / norm;
+      a_[k] = xpp / norm;
+      b_[k] = (k > 0) ? norm / norm_prev : T(0.0);
+      norm_prev = norm;
+      // residual update (modified Gram-Schmidt) and next polynomial
+      for (int i = 0; i < n; i++) {
+        r[i] -= c_[k] * p[i];
+        const T next = (x[i] - a_[k]) * p[i] - b_[k] * prev[i];
+        prev[i] = p[i];
+        p[i] = next;
+      }
     }
   }
 
-  for (int a = 0; a < deg; ++a) {
-    T val = 0.0;
-    for (int i = 0; i < n; ++i) val += npow<T>(x[i], a) * f[i];
-    u[a] = val;
+  int size() const noexcept { return c_.size(); }
+
+  T operator()(const T x) const {
+    T prev = 0.0, p = 1.0, res = 0.0;
+    for (int k = 0; k < this->size(); k++) {
+      res += c_[k] * p;
+      const T next = (x - a_[k]) * p - b_[k] * prev;
+      prev = p;
+      p = next;
+    }
+    return res;
   }
 
-  luinverse<T>(deg, M);
-  for (int a = 0; a < deg; ++a) {
-    T val = 0.0;
-    for (int b = 0; b < deg; ++b) val += M[a + deg * b] * u[b];
-    coefs[a] = val;
+  // the same polynomial as sum_a coefs[a] * x^a
+  void monomial(T* coefs) const {
+    const int deg = this->size();
+    std::vector<T> prev(deg + 1, 0.0), p(deg + 1, 0.0), next(deg + 1);
+    p[0] = 1.0;
+    for (int a = 0; a < deg; a++) coefs[a] = 0.0;
+    for (int k = 0; k < deg; k++) {
+      for (int a = 0; a <= k; a++) coefs[a] += c_[k] * p[a];
+      for (int a = 0; a <= k + 1; a++) {
+        next[a] = (a > 0 ? p[a - 1] : T(0.0)) - a_[k] * p[a] - b_[k] * prev[a];
+      }
+      std::swap(prev, p);
+      std::swap(p, next);
+    }
   }
 
-  delete[] u;
-  delete[] M;
-}
+ private:
+  std::vector<T> a_, b_, c_;
+};
 
 // fit y = A * x^n where c[0] = A and c[1] = n
 // using linear least squares lls
@@ -376,4 +1546,208 @@ void powerfit(const int n, const T* _x, const T* _y, T* coefs) {
 
   delete[] y;
   delete[] f;
-}
\ No newline at end of file
+}
+
+// Batched LU of many small N by N systems, N known at compile time.
+// Matrices are interleaved in groups of W lanes: element (i, j) of matrix
+// g * W + l sits at A[g * N * N * W + (i + N * j) * W + l], a right hand
+// side x_i at B[g * N * W + i * W + l], so the lane loop is the innermost,
+// unit stride one. Storage covers whole groups; lanes past the batch count
+// in the last group are neither read nor written.
+
+// f(k) for k = 0 .. N - 1 with k a std::integral_constant
+template <int... I, typename F>
+inline void unroll_seq(std::integer_sequence<int, I...>, F&& f) {
+  (f(std::integral_constant<int, I>()), ...);
+}
+template <int N, typename F>
+inline void unroll(F&& f) {
+  unroll_seq(std::make_integer_sequence<int, N>(), f);
+}
+
+// LU with partial pivoting of the W matrices of one group, in place
+// perm[i * W + l] is the original row of row i of lane l
+// returns the number of lanes with a zero pivot
+template <int N, int W, typename T>
+int lanes_ludec(T* A, int* perm) {
+  auto a = [A](int i, int j) { return A + (i + N * j) * W; };
+  bool bad[W] = {};
+  unroll<N>([&](auto i) {
+    for (int l = 0; l < W; ++l) perm[i * W + l] = i;
+  });
+  unroll<N>([&](auto kk) {
+    constexpr int k = decltype(kk)::value;
+    // bubble the largest |a_rk| of each lane up into row k
+    unroll<N>([&](auto rr) {
+      constexpr int r = decltype(rr)::value;
+      if constexpr (r > k) {
+        bool s[W];
+        for (int l = 0; l < W; ++l)
+          s[l] = ABS<T>(a(r, k)[l]) > ABS<T>(a(k, k)[l]);
+        unroll<N>([&](auto j) {
+          T *x = a(k, j), *y = a(r, j);
+          for (int l = 0; l < W; ++l) {
+            const T u = x[l], v = y[l];
+            x[l] = s[l] ? v : u;
+            y[l] = s[l] ? u : v;
+          }
+        });
+        for (int l = 0; l < W; ++l) {
+          const int u = perm[k * W + l], v = perm[r * W + l];
+          perm[k * W + l] = s[l] ? v : u;
+          perm[r * W + l] = s[l] ? u : v;
+        }
+      }
+    });
+    T inv[W];
+    for (int l = 0; l < W; ++l) {
+      const T d = a(k, k)[l];
+      bad[l] = bad[l] || d == 0.0;
+      inv[l] = (d == 0.0) ? T(0.0) : T(1.0) / d;
+    }
+    unroll<N>([&](auto rr) {
+      constexpr int r = decltype(rr)::value;
+      if constexpr (r > k) {
+        T* m = a(r, k);
+        for (int l = 0; l < W; ++l) m[l] *= inv[l];
+        unroll<N>([&](auto jj) {
+          constexpr int j = decltype(jj)::value;
+          if constexpr (j > k) {
+            T* x = a(r, j);
+            const T* u = a(k, j);
+            for (int l = 0; l < W; ++l) x[l] -= m[l] * u[l];
+          }
+        });
+      }
+    });
+  });
+  int res = 0;
+  for (int l = 0; l < W; ++l) res += bad[l];
+  return res;
+}
+
+// B := A**-1 B for the W lanes of one group factored by lanes_ludec
+template <int N, int W, typename T>
+void lanes_lusolve(const T* LU, const int* perm, T* B) {
+  auto a = [LU](int i, int j) { return LU + (i + N * j) * W; };
+  T y[N * W];
+  unroll<N>([&](auto i) {
+    for (int l = 0; l < W; ++l) y[i * W + l] = B[perm[i * W + l] * W + l];
+  });
+  unroll<N>([&](auto ii) {
+    constexpr int i = decltype(ii)::value;
+    unroll<i>([&](auto j) {
+      for (int l = 0; l < W; ++l) y[i * W + l] -= a(i, j)[l] * y[j * W + l];
+    });
+  });
+  unroll<N>([&](auto ii) {
+    constexpr int i = N - 1 - decltype(ii)::value;
+    unroll<N>([&](auto jj) {
+      constexpr int j = decltype(jj)::value;
+      if constexpr (j > i) {
+        for (int l = 0; l < W; ++l) y[i * W + l] -= a(i, j)[l] * y[j * W + l];
+      }
+    });
+    for (int l = 0; l < W; ++l) y[i * W + l] /= a(i, i)[l];
+  });
+  std::copy(y, y + N * W, B);
+}
+
+// run f(A, perm, B) on every group of the batch over the pool
+// a partial last group goes through stack copies padded with identity
+// matrices, unit pivots and zero right hand sides; only the non const
+// operands are copied back, the others are never written
+template <int N, int W, typename T, typename TA, typename TP, typename F>
+int batch_groups(const int count, TA* A, TP* perm, T* B, kl::ThreadPool& pool,
+                 F&& f) {
+  const int full = count / W, rem = count % W;
+  const size_t grain = std::max(1, 4096 / (N * N * W));
+  std::atomic<int> bad{0};
+  kl::parallel_for(pool, 0, full, grain, [&](size_t lo, size_t hi) {
+    int res = 0;
+    for (size_t g = lo; g < hi; ++g) {
+      res += f(A ? A + g * N * N * W : nullptr, perm ? perm + g * N * W : nullptr,
+               B ? B + g * N * W : nullptr);
+    }
+    bad += res;
+  });
+  if (rem > 0) {
+    T a[N * N * W] = {}, b[N * W] = {};
+    int p[N * W];
+    for (int i = 0; i < N; ++i) {
+      for (int l = 0; l < W; ++l) {
+        a[(i + N * i) * W + l] = 1.0;
+        p[i * W + l] = i;
+      }
+    }
+    TA* ga = A ? A + full * N * N * W : nullptr;
+    TP* gp = perm ? perm + full * N * W : nullptr;
+    T* gb = B ? B + full * N * W : nullptr;
+    for (int l = 0; l < rem; ++l) {
+      for (int e = 0; e < N * N && ga; ++e) a[e * W + l] = ga[e * W + l];
+      for (int e = 0; e < N && gp; ++e) p[e * W + l] = gp[e * W + l];
+      for (int e = 0; e < N && gb; ++e) b[e * W + l] = gb[e * W + l];
+    }
+    bad += f(a, p, b);
+    for (int l = 0; l < rem; ++l) {
+      if constexpr (!std::is_const<TA>::value)
+        for (int e = 0; e < N * N && ga; ++e) ga[e * W + l] = a[e * W + l];
+      if constexpr (!std::is_const<TP>::value)
+        for (int e = 0; e < N && gp; ++e) gp[e * W + l] = p[e * W + l];
+      for (int e = 0; e < N && gb; ++e) gb[e * W + l] = b[e * W + l];
+    }
+  }
+  return bad;
+}
+
+// factor count interleaved N by N matrices in place, perm holds N ints per
+// matrix; returns the number of singular matrices
+template <int N, int W = 8, typename T>
+int batch_ludec(const int count, T* A, int* perm, kl::ThreadPool& pool) {
+  return batch_groups<N, W, T>(count, A, perm, nullptr, pool,
+                               [](T* a, int* p, T*) {
+                                 return lanes_ludec<N, W, T>(a, p);
+                               });
+}
+
+// B := A**-1 B for a batch factored by batch_ludec
+template <int N, int W = 8, typename T>
+void batch_lusolve(const int count, const T* LU, const int* perm, T* B,
+                   kl::ThreadPool& pool) {
+  batch_groups<N, W, T>(count, LU, perm, B, pool,
+                        [](const T* a, const int* p, T* b) {
+                          lanes_lusolve<N, W, T>(a, p, b);
+                          return 0;
+                        });
+}
+
+// B := A**-1 B, A is overwritten by its factors
+// returns the number of singular matrices
+template <int N, int W = 8, typename T>
+int batch_solve(const int count, T* A, T* B, kl::ThreadPool& pool) {
+  return batch_groups<N, W, T>(count, A, static_cast<int*>(nullptr), B, pool,
+                               [](T* a, int*, T* b) {
+                                 int p[N * W];
+                                 const int res = lanes_ludec<N, W, T>(a, p);
+                                 lanes_lusolve<N, W, T>(a, p, b);
+                                 return res;
+                               });
+}
+
+// move count items of len values each (N * N for column major matrices, N
+// for right hand sides), stored one after the other, into / out of the
+// interleaved layout
+template <int W = 8, typename T>
+void batch_pack(const int count, const int len, const T* src, T* dst) {
+  for (int m = 0; m < count; ++m) {
+    const int g = m / W, l = m % W;
+    for (int e = 0; e < len; ++e) dst[(g * len + e) * W + l] = src[m * len + e];
+  }
+}
+template <int W = 8, typename T>
+void batch_unpack(const int count, const int len, const T* src, T* dst) {
+  for (int m = 0; m < count; ++m) {
+    const int g = m / W, l = m % W;
+    for (int e = 0; e < len; ++e) dst[m * len + e] = src[(g * len + e) * W + l];
+  }
+}
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "algebra.h"
+
+#include <gtest/gtest.h>
+#include <time.h>
+
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+#include "utils.h"
+
+Rand rng(82 + time(nullptr));
+
+static std::vector<double> random_matrix(int m, int n) {
+  std::vector<double> A(m * n);
+  for (auto& a : A) a = rng.doub() - 0.5;
+  return A;
+}
+
+// max |A*X - B| for A n by n, X and B n by m
+static double residual(int n, int m, const double* A, const double* X,
+                       const double* B) {
+  double res = 0.0;
+  for (int col = 0; col < m; ++col) {
+    for (int row = 0; row < n; ++row) {
+      double v = -B[row + n * col];
+      for (int k = 0; k < n; ++k) v += A[row + n * k] * X[k + n * col];
+      res = std::max(res, ABS<double>(v));
+    }
+  }
+  return res;
+}
+
+TEST(test_parallel_lu, lu_reconstructs) {
+  const int n = 150;
+  auto A = random_matrix(n, n), LU = A;
+  std::vector<int> perm(2 * n);
+  kl::ThreadPool pool(4);
+  pludec<double>(n, LU.data(), perm.data(), pool, 16);
+  for (int row = 0; row < n; ++row) {
+    for (int col = 0; col < n; ++col) {
+      double v = 0.0;
+      for (int k = 0; k <= std::min(row, col); ++k) {
+        double l = (k == row) ? 1.0 : LU[row + n * k];
+        v += l * LU[k + n * col];
+      }
+      ASSERT_NEAR(v, A[perm[row] + n * col], 1e-10);
+    }
+  }
+
+  // a block size below one is taken as one
+  auto LU0 = A, LU1 = A, LUp = A;
+  std::vector<int> ipiv0(n), ipiv1(n), ipivp(n);
+  pludec_blocked<double>(MatrixView<double>(LU0.data(), n, n), ipiv0.data(), 0);
+  pludec_blocked<double>(MatrixView<double>(LU1.data(), n, n), ipiv1.data(), 1);
+  pludec_blocked<double>(MatrixView<double>(LUp.data(), n, n), ipivp.data(),
+                         pool, -3);
+  EXPECT_EQ(LU0, LU1);
+  EXPECT_EQ(LUp, LU1);
+  EXPECT_EQ(ipiv0, ipiv1);
+  EXPECT_EQ(ipivp, ipiv1);
+};
+
+TEST(test_parallel_lu, solve_reproducible) {
+  const int n = 200, m = 40;
+  auto A = random_matrix(n, n), B = random_matrix(n, m);
+  std::vector<double> X1(n * m), X4(n * m), X(n * m);
+  kl::ThreadPool pool1(1), pool4(4);
+  plusolve<double>(n, A.data(), m, X1.data(), B.data(), pool1);
+  plusolve<double>(n, A.data(), m, X4.data(), B.data(), pool4);
+  plusolve<double>(n, A.data(), m, X.data(), B.data());
+  EXPECT_LT(residual(n, m, A.data(), X4.data(), B.data()), 1e-9);
+  EXPECT_EQ(std::memcmp(X1.data(), X4.data(), n * m * sizeof(double)), 0);
+  for (int i = 0; i < n * m; ++i) ASSERT_NEAR(X[i], X4[i], 1e-8);
+};
+
+TEST(test_lu_factorization, solve_det_inverse) {
+  const int n = 70, m = 9;
+  auto A = random_matrix(n, n), B = random_matrix(n, m);
+  LUFactorization<double> lu(n, A.data());
+  std::vector<double> X(n * m), Ainv(n * n);
+  lu.solve(m, X.data(), B.data());
+  EXPECT_LT(residual(n, m, A.data(), X.data(), B.data()), 1e-10);
+  lu.solve(m, B.data(), B.data());  // in place
+  for (int i = 0; i < n * m; ++i) ASSERT_EQ(X[i], B[i]);
+
+  lu.inverse(Ainv.data());
+  std::vector<double> I(n * n, 0.0);
+  for (int i = 0; i < n; ++i) I[i + n * i] = 1.0;
+  EXPECT_LT(residual(n, n, A.data(), Ainv.data(), I.data()), 1e-10);
+  auto C = A;
+  pluinverse<double>(n, C.data());
+  for (int i = 0; i < n * n; ++i) ASSERT_NEAR(C[i], Ainv[i], 1e-9);
+
+  // det(2x2) and an odd permutation
+  double S[4] = {0.0, 3.0, 2.0, 1.0};  // [[0, 2], [3, 1]]
+  EXPECT_DOUBLE_EQ(LUFactorization<double>(2, S).determinant(), -6.0);
+};
+
+TEST(test_lu_factorization, caller_owned_storage) {
+  const int n = 33;
+  auto A = random_matrix(n, n), B = random_matrix(n, 1);
+  std::vector<double> lu(n * n);
+  std::vector<int> piv(n);
+  LUFactorization<double> f(n, A.data(), lu.data(), piv.data());
+  kl::ThreadPool pool(3);
+  LUFactorization<double> g(n, A.data(), pool);
+  EXPECT_EQ(f.lu().data, lu.data());
+  EXPECT_EQ(std::memcmp(f.lu().data, g.lu().data, n * n * sizeof(double)), 0);
+  EXPECT_NEAR(f.determinant(), det<double>(n, A.data()),
+              1e-8 * ABS<double>(f.determinant()));
+  std::vector<double> X(n);
+  f.solve(1, X.data(), B.data());
+  EXPECT_LT(residual(n, 1, A.data(), X.data(), B.data()), 1e-10);
+};
+
+TEST(test_matrix_view, row_major_without_copies) {
+  const int n = 90, m = 5;
+  auto A = random_matrix(n, n), B = random_matrix(n, m);
+  std::vector<double> RA(n * n), RB(n * m);  // same matrices, row-major
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) RA[i * n + j] = A[i + n * j];
+    for (int j = 0; j < m; ++j) RB[i * m + j] = B[i + n * j];
+  }
+  MatrixView<double> rA(RA.data(), n, n, Layout::RowMajor);
+  EXPECT_EQ(&rA(2, 3), &RA[2 * n + 3]);
+  EXPECT_EQ(&rA.t()(3, 2), &RA[2 * n + 3]);
+
+  // same arithmetic on either layout
+  auto LU = A, RLU = RA;
+  std::vector<int> perm(2 * n), rperm(2 * n);
+  pludec<double>(n, LU.data(), perm.data());
+  pludec<double>(MatrixView<double>(RLU.data(), n, n, Layout::RowMajor),
+                 rperm.data());
+  EXPECT_EQ(perm, rperm);
+  for (int i = 0; i < n; ++i)
+    for (int j = 0; j < n; ++j) ASSERT_EQ(LU[i + n * j], RLU[i * n + j]);
+
+  std::vector<double> RX(n * m);
+  plusolve<double>(rA, MatrixView<double>(RX.data(), n, m, Layout::RowMajor),
+                   MatrixView<const double>(RB.data(), n, m, Layout::RowMajor));
+  std::vector<double> X(n * m);  // back to column-major for the residual
+  for (int i = 0; i < n; ++i)
+    for (int j = 0; j < m; ++j) X[i + n * j] = RX[i * m + j];
+  EXPECT_LT(residual(n, m, A.data(), X.data(), B.data()), 1e-10);
+  EXPECT_NEAR(det<double>(n, A.data()), det<double>(rA),
+              1e-10 * ABS<double>(det<double>(n, A.data())));
+
+  // a sub-block with its own leading dimension
+  auto C = A;
+  auto sub = MatrixView<double>(C.data(), n, n).block(10, 20, 30, 30);
+  std::vector<double> S(30 * 30);
+  for (int j = 0; j < 30; ++j)
+    for (int i = 0; i < 30; ++i) S[i + 30 * j] = sub(i, j);
+  luinverse<double>(sub);
+  luinverse<double>(30, S.data());
+  for (int j = 0; j < 30; ++j)
+    for (int i = 0; i < 30; ++i) ASSERT_DOUBLE_EQ(sub(i, j), S[i + 30 * j]);
+  EXPECT_EQ(C[5], A[5]);
+};
+
+// R * R**T + n * I is symmetric positive definite
+static std::vector<double> random_spd(int n) {
+  auto R = random_matrix(n, n);
+  std::vector<double> A(n * n, 0.0);
+  for (int j = 0; j < n; ++j) {
+    for (int i = 0; i < n; ++i) {
+      for (int k = 0; k < n; ++k) A[i + n * j] += R[i + n * k] * R[j + n * k];
+    }
+    A[j + n * j] += n;
+  }
+  return A;
+}
+
+TEST(test_symmetric, cholesky_and_ldl) {
+  const int n = 150, m = 6;
+  auto A = random_spd(n), B = random_matrix(n, m);
+  std::vector<double> X(n * m), Y(n * m);
+  ASSERT_TRUE(cholsolve<double>(n, A.data(), m, X.data(), B.data()));
+  EXPECT_LT(residual(n, m, A.data(), X.data(), B.data()), 1e-10);
+  ASSERT_TRUE(ldlsolve<double>(n, A.data(), m, Y.data(), B.data()));
+  for (int i = 0; i < n * m; ++i) ASSERT_NEAR(X[i], Y[i], 1e-12);
+
+  // tiled DAG gives the same bits for any pool size
+  auto L1 = A, L4 = A;
+  kl::ThreadPool pool(4);
+  ASSERT_TRUE(choldec<double>(MatrixView<double>(L1.data(), n, n), 32));
+  ASSERT_TRUE(choldec<double>(MatrixView<double>(L4.data(), n, n), pool, 32));
+  EXPECT_EQ(std::memcmp(L1.data(), L4.data(), n * n * sizeof(double)), 0);
+  auto L0 = A;
+  ASSERT_TRUE(choldec<double>(MatrixView<double>(L0.data(), n, n), pool, 0));
+  for (int i = 0; i < n * n; ++i) ASSERT_NEAR(L0[i], L1[i], 1e-12);
+
+  // row-major factors, upper triangle left alone
+  auto R = A;
+  R[1] = 1234.5;  // (0, 1) in row-major storage
+  MatrixView<double> rR(R.data(), n, n, Layout::RowMajor);
+  ASSERT_TRUE(ldldec<double>(rR, pool, 32));
+  EXPECT_EQ(R[1], 1234.5);
+  std::vector<double> Z = B;
+  ldlsub<double>(rR, MatrixView<double>(Z.data(), n, m));
+  for (int i = 0; i < n * m; ++i) ASSERT_NEAR(X[i], Z[i], 1e-12);
+
+  auto N = A;
+  N[3 + n * 3] = -1e6;
+  EXPECT_FALSE(choldec<double>(n, N.data()));
+  N = A;
+  N[3 + n * 3] = -1e6;
+  EXPECT_FALSE(choldec<double>(MatrixView<double>(N.data(), n, n), pool, 32));
+};
+
+TEST(test_symmetric, lls_fit) {
+  // y = 1 - 2 x + 0.5 exp(x) on noiseless samples
+  const int m = 3, n = 50;
+  std::vector<double> f(m * n), y(n), c(m);
+  for (int i = 0; i < n; ++i) {
+    double x = 0.1 * i;
+    f[0 + m * i] = 1.0;
+    f[1 + m * i] = x;
+    f[2 + m * i] = std::exp(x);
+    y[i] = 1.0 - 2.0 * x + 0.5 * std::exp(x);
+  }
+  lls<double>(m, n, f.data(), y.data(), c.data());
+  EXPECT_NEAR(c[0], 1.0, 1e-8);
+  EXPECT_NEAR(c[1], -2.0, 1e-8);
+  EXPECT_NEAR(c[2], 0.5, 1e-8);
+};
+
+TEST(test_qrsolve, exact_and_noisy) {
+  // an overdetermined consistent system, then the residual of a noisy one
+  // is orthogonal to the columns of A
+  const int m = 30, n = 5, k = 2;
+  auto A = random_matrix(m, n), X0 = random_matrix(n, k);
+  std::vector<double> Bx(m * k, 0.0), X(n * k);
+  for (int c = 0; c < k; ++c)
+    for (int p = 0; p < n; ++p)
+      for (int i = 0; i < m; ++i) Bx[i + m * c] += A[i + m * p] * X0[p + n * c];
+  std::vector<double> QA = A, QB = Bx;
+  qrsolve<double>(MatrixView<double>(QA.data(), m, n),
+                  MatrixView<double>(QB.data(), m, k),
+                  MatrixView<double>(X.data(), n, k));
+  for (int i = 0; i < n * k; ++i) EXPECT_NEAR(X[i], X0[i], 1e-12);
+
+  auto Y = random_matrix(m, 1);
+  QA = A;
+  QB = Y;
+  qrsolve<double>(MatrixView<double>(QA.data(), m, n),
+                  MatrixView<double>(QB.data(), m, 1),
+                  MatrixView<double>(X.data(), n, 1));
+  for (int p = 0; p < n; ++p) {
+    double dot = 0.0;
+    for (int i = 0; i < m; ++i) {
+      double r = Y[i];
+      for (int q = 0; q < n; ++q) r -= A[i + m * q] * X[q];
+      dot += A[i + m * p] * r;
+    }
+    EXPECT_NEAR(dot, 0.0, 1e-12);
+  }
+};
+
+TEST(test_streaming_lls, chunks_downdate_merge) {
+  const int m = 4, n = 3000;
+  std::vector<double> f(m * n), y(n);
+  for (int i = 0; i < n; ++i) {
+    double x = rng.doub() * 4.0 - 2.0;
+    f[0 + m * i] = 1.0;
+    f[1 + m * i] = x;
+    f[2 + m * i] = x * x;
+    f[3 + m * i] = std::sin(x);
+    y[i] = 3.0 - x + 0.25 * std::sin(x) + 0.01 * (rng.doub() - 0.5);
+  }
+  std::vector<double> ref(m), c(m);
+  lls<double>(m, n, f.data(), y.data(), ref.data());
+
+  StreamingLLS<double> acc(m);
+  EXPECT_FALSE(acc.solve(c.data()));
+  for (int i0 = 0; i0 < n; i0 += 700)
+    acc.add(std::min(700, n - i0), f.data() + m * i0, y.data() + i0);
+  ASSERT_TRUE(acc.solve(c.data()));
+  EXPECT_EQ(acc.count(), n);
+  for (int a = 0; a < m; ++a) EXPECT_NEAR(c[a], ref[a], 1e-9);
+
+  double rss = 0.0;
+  for (int i = 0; i < n; ++i) {
+    double r = y[i];
+    for (int a = 0; a < m; ++a) r -= c[a] * f[a + m * i];
+    rss += r * r;
+  }
+  EXPECT_NEAR(acc.residual(), std::sqrt(rss), 1e-9);
+
+  // dropping the last 1000 samples gives the fit of the first 2000
+  ASSERT_TRUE(acc.remove(1000, f.data() + m * 2000, y.data() + 2000));
+  lls<double>(m, 2000, f.data(), y.data(), ref.data());
+  acc.solve(c.data());
+  for (int a = 0; a < m; ++a) EXPECT_NEAR(c[a], ref[a], 1e-8);
+
+  // halves built apart and in parallel merge into the same fit
+  kl::ThreadPool pool(3);
+  StreamingLLS<double> lo(m), hi(m);
+  lo.add(1000, f.data(), y.data(), pool);
+  hi.add(1000, f.data() + m * 1000, y.data() + 1000);
+  lo.merge(hi);
+  EXPECT_EQ(lo.count(), 2000);
+  lo.solve(c.data());
+  for (int a = 0; a < m; ++a) EXPECT_NEAR(c[a], ref[a], 1e-8);
+  EXPECT_NEAR(lo.residual(), acc.residual(), 1e-9);
+};
+
+TEST(test_polyfit, power_sums_orthogonal_batched) {
+  EXPECT_EQ(npow<double>(2.0, 10), 1024.0);
+  EXPECT_EQ(npow<double>(2.0, -2), 0.25);
+  EXPECT_EQ(npow<int>(3, 0), 1);
+
+  // f = 1 - 2x + 0.5x^3 on 101 points, 4 coefficients
+  const int deg = 4, n = 101;
+  const double truth[deg] = {1.0, -2.0, 0.0, 0.5};
+  std::vector<double> x(n), f(n), c(deg), d(deg);
+  for (int i = 0; i < n; ++i) {
+    x[i] = -1.0 + 0.02 * i;
+    f[i] = 1.0 - 2.0 * x[i] + 0.5 * x[i] * x[i] * x[i];
+  }
+  polyfit<double>(deg, n, x.data(), f.data(), c.data());
+  for (int a = 0; a < deg; ++a) EXPECT_NEAR(c[a], truth[a], 1e-10);
+
+  OrthoPolyFit<double> ortho(deg, n, x.data(), f.data());
+  EXPECT_NEAR(ortho(0.3), 1.0 - 0.6 + 0.5 * 0.027, 1e-12);
+  ortho.monomial(d.data());
+  for (int a = 0; a < deg; ++a) EXPECT_NEAR(d[a], truth[a], 1e-12);
+
+  // 300 noisy series sharing x, batched over a pool
+  const int ns = 300;
+  std::vector<double> F(ns * n), C(ns * deg);
+  for (int s = 0; s < ns; ++s)
+    for (int i = 0; i < n; ++i) F[s * n + i] = f[i] * s + rng.doub() - 0.5;
+  kl::ThreadPool pool(4);
+  polyfit<double>(deg, n, ns, x.data(), 0, F.data(), C.data(), pool);
+  for (int s = 0; s < ns; s += 37) {
+    polyfit<double>(deg, n, x.data(), F.data() + s * n, c.data());
+    for (int a = 0; a < deg; ++a) ASSERT_NEAR(C[s * deg + a], c[a], 1e-10);
+  }
+};
+
+TEST(test_mixed_precision, refine_and_fallback) {
+  const int n = 200, m = 3;
+  auto A = random_matrix(n, n), B = random_matrix(n, m);
+  // the eigenvalues of the random part fill a disc of radius about
+  // sqrt(n / 12) ~ 4.1, the shift keeps them well away from zero
+  for (int i = 0; i < n; ++i) A[i + n * i] += 8.0;
+  std::vector<double> X(n * m), Y(n * m);
+  kl::ThreadPool pool(4);
+  auto info = plusolve_mixed<double>(n, A.data(), m, X.data(), B.data(), pool);
+  plusolve<double>(n, A.data(), m, Y.data(), B.data());
+  EXPECT_TRUE(info.converged);
+  EXPECT_FALSE(info.fallback);
+  EXPECT_GT(info.iterations, 0);
+  EXPECT_LE(info.backward_error, std::sqrt(n) * 2.3e-16);
+  EXPECT_LT(residual(n, m, A.data(), X.data(), B.data()), 1e-13);
+  for (int e = 0; e < n * m; ++e) ASSERT_NEAR(X[e], Y[e], 1e-12);
+
+  // Hilbert matrix: too ill conditioned for a float factorization
+  const int h = 12;
+  std::vector<double> H(h * h), b(h, 1.0), x(h);
+  for (int i = 0; i < h; ++i)
+    for (int j = 0; j < h; ++j) H[i + h * j] = 1.0 / (i + j + 1);
+  info = plusolve_mixed<double>(h, H.data(), 1, x.data(), b.data());
+  EXPECT_TRUE(info.fallback);
+  EXPECT_LT(info.backward_error, 1e-14);
+
+  // out of float range
+  for (auto& a : A) a *= 1e300;
+  info = plusolve_mixed<double>(n, A.data(), m, X.data(), B.data(), pool);
+  EXPECT_TRUE(info.fallback);
+  EXPECT_EQ(info.iterations, 0);
+  EXPECT_TRUE(info.converged);
+};
+
+template <int N>
+static void check_batch(int count, kl::ThreadPool& pool) {
+  const int W = 8, groups = (count + W - 1) / W;
+  auto A = random_matrix(N * N, count), X = random_matrix(N, count);
+  std::vector<double> B(N * count, 0.0);
+  for (int m = 0; m < count; ++m)
+    for (int j = 0; j < N; ++j)
+      for (int i = 0; i < N; ++i)
+        B[m * N + i] += A[m * N * N + i + N * j] * X[m * N + j];
+
+  std::vector<double> a(groups * W * N * N), b(groups * W * N), x(N * count);
+  std::vector<int> perm(groups * W * N);
+  batch_pack<W>(count, N * N, A.data(), a.data());
+  batch_pack<W>(count, N, B.data(), b.data());
+  auto b2 = b;
+  auto a2 = a;
+  EXPECT_EQ(batch_ludec<N>(count, a.data(), perm.data(), pool), 0);
+  batch_lusolve<N>(count, a.data(), perm.data(), b.data(), pool);
+  EXPECT_EQ(batch_solve<N>(count, a2.data(), b2.data(), pool), 0);
+  EXPECT_EQ(b, b2);
+  batch_unpack<W>(count, N, b.data(), x.data());
+  for (int e = 0; e < N * count; ++e) ASSERT_NEAR(x[e], X[e], 1e-8);
+}
+
+TEST(test_batch_lu, small_systems) {
+  kl::ThreadPool pool(4);
+  check_batch<3>(1001, pool);
+  check_batch<4>(64, pool);
+  check_batch<7>(13, pool);
+  check_batch<16>(100, pool);
+
+  // a singular matrix is reported and does not disturb its neighbours
+  std::vector<double> A(8 * 4), B(8 * 2, 1.0);
+  for (int m = 0; m < 8; ++m) {
+    A[m * 4 + 0] = 2.0;
+    A[m * 4 + 3] = (m == 5) ? 0.0 : 4.0;
+  }
+  std::vector<double> a(A.size()), b(B.size());
+  batch_pack<8>(8, 4, A.data(), a.data());
+  batch_pack<8>(8, 2, B.data(), b.data());
+  EXPECT_EQ(batch_solve<2>(8, a.data(), b.data(), pool), 1);
+  batch_unpack<8>(8, 2, b.data(), B.data());
+  EXPECT_EQ(B[0], 0.5);
+  EXPECT_EQ(B[1], 0.25);
+};
+
+// a partial last group must not write to the factors, so that one const
+// factorization can be shared by threads solving at the same time
+TEST(test_batch_lu, shared_const_factors) {
+  const int N = 3, W = 8, count = 13, groups = (count + W - 1) / W;
+  kl::ThreadPool pool(2);
+  auto A = random_matrix(N * N, count), B = random_matrix(N, count);
+  std::vector<double> a(groups * W * N * N), b(groups * W * N);
+  std::vector<int> p(groups * W * N);
+  for (int m = 0; m < count; ++m)
+    for (int i = 0; i < N; ++i) A[m * N * N + i + N * i] += 4.0;
+  batch_pack<W>(count, N * N, A.data(), a.data());
+  batch_pack<W>(count, N, B.data(), b.data());
+  ASSERT_EQ(batch_ludec<N>(count, a.data(), p.data(), pool), 0);
+  const std::vector<double> LU = a;
+  const std::vector<int> perm = p;
+
+  std::vector<double> ref = b;
+  batch_lusolve<N>(count, LU.data(), perm.data(), ref.data(), pool);
+  std::vector<std::vector<double>> x(2, b);
+  std::vector<std::thread> th;
+  for (int t = 0; t < 2; ++t) {
+    th.emplace_back([&, t] {
+      kl::ThreadPool own(2);
+      for (int rep = 0; rep < 50; ++rep) {
+        x[t] = b;
+        batch_lusolve<N>(count, LU.data(), perm.data(), x[t].data(), own);
+      }
+    });
+  }
+  for (auto& t : th) t.join();
+  EXPECT_EQ(x[0], ref);
+  EXPECT_EQ(x[1], ref);
+  EXPECT_EQ(LU, a);
+  EXPECT_EQ(perm, p);
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace kl {
+// caching allocator of 64 byte aligned buffers
+// a request is rounded up to its size class, 64 byte steps up to 256 bytes
+// and then four classes per power of two (at most 25% waste); a freed buffer
+// goes to the free list of its class, as long as the cache holds less than
+// cache_limit() bytes, and the next request of that class takes it from
+// there, so a steady stream of same sized buffers stops calling malloc
+class CachingAllocator final {
+ public:
+  static constexpr size_t alignment = 64;
+  struct Stats {
+    size_t hits = 0;    // requests served from the cache
+    size_t misses = 0;  // requests that allocated
+    size_t cached = 0;  // bytes held by the cache
+  };
+
+  // the process wide instance, never destroyed so that objects with static
+  // storage can still give their buffers back at exit
+  static CachingAllocator& instance() {
+    static CachingAllocator* alloc = new CachingAllocator();
+    return *alloc;
+  }
+
+  CachingAllocator() : free_(num_classes) {}
+  CachingAllocator(const CachingAllocator&) = delete;
+  CachingAllocator& operator=(const CachingAllocator&) = delete;
+  ~CachingAllocator() { this->release(); }
+
+  // a buffer of at least bytes bytes
+  void* allocate(size_t bytes) {
+    size_t idx;
+    const size_t sz = size_class(bytes, idx);
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      auto& fl = free_[idx];
+      if (!fl.empty()) {
+        void* p = fl.back();
+        fl.pop_back();
+        cached_ -= sz;
+        ++stats_.hits;
+        return p;
+      }
+      ++stats_.misses;
+    }
+    return ::operator new(sz, std::align_val_t(alignment));
+  }
+
+  // give back a buffer of allocate(bytes)
+  void deallocate(void* p, size_t bytes) noexcept {
+    if (p == nullptr) return;
+    size_t idx;
+    const size_t sz = size_class(bytes, idx);
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      if (cached_ + sz <= limit_) {
+        try {
+          free_[idx].push_back(p);
+          cached_ += sz;
+          return;
+        } catch (...) {
+        }
+      }
+    }
+    ::operator delete(p, std::align_val_t(alignment));
+  }
+
+  // free every cached buffer
+  void release() noexcept {
+    std::lock_guard<std::mutex> lk(m_);
+    for (auto& fl : free_) {
+      for (void* p : fl) ::operator delete(p, std::align_val_t(alignment));
+      fl.clear();
+    }
+    cached_ = 0;
+  }
+
+  size_t cache_limit() const noexcept { return limit_; }
+  void set_cache_limit(size_t bytes) {
+    bool drop;
+    {
+      std::lock_guard<std::mutex> lk(m_);
+      limit_ = bytes;
+      drop = (cached_ > bytes);
+    }
+    if (drop) this->release();
+  }
+
+  Stats stats() {
+    std::lock_guard<std::mutex> lk(m_);
+    Stats s = stats_;
+    s.cached = cached_;
+    return s;
+  }
+
+  // the size class of a request of bytes bytes and its index
+  static size_t size_class(size_t bytes, size_t& idx) noexcept {
+    if (bytes <= 256) {
+      const size_t sz = std::max<size_t>(1, (bytes + 63) / 64) * 64;
+      idx = sz / 64 - 1;
+      return sz;
+    }
+    // 2^e < bytes <= 2^(e + 1), in steps of 2^(e - 2)
+    const int e = 63 - __builtin_clzll(bytes - 1);
+    const size_t step = size_t(1) << (e - 2);
+    const size_t sz = (bytes + step - 1) / step * step;
+    idx = 4 * (e - 7) + sz / step - 5;
+    return sz;
+  }
+
+ private:
+  static constexpr size_t num_classes = 4 * 57;
+
+  std::mutex m_;
+  std::vector<std::vector<void*>> free_;
+  size_t cached_ = 0;
+  size_t limit_ = size_t(1) << 28;
+  Stats stats_;
+};
+
+// std allocator interface to CachingAllocator::instance()
+template <typename T>
+struct CachingStdAllocator {
+  typedef T value_type;
+
+  CachingStdAllocator() noexcept = default;
+  template <typename U>
+  CachingStdAllocator(const CachingStdAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(
+        CachingAllocator::instance().allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) noexcept {
+    CachingAllocator::instance().deallocate(p, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const CachingStdAllocator<U>&) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const CachingStdAllocator<U>&) const noexcept {
+    return false;
+  }
+};
+
+}  // namespace kl
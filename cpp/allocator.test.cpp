@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "allocator.h"
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "utils.h"
+
+using kl::CachingAllocator;
+
+Rand rng(82 + time(nullptr));
+
+TEST(test_allocator, size_classes) {
+  size_t prev_idx = 0, prev_sz = 0;
+  for (size_t bytes = 1; bytes < (size_t(1) << 22); bytes += 1 + bytes / 10) {
+    size_t idx;
+    const size_t sz = CachingAllocator::size_class(bytes, idx);
+    ASSERT_GE(sz, bytes);
+    ASSERT_EQ(sz % CachingAllocator::alignment, 0u);
+    ASSERT_LE(sz, bytes < 256 ? 256 : bytes + bytes / 4);
+    // classes are increasing and their indices dense
+    ASSERT_GE(sz, prev_sz);
+    if (prev_sz > 0) {
+      ASSERT_TRUE(idx == prev_idx || idx == prev_idx + 1);
+      ASSERT_EQ(idx == prev_idx, sz == prev_sz);
+    }
+    prev_idx = idx;
+    prev_sz = sz;
+  }
+};
+
+TEST(test_allocator, recycles) {
+  CachingAllocator alloc;
+  std::vector<std::pair<void*, size_t>> live;
+  for (int i = 0; i < 100; ++i) {
+    const size_t bytes = 1 + rng.uint32(1 << 16);
+    void* p = alloc.allocate(bytes);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % CachingAllocator::alignment,
+              0u);
+    live.emplace_back(p, bytes);
+  }
+  for (auto& b : live) alloc.deallocate(b.first, b.second);
+  const auto before = alloc.stats();
+  EXPECT_EQ(before.misses, 100u);
+  EXPECT_GT(before.cached, 0u);
+  // the same requests again are served from the cache
+  for (auto& b : live) b.first = alloc.allocate(b.second);
+  EXPECT_EQ(alloc.stats().misses, before.misses);
+  EXPECT_EQ(alloc.stats().hits, 100u);
+  for (auto& b : live) alloc.deallocate(b.first, b.second);
+
+  alloc.set_cache_limit(0);
+  EXPECT_EQ(alloc.stats().cached, 0u);
+  void* p = alloc.allocate(100);
+  alloc.deallocate(p, 100);
+  EXPECT_EQ(alloc.stats().cached, 0u);
+
+  // as a std allocator
+  std::shared_ptr<int> sp = std::allocate_shared<int>(
+      kl::CachingStdAllocator<int>(), 7);
+  EXPECT_EQ(*sp, 7);
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "integer.h"
+#include "thread_pool.h"
+
+// exact linear algebra on integer matrices, A[i][j] = A[i + n*j]
+
+// signed integer on top of the unsigned bigint
+struct zint {
+  bigint mag;
+  bool neg = false;
+
+  zint() {}
+  zint(int64_t x)
+      : mag(static_cast<uint64_t>(x < 0 ? -static_cast<uint64_t>(x) : x)),
+        neg(x < 0) {}
+  zint(const bigint& m, bool negative) : mag(m), neg(negative && m != 0) {}
+
+  bool is_zero() const { return mag == 0; }
+
+  zint operator-() const { return zint(mag, !neg); }
+  zint operator+(const zint& rhs) const {
+    if (neg == rhs.neg) return zint(mag + rhs.mag, neg);
+    if (mag >= rhs.mag) return zint(mag - rhs.mag, neg);
+    return zint(rhs.mag - mag, rhs.neg);
+  }
+  zint operator-(const zint& rhs) const { return *this + (-rhs); }
+  zint operator*(const zint& rhs) const {
+    return zint(mag * rhs.mag, neg != rhs.neg);
+  }
+  // exact division, rhs must divide *this
+  zint operator/(const zint& rhs) const {
+    return zint(mag / rhs.mag, neg != rhs.neg);
+  }
+  bool operator==(const zint& rhs) const {
+    return neg == rhs.neg && mag == rhs.mag;
+  }
+  bool operator!=(const zint& rhs) const { return !(*this == rhs); }
+  friend std::ostream& operator<<(std::ostream& oss, const zint& rhs) {
+    return oss << (rhs.neg ? "-" : "") << rhs.mag;
+  }
+};
+
+// fraction-free Gaussian elimination (Bareiss) on the n by n + m matrix
+// [A | B], every division is exact and entries stay bounded by minors of A
+// returns the sign of the row permutation, 0 if A is singular
+inline int bareiss(const int n, const int m, std::vector<zint>& M) {
+  const int ld = n;
+  int sign = 1;
+  zint prev(1);
+  for (int k = 0; k < n; ++k) {
+    if (M[k + ld * k].is_zero()) {
+      int r = k + 1;
+      while (r < n && M[r + ld * k].is_zero()) ++r;
+      if (r == n) return 0;
+      for (int j = k; j < n + m; ++j) std::swap(M[k + ld * j], M[r + ld * j]);
+      sign = -sign;
+    }
+    const zint& pivot = M[k + ld * k];
+    for (int j = k + 1; j < n + m; ++j) {
+      for (int i = k + 1; i < n; ++i) {
+        M[i + ld * j] =
+            (M[i + ld * j] * pivot - M[i + ld * k] * M[k + ld * j]) / prev;
+      }
+    }
+    prev = pivot;
+  }
+  return sign;
+}
+
+// det(A) by Bareiss elimination
+inline zint bareiss_det(const int n, const zint* A) {
+  if (n == 0) return zint(1);
+  std::vector<zint> M(A, A + n * n);
+  const int sign = bareiss(n, 0, M);
+  if (sign == 0) return zint(0);
+  const zint& d = M[(n - 1) + n * (n - 1)];
+  return (sign > 0) ? d : -d;
+}
+
+// rational solution of A x = b as x = num / den with den = det(A)
+// returns false if A is singular
+inline bool bareiss_solve(const int n, const zint* A, const zint* b, zint* num,
+                          zint& den) {
+  std::vector<zint> M(A, A + n * n);
+  M.insert(M.end(), b, b + n);
+  const int sign = bareiss(n, 1, M);
+  if (sign == 0) return false;
+  // with d the last pivot, y = d x is integral and
+  // U_ii y_i = d c_i - sum_{j > i} U_ij y_j divides exactly
+  const zint d = M[(n - 1) + n * (n - 1)];
+  for (int i = n - 1; i >= 0; --i) {
+    zint s = d * M[i + n * n];
+    for (int j = i + 1; j < n; ++j) s = s - M[i + n * j] * num[j];
+    num[i] = s / M[i + n * i];
+  }
+  den = d;
+  if (sign < 0) {
+    den = -den;
+    for (int i = 0; i < n; ++i) num[i] = -num[i];
+  }
+  return true;
+}
+
+// arithmetic modulo a word sized p < 2^63
+inline uint64_t mulmod(uint64_t a, uint64_t b, uint64_t p) {
+  return static_cast<uint64_t>(static_cast<uint128_t>(a) * b % p);
+}
+
+inline uint64_t powmod(uint64_t a, uint64_t e, uint64_t p) {
+  uint64_t res = 1;
+  while (e > 0) {
+    if (e & 1) res = mulmod(res, a, p);
+    a = mulmod(a, a, p);
+    e >>= 1;
+  }
+  return res;
+}
+
+// x mod p, limb by limb
+inline uint64_t mod_word(const bigint& x, uint64_t p) {
+  uint128_t r = 0;
+  for (size_t i = x.size(); i-- > 0;) r = ((r << 64) + x.val_[i]) % p;
+  return static_cast<uint64_t>(r);
+}
+
+inline uint64_t mod_word(const zint& x, uint64_t p) {
+  const uint64_t r = mod_word(x.mag, p);
+  return (x.neg && r != 0) ? p - r : r;
+}
+
+// deterministic Miller-Rabin for 64 bit words
+inline bool is_word_prime(uint64_t x) {
+  if (x < 2) return false;
+  for (uint64_t q : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37}) {
+    if (x % q == 0) return x == q;
+  }
+  uint64_t d = x - 1;
+  int s = 0;
+  while (!(d & 1)) {
+    d >>= 1;
+    ++s;
+  }
+  for (uint64_t w : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37}) {
+    uint64_t y = powmod(w, d, x);
+    if (y == 1 || y == x - 1) continue;
+    bool composite = true;
+    for (int i = 1; i < s && composite; ++i) {
+      y = mulmod(y, y, x);
+      composite = (y != x - 1);
+    }
+    if (composite) return false;
+  }
+  return true;
+}
+
+// the k largest primes below 2^62
+inline std::vector<uint64_t> word_primes(size_t k) {
+  std::vector<uint64_t> res;
+  for (uint64_t x = (uint64_t(1) << 62) - 1; res.size() < k; x -= 2) {
+    if (is_word_prime(x)) res.push_back(x);
+  }
+  return res;
+}
+
+// det(A) mod p; if b is given and det(A) != 0 mod p, b := det(A) A**-1 b
+inline uint64_t modular_elim(const int n, std::vector<uint64_t>& A,
+                             uint64_t* b, const uint64_t p) {
+  uint64_t det = 1;
+  for (int k = 0; k < n; ++k) {
+    int r = k;
+    while (r < n && A[r + n * k] == 0) ++r;
+    if (r == n) return 0;
+    if (r != k) {
+      for (int j = k; j < n; ++j) std::swap(A[k + n * j], A[r + n * j]);
+      if (b) std::swap(b[k], b[r]);
+      det = p - det;
+    }
+    const uint64_t piv = A[k + n * k], inv = powmod(piv, p - 2, p);
+    det = mulmod(det, piv, p);
+    for (int i = k + 1; i < n; ++i) {
+      const uint64_t l = mulmod(A[i + n * k], inv, p);
+      if (l == 0) continue;
+      for (int j = k + 1; j < n; ++j)
+        A[i + n * j] = (A[i + n * j] + p - mulmod(l, A[k + n * j], p)) % p;
+      if (b) b[i] = (b[i] + p - mulmod(l, b[k], p)) % p;
+    }
+  }
+  if (b) {
+    for (int i = n - 1; i >= 0; --i) {
+      uint64_t s = b[i];
+      for (int j = i + 1; j < n; ++j)
+        s = (s + p - mulmod(A[i + n * j], b[j], p)) % p;
+      b[i] = mulmod(s, powmod(A[i + n * i], p - 2, p), p);
+    }
+    for (int i = 0; i < n; ++i) b[i] = mulmod(b[i], det, p);
+  }
+  return det;
+}
+
+// Garner's mixed radix CRT of residues r[i] mod primes[i] into the
+// symmetric range (-M/2, M/2], M the product of the primes
+class CRTBasis {
+ public:
+  explicit CRTBasis(const std::vector<uint64_t>& primes)
+      : p_(primes), inv_(primes.size()), M_(1) {
+    for (size_t i = 0; i < p_.size(); ++i) {
+      uint64_t prod = 1;
+      for (size_t j = 0; j < i; ++j) prod = mulmod(prod, p_[j] % p_[i], p_[i]);
+      inv_[i] = powmod(prod, p_[i] - 2, p_[i]);
+      M_ = M_ * p_[i];
+    }
+  }
+
+  zint operator()(const uint64_t* r) const {
+    const size_t k = p_.size();
+    std::vector<uint64_t> v(k);
+    for (size_t i = 0; i < k; ++i) {
+      // value of v_0 + v_1 p_0 + ... + v_{i-1} p_0..p_{i-2} mod p_i
+      uint64_t x = 0;
+      for (size_t j = i; j-- > 0;) x = (mulmod(x, p_[j], p_[i]) + v[j]) % p_[i];
+      v[i] = mulmod((r[i] + p_[i] - x) % p_[i], inv_[i], p_[i]);
+    }
+    bigint res(0);
+    for (size_t j = k; j-- > 0;) res = res * p_[j] + bigint(v[j]);
+    if (res * 2 > M_) return zint(M_ - res, true);
+    return zint(res, false);
+  }
+
+ private:
+  std::vector<uint64_t> p_, inv_;
+  bigint M_;
+};
+
+// log2 |x|, approximately
+inline double log2_abs(const zint& x) {
+  const size_t sz = x.mag.size();
+  double top = static_cast<double>(x.mag.val_[sz - 1]);
+  if (sz > 1) top += std::ldexp(static_cast<double>(x.mag.val_[sz - 2]), -64);
+  return (top == 0.0) ? -HUGE_VAL : std::log2(top) + 64.0 * (sz - 1);
+}
+
+// log2 of the Euclidean norm of the n entries at x[0], x[stride], ...
+inline double log2_norm(const int n, const zint* x, const int stride) {
+  double lmax = -HUGE_VAL;
+  for (int i = 0; i < n; ++i) lmax = std::max(lmax, log2_abs(x[i * stride]));
+  if (lmax == -HUGE_VAL) return lmax;
+  double s = 0.0;
+  for (int i = 0; i < n; ++i)
+    s += std::exp2(2.0 * (log2_abs(x[i * stride]) - lmax));
+  return lmax + 0.5 * std::log2(s);
+}
+
+// The multi-modular routines eliminate modulo word primes in parallel and
+// stop once the product of the primes exceeds twice the Hadamard bound of
+// the values reconstructed, |det(A)| <= prod_j ||a_j||.
+
+// det(A) modulo enough primes, then CRT
+inline zint modular_det(const int n, const zint* A, kl::ThreadPool& pool) {
+  if (n == 0) return zint(1);
+  double bits = 2.0;
+  for (int j = 0; j < n; ++j) {
+    const double l = log2_norm(n, A + n * j, 1);
+    if (l == -HUGE_VAL) return zint(0);
+    bits += std::max(0.0, l);
+  }
+  const auto primes = word_primes(static_cast<size_t>(bits / 61.0) + 1);
+  std::vector<uint64_t> res(primes.size());
+  kl::parallel_for(pool, 0, primes.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t q = lo; q < hi; ++q) {
+      std::vector<uint64_t> a(n * n);
+      for (int e = 0; e < n * n; ++e) a[e] = mod_word(A[e], primes[q]);
+      res[q] = modular_elim(n, a, nullptr, primes[q]);
+    }
+  });
+  return CRTBasis(primes)(res.data());
+}
+
+// rational solution of A x = b as x = num / den with den = det(A)
+// num_i = det(A_i), A with column i replaced by b, is bounded by the
+// Hadamard bound of [A | b] with b swapped for one column; primes dividing
+// det(A) cannot give num and are replaced by further ones
+// returns false if A is singular
+inline bool modular_solve(const int n, const zint* A, const zint* b, zint* num,
+                          zint& den, kl::ThreadPool& pool) {
+  double bits = 2.0, lmin = HUGE_VAL;
+  for (int j = 0; j < n; ++j) {
+    const double l = log2_norm(n, A + n * j, 1);
+    if (l == -HUGE_VAL) return false;
+    bits += std::max(0.0, l);
+    lmin = std::min(lmin, std::max(0.0, l));
+  }
+  const double lb = log2_norm(n, b, 1);
+  if (lb > lmin) bits += lb - lmin;
+
+  std::vector<uint64_t> good, res;  // res: det, then num, per good prime
+  double good_bits = 0.0, bad_bits = 0.0;
+  std::vector<uint64_t> pool_primes;
+  size_t next = 0;
+  while (good_bits < bits) {
+    if (bad_bits >= bits) return false;  // det(A) = 0 mod too many primes
+    const size_t want = static_cast<size_t>((bits - good_bits) / 61.0) + 1;
+    pool_primes = word_primes(next + want);
+    std::vector<uint64_t> round(want * (n + 1));
+    kl::parallel_for(pool, 0, want, 1, [&](size_t lo, size_t hi) {
+      for (size_t q = lo; q < hi; ++q) {
+        const uint64_t p = pool_primes[next + q];
+        std::vector<uint64_t> a(n * n);
+        for (int e = 0; e < n * n; ++e) a[e] = mod_word(A[e], p);
+        uint64_t* y = &round[q * (n + 1)];
+        for (int i = 0; i < n; ++i) y[i + 1] = mod_word(b[i], p);
+        y[0] = modular_elim(n, a, y + 1, p);
+      }
+    });
+    for (size_t q = 0; q < want; ++q) {
+      const uint64_t p = pool_primes[next + q];
+      if (round[q * (n + 1)] == 0) {
+        bad_bits += std::log2(static_cast<double>(p));
+        continue;
+      }
+      good.push_back(p);
+      good_bits += std::log2(static_cast<double>(p));
+      res.insert(res.end(), &round[q * (n + 1)], &round[(q + 1) * (n + 1)]);
+    }
+    next += want;
+  }
+
+  const size_t k = good.size();
+  CRTBasis crt(good);
+  std::vector<uint64_t> r(k);
+  for (int i = -1; i < n; ++i) {
+    for (size_t q = 0; q < k; ++q) r[q] = res[q * (n + 1) + (i + 1)];
+    if (i < 0) {
+      den = crt(r.data());
+    } else {
+      num[i] = crt(r.data());
+    }
+  }
+  return true;
+}
+
+// serial versions
+inline zint modular_det(const int n, const zint* A) {
+  kl::ThreadPool serial(1);
+  return modular_det(n, A, serial);
+}
+
+inline bool modular_solve(const int n, const zint* A, const zint* b, zint* num,
+                          zint& den) {
+  kl::ThreadPool serial(1);
+  return modular_solve(n, A, b, num, den, serial);
+}
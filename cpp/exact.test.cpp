@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "exact.h"
+
+#include <gtest/gtest.h>
+#include <time.h>
+
+#include <vector>
+
+#include "thread_pool.h"
+#include "utils.h"
+
+Rand rng(82 + time(nullptr));
+
+static zint random_zint(int limbs) {
+  std::vector<uint64_t> v(limbs);
+  for (auto& x : v) x = rng.uint64();
+  return zint(bigint(v), rng.uint32(2));
+}
+
+TEST(test_exact, vandermonde_det) {
+  // det of the Vandermonde matrix of x is prod_{i < j} (x_j - x_i)
+  const int n = 12;
+  std::vector<zint> A(n * n);
+  zint truth(1);
+  for (int i = 0; i < n; ++i) {
+    const int64_t x = 3 * i - 17 + (i % 3);
+    zint p(1);
+    for (int j = 0; j < n; ++j) {
+      A[i + n * j] = p;
+      p = p * zint(x);
+    }
+    for (int k = 0; k < i; ++k) truth = truth * zint(x - (3 * k - 17 + k % 3));
+  }
+  kl::ThreadPool pool(4);
+  EXPECT_EQ(bareiss_det(n, A.data()), truth);
+  EXPECT_EQ(modular_det(n, A.data(), pool), truth);
+  EXPECT_EQ(modular_det(n, A.data()), truth);
+
+  std::copy(A.begin(), A.begin() + n, A.begin() + n);  // equal columns
+  EXPECT_TRUE(bareiss_det(n, A.data()).is_zero());
+  EXPECT_TRUE(modular_det(n, A.data(), pool).is_zero());
+};
+
+TEST(test_exact, rational_solve) {
+  kl::ThreadPool pool(4);
+  for (int limbs : {0, 2}) {
+    const int n = 7;
+    std::vector<zint> A(n * n), b(n), num1(n), num2(n);
+    for (auto& a : A)
+      a = limbs ? random_zint(limbs) : zint(int64_t(rng.uint32(201)) - 100);
+    for (auto& v : b)
+      v = limbs ? random_zint(limbs) : zint(int64_t(rng.uint32(201)) - 100);
+    zint den1, den2;
+    ASSERT_TRUE(bareiss_solve(n, A.data(), b.data(), num1.data(), den1));
+    ASSERT_TRUE(modular_solve(n, A.data(), b.data(), num2.data(), den2, pool));
+    EXPECT_EQ(den1, bareiss_det(n, A.data()));
+    EXPECT_EQ(den1, den2);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(num1[i], num2[i]);
+      zint s(0);  // A num == den b exactly
+      for (int j = 0; j < n; ++j) s = s + A[i + n * j] * num1[j];
+      EXPECT_EQ(s, den1 * b[i]);
+    }
+  }
+
+  // singular system
+  const int n = 3;
+  std::vector<zint> A{1, 2, 3, 2, 4, 6, 0, 1, 5}, b{1, 1, 1}, num(n);
+  zint den;
+  EXPECT_FALSE(bareiss_solve(n, A.data(), b.data(), num.data(), den));
+  EXPECT_FALSE(modular_solve(n, A.data(), b.data(), num.data(), den, pool));
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
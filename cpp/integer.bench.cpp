@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "integer.h"
+#include "random_bigint.h"
+#include "utils.h"
+
+// a fixed seed, so runs on different commits see the same operands
+static Rand rng(82);
+
+// state.range(0): number of 64-bit limbs of the operands
+static void limbs(benchmark::internal::Benchmark* b) {
+  for (int64_t n : {1, 4, 16, 64, 256}) b->Arg(n);
+}
+
+static void BM_bigint_mul(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const bigint x = random_bigint(rng, 64 * n), y = random_bigint(rng, 64 * n);
+  for (auto _ : state) {
+    bigint z = x * y;
+    benchmark::DoNotOptimize(z.val_.data());
+  }
+}
+BENCHMARK(BM_bigint_mul)->Apply(limbs);
+
+// a 2n limb numerator over an n limb denominator
+static void BM_bigint_div(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const bigint x = random_bigint(rng, 128 * n), y = random_bigint(rng, 64 * n);
+  for (auto _ : state) {
+    bigint q = x / y;
+    benchmark::DoNotOptimize(q.val_.data());
+  }
+}
+BENCHMARK(BM_bigint_div)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+// base, exponent and modulus of n limbs each
+static void BM_bigint_pow_mod(benchmark::State& state) {
+  const size_t n = state.range(0);
+  const bigint x = random_bigint(rng, 64 * n), e = random_bigint(rng, 64 * n),
+               p = random_bigint(rng, 64 * n) + 1;
+  for (auto _ : state) {
+    bigint r = pow_mod(x, e, p);
+    benchmark::DoNotOptimize(r.val_.data());
+  }
+}
+BENCHMARK(BM_bigint_pow_mod)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+// state.range(0): bits of the starting point
+static void BM_make_prime(benchmark::State& state) {
+  const size_t bits = state.range(0);
+  std::vector<bigint> from;
+  for (int i = 0; i < 8; ++i) from.push_back(random_bigint(rng, bits));
+  size_t i = 0;
+  for (auto _ : state) {
+    bigint p = make_prime(from[i++ % from.size()]);
+    benchmark::DoNotOptimize(p.val_.data());
+  }
+}
+BENCHMARK(BM_make_prime)->Arg(32)->Arg(48)->Arg(64);
+
+BENCHMARK_MAIN();
@@ -56,6 +56,8 @@ bigint bigint::operator+(const bigint& rhs) const {
     v = rhs.val_;
     u = this->val_;
   }
+  bigint::allocated(v.size());
+  bigint::allocated(u.size());
   size_t usz = u.size(), vsz = v.size();
   uint64_t c = 0;
   size_t i = 0;
@@ -72,12 +74,15 @@ bigint bigint::operator+(const bigint& rhs) const {
     }
     add__(v[i++], c);
   }
+  KL_STATS_ADD(limb_ops, i);
   return bigint(v);
 }
 
 bigint bigint::operator-(const bigint& rhs) const {
   if (*this <= rhs) return 0;
   std::vector<uint64_t> v = val_, u = rhs.val_;
+  bigint::allocated(v.size());
+  bigint::allocated(u.size());
   size_t usz = u.size(), vsz = v.size();
   uint64_t c = 0;
   size_t i;
@@ -93,6 +98,7 @@ bigint bigint::operator-(const bigint& rhs) const {
     }
     sub__(v[i++], c);
   }
+  KL_STATS_ADD(limb_ops, i);
 
   return bigint(v);
 }
@@ -100,6 +106,7 @@ bigint bigint::operator-(const bigint& rhs) const {
 bigint bigint::operator>>(int n) const {
   if (n < 1 || *this == 0) return *this;
   std::vector<uint64_t> v = val_;
+  bigint::allocated(v.size());
   while (n >= 64) {
     n -= 64;
     v.pop_back();
@@ -116,6 +123,7 @@ bigint bigint::operator>>(int n) const {
     c = (v[i]) << (64 - n);
     v[i] = val;
   }
+  KL_STATS_ADD(limb_ops, v.size());
 
   return bigint(v);
 }
@@ -123,6 +131,7 @@ bigint bigint::operator>>(int n) const {
 bigint bigint::operator<<(int n) const {
   if (n == 0 || *this == 0) return *this;
   std::vector<uint64_t> v = val_;
+  bigint::allocated(v.size());
   while (n >= 64) {
     n -= 64;
     v.insert(v.begin(), 0);
@@ -137,6 +146,7 @@ bigint bigint::operator<<(int n) const {
     v[i] = val;
   }
   if (c > 0) v.push_back(c);
+  KL_STATS_ADD(limb_ops, v.size());
 
   return bigint(v);
 }
@@ -159,6 +169,8 @@ bool bigint::operator>(const bigint& rhs) const {
 
 bigint bigint::operator*(uint64_t x) const {
   std::vector<uint64_t> v = this->val_;
+  bigint::allocated(v.size());
+  KL_STATS_ADD(limb_ops, v.size());
   uint64_t c = 0;
   for (size_t i = 0; i < v.size(); ++i) {
     uint64_t val = x;
@@ -187,6 +199,8 @@ bigint bigint::operator/(uint64_t x) const {
   if (*this == x) return 1;
   size_t sz = val_.size();
   std::vector<uint64_t> v(sz, 0);
+  bigint::allocated(sz);
+  KL_STATS_ADD(limb_ops, sz);
   uint64_t c = 0;
   for (int i = sz - 1; i >= 0; --i) {
     uint128_t val =
@@ -207,6 +221,7 @@ void divmod__(bigint& nu, bigint& de) {
       de = 0;
       return;
     }
+    KL_STATS_ADD(divisions, 1);
     uint128_t v = val.val_.back(), u = de.val_.back();
     if (v < u) {
       v = (v << 64) + val.val_[val.size() - 2];
@@ -219,6 +234,7 @@ void divmod__(bigint& nu, bigint& de) {
     std::vector<uint64_t> vv;
     for (size_t i = 0; i < n; ++i) vv.push_back(0);
     vv.push_back(sig);
+    bigint::allocated(vv.size());
     bigint r(vv);
 
     while (r * de < val) {
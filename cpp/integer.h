@@ -10,6 +10,8 @@
 #include <iostream>
 #include <vector>
 
+#include "stats.h"
+
 typedef unsigned __int128 uint128_t;
 
 class Zeroable {
@@ -80,6 +82,7 @@ T inverse(const T& a, const T& b) {
 // compute x^n modulo p
 template <typename T>
 T pow_mod(const T& x, const T& n, const T& p) {
+  KL_STATS_TIMER("pow_mod");
   T k = n, r = x % p;
   T res = 1;
   while (k > 0) {
@@ -121,6 +124,7 @@ bool is_prime(const T& x) {
 // find the first prime number that is greater than x
 template <typename T>
 T make_prime(const T& x) {
+  KL_STATS_TIMER("make_prime");
   T val = (x & 1) ? x : x + 1;
   while (!is_prime(val)) {
     val = val + 2;
@@ -137,11 +141,20 @@ struct bigint {
     }
   }
   size_t size() const { return val_.size(); }
-  bigint() : val_{{0}} {}
-  bigint(uint64_t x) : val_{{x}} {}
-  bigint(const std::vector<uint64_t>& val) : val_{val} { canonize(); }
+  // counts a new limb buffer of n limbs, see stats.h
+  static void allocated(size_t n) {
+    KL_STATS_ADD(bigint_allocs, 1);
+    KL_STATS_ADD(bigint_bytes, n * sizeof(uint64_t));
+    (void)n;
+  }
+  bigint() : val_{{0}} { allocated(1); }
+  bigint(uint64_t x) : val_{{x}} { allocated(1); }
+  bigint(const std::vector<uint64_t>& val) : val_{val} {
+    allocated(val_.size());
+    canonize();
+  }
   bigint(bigint&& rhs) : val_{std::move(rhs.val_)} { rhs.val_ = {}; }
-  bigint(const bigint& rhs) : val_{rhs.val_} {}
+  bigint(const bigint& rhs) : val_{rhs.val_} { allocated(val_.size()); }
   bigint operator+(const bigint&) const;
   bigint operator-(const bigint&) const;
   bigint operator*(const bigint&) const;
@@ -153,6 +166,7 @@ struct bigint {
   bigint operator<<(int) const;
   uint64_t operator&(uint64_t x) const { return this->val_[0] & x; }
   bigint& operator=(const bigint& rhs) {
+    if (rhs.size() > val_.capacity()) allocated(rhs.size());
     this->val_ = rhs.val_;
     return *this;
   }
@@ -6,6 +6,7 @@
 
 #include "utils.h"
 #include "integer.h"
+#include "random_bigint.h"
 
 #include <gtest/gtest.h>
 
@@ -42,13 +43,8 @@ TEST(test_dynamic, test_math) {
 };
 
 TEST(test_many_digits, test_mul_add) {
-  std::vector<uint64_t> u, v;
-  for (int i = 0; i < 5000; ++i) {
-    u.push_back(rng.uint64());
-    v.push_back(rng.uint64());
-  }
   // x and y are 5k x 64-bit numbers
-  bigint x(u), y(v);
+  bigint x = random_bigint(rng, 5000 * 64), y = random_bigint(rng, 5000 * 64);
   bigint s = x / y, r = x % y;
   ASSERT_EQ(x.size(), 5000);
   ASSERT_EQ(y.size(), 5000);
@@ -57,6 +53,15 @@ TEST(test_many_digits, test_mul_add) {
   ASSERT_EQ(x + x, x * 2);
 }
 
+TEST(test_random, test_bit_length) {
+  for (size_t bits : {1, 2, 63, 64, 65, 128, 1000}) {
+    bigint x = random_bigint(rng, bits);
+    ASSERT_EQ(x.size(), (bits + 63) / 64);
+    ASSERT_EQ(x.val_.back() >> ((bits - 1) % 64), 1u);
+  }
+  ASSERT_EQ(random_bigint(rng, 1), 1);
+}
+
 TEST(test_static_comp, test_prime) {
   bigint e(12345), n(54321), p(56789);
   bigint enp = pow_mod(e, n, p);
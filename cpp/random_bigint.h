@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "integer.h"
+#include "utils.h"
+
+// a random number of exactly bits bits, bits > 0
+inline bigint random_bigint(Rand& rng, size_t bits) {
+  std::vector<uint64_t> val((bits + 63) / 64);
+  rng.fill(val.data(), val.size());
+  const int top = (bits - 1) % 64;
+  val.back() &= ~uint64_t(0) >> (63 - top);
+  val.back() |= uint64_t(1) << top;
+  return bigint(val);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "simd.h"
+#include "tensor.h"
+
+using kl::simd::Isa;
+
+// state.range(0): number of elements, state.range(1): 0 scalar, 1 SIMD
+static void set_isa(const benchmark::State& state) {
+  kl::simd::set_isa(state.range(1) ? kl::simd::detect_isa() : Isa::scalar);
+}
+
+static void args(benchmark::internal::Benchmark* b) {
+  for (int64_t n : {1 << 10, 1 << 16, 1 << 20})
+    for (int64_t simd : {0, 1}) b->Args({n, simd});
+}
+
+template <typename T>
+static void BM_add(benchmark::State& state) {
+  set_isa(state);
+  const size_t n = state.range(0);
+  std::vector<T> a(n, T(1)), b(n, T(2)), o(n);
+  for (auto _ : state) {
+    kl::simd::add(n, a.data(), b.data(), o.data());
+    benchmark::DoNotOptimize(o.data());
+  }
+  state.SetBytesProcessed(state.iterations() * n * 3 * sizeof(T));
+}
+BENCHMARK_TEMPLATE(BM_add, float)->Apply(args);
+BENCHMARK_TEMPLATE(BM_add, double)->Apply(args);
+BENCHMARK_TEMPLATE(BM_add, int32_t)->Apply(args);
+
+template <typename T>
+static void BM_fma(benchmark::State& state) {
+  set_isa(state);
+  const size_t n = state.range(0);
+  std::vector<T> a(n, T(1)), b(n, T(2)), c(n, T(3)), o(n);
+  for (auto _ : state) {
+    kl::simd::fma(n, a.data(), b.data(), c.data(), o.data());
+    benchmark::DoNotOptimize(o.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_fma, float)->Apply(args);
+BENCHMARK_TEMPLATE(BM_fma, double)->Apply(args);
+
+#define KL_BENCH_MATH(name)                                      \
+  template <typename T>                                          \
+  static void BM_##name(benchmark::State& state) {               \
+    set_isa(state);                                              \
+    const size_t n = state.range(0);                             \
+    std::vector<T> a(n), o(n);                                   \
+    for (size_t i = 0; i < n; ++i) a[i] = T(0.5) + T(i % 100) / 10; \
+    for (auto _ : state) {                                       \
+      kl::simd::name(n, a.data(), o.data());                     \
+      benchmark::DoNotOptimize(o.data());                        \
+    }                                                            \
+    state.SetItemsProcessed(state.iterations() * n);             \
+  }                                                              \
+  BENCHMARK_TEMPLATE(BM_##name, float)->Apply(args);             \
+  BENCHMARK_TEMPLATE(BM_##name, double)->Apply(args);
+KL_BENCH_MATH(exp)
+KL_BENCH_MATH(log)
+KL_BENCH_MATH(tanh)
+#undef KL_BENCH_MATH
+
+// Tensor elementwise through the expression evaluator
+static void BM_tensor_mul(benchmark::State& state) {
+  set_isa(state);
+  const uint64_t n = state.range(0);
+  kl::Tensor<float> x(kl::Shape({n}), std::vector<float>(n, 1.5f)),
+      y(kl::Shape({n}), std::vector<float>(n, 2.5f));
+  for (auto _ : state) {
+    kl::Tensor<float> z = x * y;
+    benchmark::DoNotOptimize(z.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_mul)->Apply(args);
+
+BENCHMARK_MAIN();
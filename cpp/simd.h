@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace kl {
+namespace simd {
+// Elementwise kernels over arrays, written once on GCC vector types and
+// compiled for AVX-512, AVX2 and NEON register widths; the widest one the
+// CPU supports is picked at runtime. The scalar path is a plain loop that
+// calls the standard math library.
+
+enum class Isa { scalar, avx2, avx512, neon };
+
+inline Isa detect_isa() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+    return Isa::avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return Isa::avx2;
+  return Isa::scalar;
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+  return Isa::neon;
+#else
+  return Isa::scalar;
+#endif
+}
+
+inline std::atomic<Isa>& isa_slot() {
+  static std::atomic<Isa> isa{detect_isa()};
+  return isa;
+}
+
+inline Isa active_isa() { return isa_slot().load(std::memory_order_relaxed); }
+
+// select the kernels to use, an ISA the CPU lacks falls back to the best
+// one it has; returns the ISA now in use
+inline Isa set_isa(Isa isa) {
+  const Isa best = detect_isa();
+  const bool ok = isa == Isa::scalar || isa == best ||
+                  (isa == Isa::avx2 && best == Isa::avx512);
+  isa_slot().store(ok ? isa : best, std::memory_order_relaxed);
+  return active_isa();
+}
+
+#define KL_SIMD_INLINE inline __attribute__((always_inline))
+
+template <typename T, size_t Bytes>
+struct vec {
+  typedef T type __attribute__((vector_size(Bytes)));
+};
+
+// integer type and exponent layout of a floating point type
+template <typename T>
+struct fbits;
+template <>
+struct fbits<float> {
+  typedef int32_t itype;
+  static constexpr int mant = 23, bias = 127;
+};
+template <>
+struct fbits<double> {
+  typedef int64_t itype;
+  static constexpr int mant = 52, bias = 1023;
+};
+
+// Wide vectors are passed by reference and results come back through
+// reference arguments: GCC warns (-Wpsabi) on any function returning a
+// vector wider than its own target's registers, and it reports that for
+// template instantiations at the end of the including file, where no
+// diagnostic pragma of this header can reach. Scalars broadcast in vector
+// arithmetic and in ?:, so V{} + x stands for a splat.
+
+// exp: x = n ln2 + r with |r| <= ln2 / 2, a Taylor polynomial for e^r and
+// 2^n applied as two factors so that subnormal results come out right
+template <typename V, typename T>
+KL_SIMD_INLINE void vexp(const V& x, V& out) {
+  typedef fbits<T> fb;
+  typedef typename vec<typename fb::itype, sizeof(V)>::type IV;
+  constexpr bool dbl = std::is_same<T, double>::value;
+  const T maxlog = dbl ? 709.782712893384 : 88.7228391f;
+  const T minlog = dbl ? -745.1332191019412 : -103.972084f;
+  const T ln2hi = dbl ? 6.93145751953125E-1 : 0.693359375f;
+  const T ln2lo = dbl ? 1.42860682030941723212E-6 : -2.12194440e-4f;
+  constexpr int deg = dbl ? 13 : 7;
+
+  V xc = (x > maxlog) ? maxlog : x;
+  xc = (xc < minlog) ? minlog : xc;
+  const V t = xc * T(1.4426950408889634) + ((xc >= T(0)) ? T(0.5) : T(-0.5));
+  const IV n = __builtin_convertvector(t, IV);
+  const V nf = __builtin_convertvector(n, V);
+  const V r = (xc - nf * ln2hi) - nf * ln2lo;
+  // 1 / k! from k = deg down to 0
+  constexpr T cd[] = {1 / 6227020800.0, 1 / 479001600.0, 1 / 39916800.0,
+                      1 / 3628800.0,    1 / 362880.0,    1 / 40320.0,
+                      1 / 5040.0,       1 / 720.0,       1 / 120.0,
+                      1 / 24.0,         1 / 6.0,         1 / 2.0,
+                      1.0,              1.0};
+  V p = V{} + cd[13 - deg];
+#pragma GCC unroll 16
+  for (int k = 13 - deg + 1; k < 14; ++k) p = p * r + cd[k];
+  const IV n1 = n >> 1, n2 = n - n1;
+  const V s1 = (V)((n1 + fb::bias) << fb::mant);
+  const V s2 = (V)((n2 + fb::bias) << fb::mant);
+  V res = p * s1 * s2;
+  res = (x > maxlog) ? std::numeric_limits<T>::infinity() : res;
+  out = (x < minlog) ? T(0) : res;
+}
+
+// log: x = 2^e m with m in [sqrt(1/2), sqrt(2)), log m = 2 atanh(s) with
+// s = (m - 1) / (m + 1) summed as an odd series
+template <typename V, typename T>
+KL_SIMD_INLINE void vlog(const V& x, V& out) {
+  typedef fbits<T> fb;
+  typedef typename fb::itype I;
+  typedef typename vec<I, sizeof(V)>::type IV;
+  constexpr bool dbl = std::is_same<T, double>::value;
+  const T ln2hi = dbl ? 6.93145751953125E-1 : 0.693359375f;
+  const T ln2lo = dbl ? 1.42860682030941723212E-6 : -2.12194440e-4f;
+  constexpr int terms = dbl ? 11 : 6;
+
+  const IV sub = x < std::numeric_limits<T>::min();  // scale subnormals up
+  const V xs = sub ? x * T(I(1) << (fb::mant + 2)) : x;
+  const IV bits = (IV)xs;
+  IV e = ((bits >> fb::mant) & ((I(1) << (8 * sizeof(T) - 1 - fb::mant)) - 1)) -
+         (fb::bias - 1) + (sub & -(fb::mant + 2));
+  V m = (V)((bits & ((I(1) << fb::mant) - 1)) | (I(fb::bias - 1) << fb::mant));
+  const IV low = m < T(0.7071067811865476);
+  m = low ? m + m : m;
+  e = e + low;
+
+  const V s = (m - T(1)) / (m + T(1)), z = s * s;
+  // 1 / (2k + 1) from k = 10 down to 0
+  constexpr T cl[] = {1 / 21.0, 1 / 19.0, 1 / 17.0, 1 / 15.0, 1 / 13.0, 1 / 11.0,
+                      1 / 9.0,  1 / 7.0,  1 / 5.0,  1 / 3.0,  1.0};
+  V p = V{} + cl[11 - terms];
+#pragma GCC unroll 16
+  for (int k = 11 - terms + 1; k < 11; ++k) p = p * z + cl[k];
+  const V ef = __builtin_convertvector(e, V);
+  V res = ef * ln2hi + (T(2) * s * p + ef * ln2lo);
+
+  res = (x == std::numeric_limits<T>::infinity()) ? x : res;
+  res = (x == T(0)) ? -std::numeric_limits<T>::infinity() : res;
+  // negative and NaN
+  out = (x >= T(0)) ? res : std::numeric_limits<T>::quiet_NaN();
+}
+
+// tanh: rational (double) or polynomial (float) fit of Cephes below 0.625,
+// 1 - 2 / (e^{2|x|} + 1) above
+template <typename V, typename T>
+KL_SIMD_INLINE void vtanh(const V& x, V& out) {
+  const V ax = (x < T(0)) ? -x : x;
+  V e;
+  vexp<V, T>(ax + ax, e);
+  V big = T(1) - T(2) / (e + T(1));
+  big = (x < T(0)) ? -big : big;
+  const V z = x * x;
+  V small;
+  if constexpr (std::is_same<T, double>::value) {
+    const V p = (T(-9.64399179425052238628E-1) * z -
+                 T(9.92877231001918586564E1)) * z -
+                T(1.61468768441708447952E3);
+    const V q = ((z + T(1.12811678491632931402E2)) * z +
+                 T(2.23548839060100448583E3)) * z +
+                T(4.84406305325125486048E3);
+    small = x + x * z * p / q;
+  } else {
+    small = ((((T(-5.70498872745E-3) * z + T(2.06390887954E-2)) * z -
+               T(5.37397155531E-2)) * z + T(1.33314422036E-1)) * z -
+             T(3.33332819422E-1)) * z * x + x;
+  }
+  out = (ax < T(0.625)) ? small : big;
+}
+
+// functors usable on vectors and on scalars, r = op(a...)
+struct add_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& a, const V& b) const {
+    r = a + b;
+  }
+};
+struct sub_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& a, const V& b) const {
+    r = a - b;
+  }
+};
+struct mul_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& a, const V& b) const {
+    r = a * b;
+  }
+};
+struct div_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& a, const V& b) const {
+    r = a / b;
+  }
+};
+struct fma_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& a, const V& b,
+                                 const V& c) const {
+    r = a * b + c;
+  }
+};
+template <typename T>
+struct exp_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& x) const {
+    if constexpr (std::is_arithmetic<V>::value) {
+      r = std::exp(x);
+    } else {
+      vexp<V, T>(x, r);
+    }
+  }
+};
+template <typename T>
+struct log_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& x) const {
+    if constexpr (std::is_arithmetic<V>::value) {
+      r = std::log(x);
+    } else {
+      vlog<V, T>(x, r);
+    }
+  }
+};
+template <typename T>
+struct tanh_op {
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& x) const {
+    if constexpr (std::is_arithmetic<V>::value) {
+      r = std::tanh(x);
+    } else {
+      vtanh<V, T>(x, r);
+    }
+  }
+};
+// op(a, s) and op(s, a) for a scalar s
+template <typename T, typename Op>
+struct right_op {
+  T s;
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& a) const {
+    Op()(r, a, V{} + s);
+  }
+};
+template <typename T, typename Op>
+struct left_op {
+  T s;
+  template <typename V>
+  KL_SIMD_INLINE void operator()(V& r, const V& a) const {
+    Op()(r, V{} + s, a);
+  }
+};
+
+// f(r, a[I]...)
+template <typename F, typename V, size_t... I>
+KL_SIMD_INLINE void apply(const F& f, V& r, const V* a,
+                          std::index_sequence<I...>) {
+  f(r, a[I]...);
+}
+
+// o[i] = f(in[i]...) on Bytes wide vectors; the tail goes through a vector
+// padded with ones so every element sees the same arithmetic
+template <size_t Bytes, typename T, typename F, typename... P>
+KL_SIMD_INLINE void map(size_t n, T* o, F f, const P*... in) {
+  typedef typename vec<T, Bytes>::type V;
+  constexpr size_t L = Bytes / sizeof(T);
+  auto load = [](V& v, const T* p, size_t len) __attribute__((always_inline)) {
+    if (len == L) {
+      memcpy(&v, p, Bytes);
+    } else {
+      T t[L];
+      for (size_t k = 0; k < L; ++k) t[k] = (k < len) ? p[k] : T(1);
+      memcpy(&v, t, Bytes);
+    }
+  };
+  const auto seq = std::index_sequence_for<P...>();
+  V a[sizeof...(P)], r;
+  size_t i = 0;
+  for (; i + L <= n; i += L) {
+    size_t k = 0;
+    (load(a[k++], in + i, L), ...);
+    apply(f, r, a, seq);
+    memcpy(o + i, &r, Bytes);
+  }
+  if (i < n) {
+    size_t k = 0;
+    (load(a[k++], in + i, n - i), ...);
+    apply(f, r, a, seq);
+    T t[L];
+    memcpy(t, &r, Bytes);
+    for (size_t j = 0; j < n - i; ++j) o[i + j] = t[j];
+  }
+}
+
+template <typename T, typename F, typename... P>
+void map_scalar(size_t n, T* o, F f, const P*... in) {
+  for (size_t i = 0; i < n; ++i) f(o[i], in[i]...);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <typename T, typename F, typename... P>
+__attribute__((target("avx2,fma"))) void map_avx2(size_t n, T* o, F f,
+                                                   const P*... in) {
+  map<32>(n, o, f, in...);
+}
+template <typename T, typename F, typename... P>
+__attribute__((target("avx512f,avx512dq,fma"))) void map_avx512(
+    size_t n, T* o, F f, const P*... in) {
+  map<64>(n, o, f, in...);
+}
+#endif
+
+template <typename T, typename F, typename... P>
+void dispatch(size_t n, T* o, F f, const P*... in) {
+  switch (active_isa()) {
+#if defined(__x86_64__) || defined(__i386__)
+    case Isa::avx512:
+      return map_avx512(n, o, f, in...);
+    case Isa::avx2:
+      return map_avx2(n, o, f, in...);
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+    case Isa::neon:
+      return map<16>(n, o, f, in...);
+#endif
+    default:
+      return map_scalar(n, o, f, in...);
+  }
+}
+
+#undef KL_SIMD_INLINE
+
+// o = a op b, o = a op s and o = s op a, o may alias an input
+template <typename T>
+void add(size_t n, const T* a, const T* b, T* o) {
+  dispatch(n, o, add_op(), a, b);
+}
+template <typename T>
+void sub(size_t n, const T* a, const T* b, T* o) {
+  dispatch(n, o, sub_op(), a, b);
+}
+template <typename T>
+void mul(size_t n, const T* a, const T* b, T* o) {
+  dispatch(n, o, mul_op(), a, b);
+}
+template <typename T>
+void div(size_t n, const T* a, const T* b, T* o) {
+  dispatch(n, o, div_op(), a, b);
+}
+
+template <typename T>
+void add(size_t n, const T* a, T s, T* o) {
+  dispatch(n, o, right_op<T, add_op>{s}, a);
+}
+template <typename T>
+void sub(size_t n, const T* a, T s, T* o) {
+  dispatch(n, o, right_op<T, sub_op>{s}, a);
+}
+template <typename T>
+void mul(size_t n, const T* a, T s, T* o) {
+  dispatch(n, o, right_op<T, mul_op>{s}, a);
+}
+template <typename T>
+void div(size_t n, const T* a, T s, T* o) {
+  dispatch(n, o, right_op<T, div_op>{s}, a);
+}
+
+template <typename T>
+void add(size_t n, T s, const T* a, T* o) {
+  dispatch(n, o, right_op<T, add_op>{s}, a);
+}
+template <typename T>
+void sub(size_t n, T s, const T* a, T* o) {
+  dispatch(n, o, left_op<T, sub_op>{s}, a);
+}
+template <typename T>
+void mul(size_t n, T s, const T* a, T* o) {
+  dispatch(n, o, right_op<T, mul_op>{s}, a);
+}
+template <typename T>
+void div(size_t n, T s, const T* a, T* o) {
+  dispatch(n, o, left_op<T, div_op>{s}, a);
+}
+
+// o = a * b + c, fused where the ISA has an fma instruction
+template <typename T>
+void fma(size_t n, const T* a, const T* b, const T* c, T* o) {
+  dispatch(n, o, fma_op(), a, b, c);
+}
+
+// o = exp(a), log(a), tanh(a) for float and double, within a few ulp of
+// the standard library
+template <typename T>
+void exp(size_t n, const T* a, T* o) {
+  static_assert(std::is_floating_point<T>::value, "exp needs float/double");
+  dispatch(n, o, exp_op<T>(), a);
+}
+template <typename T>
+void log(size_t n, const T* a, T* o) {
+  static_assert(std::is_floating_point<T>::value, "log needs float/double");
+  dispatch(n, o, log_op<T>(), a);
+}
+template <typename T>
+void tanh(size_t n, const T* a, T* o) {
+  static_assert(std::is_floating_point<T>::value, "tanh needs float/double");
+  dispatch(n, o, tanh_op<T>(), a);
+}
+
+}  // namespace simd
+}  // namespace kl
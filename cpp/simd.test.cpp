@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "simd.h"
+
+#include <gtest/gtest.h>
+#include <time.h>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "utils.h"
+
+using kl::simd::Isa;
+
+Rand rng(82 + time(nullptr));
+
+// scalar first, then the best the CPU has
+static std::vector<Isa> isas() {
+  std::vector<Isa> res{Isa::scalar};
+  if (kl::simd::detect_isa() != Isa::scalar)
+    res.push_back(kl::simd::detect_isa());
+  if (kl::simd::detect_isa() == Isa::avx512) res.push_back(Isa::avx2);
+  return res;
+}
+
+template <typename T>
+static void check_arith(size_t n) {
+  std::vector<T> a(n), b(n), c(n), o(n);
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = static_cast<T>(rng.uniform<int32_t>(-1000, 1000));
+    b[i] = static_cast<T>(rng.uniform<int32_t>(1, 1000));
+    c[i] = static_cast<T>(rng.uniform<int32_t>(-1000, 1000));
+  }
+  const T s = 7;
+  kl::simd::add(n, a.data(), b.data(), o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(a[i] + b[i]));
+  kl::simd::sub(n, a.data(), b.data(), o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(a[i] - b[i]));
+  kl::simd::mul(n, a.data(), b.data(), o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(a[i] * b[i]));
+  kl::simd::div(n, a.data(), b.data(), o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(a[i] / b[i]));
+  kl::simd::fma(n, a.data(), b.data(), c.data(), o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(a[i] * b[i] + c[i]));
+  kl::simd::sub(n, a.data(), s, o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(a[i] - s));
+  kl::simd::sub(n, s, a.data(), o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(s - a[i]));
+  kl::simd::div(n, s, b.data(), o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(s / b[i]));
+  o = a;  // in place
+  kl::simd::mul(n, o.data(), s, o.data());
+  for (size_t i = 0; i < n; ++i) ASSERT_EQ(o[i], T(a[i] * s));
+}
+
+TEST(test_simd, arithmetic) {
+  for (auto isa : isas()) {
+    kl::simd::set_isa(isa);
+    for (size_t n : {0, 1, 7, 15, 16, 17, 33, 1000}) {
+      check_arith<float>(n);
+      check_arith<double>(n);
+      check_arith<int32_t>(n);
+      check_arith<int64_t>(n);
+    }
+  }
+  kl::simd::set_isa(kl::simd::detect_isa());
+};
+
+// max error in ulp of f against the long double reference g
+template <typename T, typename F, typename G>
+static double max_ulp(const std::vector<T>& x, F f, G g) {
+  std::vector<T> y(x.size());
+  f(x.size(), x.data(), y.data());
+  double res = 0.0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    const long double r = g(static_cast<long double>(x[i]));
+    const T ref = static_cast<T>(r);
+    if (std::isnan(r) || std::isinf(ref) || r == 0) {
+      EXPECT_TRUE((std::isnan(r) && std::isnan(y[i])) || y[i] == ref)
+          << x[i] << " " << y[i] << " " << static_cast<double>(r);
+      continue;
+    }
+    int e;
+    std::frexp(ref, &e);
+    const long double ulp = std::ldexp(
+        1.0L, std::max(e, std::numeric_limits<T>::min_exponent) -
+                  std::numeric_limits<T>::digits);
+    res = std::max<double>(res, std::fabs((y[i] - r) / ulp));
+  }
+  return res;
+}
+
+template <typename T>
+static void check_math() {
+  std::vector<T> x, xp;
+  for (int i = 0; i < 20000; ++i) {
+    x.push_back(static_cast<T>((rng.doub() - 0.5) * 60));
+    xp.push_back(static_cast<T>(std::exp((rng.doub() - 0.5) * 1200) + 0.0));
+  }
+  const T inf = std::numeric_limits<T>::infinity();
+  const T nan = std::numeric_limits<T>::quiet_NaN();
+  for (T v : {T(0), T(-0.0), T(1), T(-1), T(1e-3), T(0.6), T(0.65), T(700),
+              T(-740), T(88), T(-100), inf, -inf, nan, T(1e-30)}) {
+    x.push_back(v);
+  }
+  for (T v : {T(0), T(1), T(2), T(1e-40), std::numeric_limits<T>::min(),
+              std::numeric_limits<T>::denorm_min(), T(-1), inf, nan}) {
+    xp.push_back(v);
+  }
+  auto ex = [](size_t n, const T* a, T* o) { kl::simd::exp(n, a, o); };
+  auto lg = [](size_t n, const T* a, T* o) { kl::simd::log(n, a, o); };
+  auto th = [](size_t n, const T* a, T* o) { kl::simd::tanh(n, a, o); };
+  EXPECT_LT(max_ulp(x, ex, [](long double v) { return std::exp(v); }), 4.0);
+  EXPECT_LT(max_ulp(xp, lg, [](long double v) { return std::log(v); }), 4.0);
+  EXPECT_LT(max_ulp(x, th, [](long double v) { return std::tanh(v); }), 4.0);
+}
+
+TEST(test_simd, exp_log_tanh) {
+  for (auto isa : isas()) {
+    kl::simd::set_isa(isa);
+    check_math<float>();
+    check_math<double>();
+  }
+  kl::simd::set_isa(kl::simd::detect_isa());
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+namespace kl {
+template <typename T, size_t N>
+class SmallVector;
+
+// a view of n contiguous elements, the std::span of C++20 in short
+template <typename T>
+class Span final {
+ public:
+  typedef std::remove_const_t<T> value_type;
+  typedef T* iterator;
+  typedef T* const_iterator;
+
+  constexpr Span() noexcept : p_{nullptr}, n_{0} {}
+  constexpr Span(T* p, size_t n) noexcept : p_{p}, n_{n} {}
+  template <typename A>
+  Span(const std::vector<value_type, A>& v) noexcept
+      : p_{v.data()}, n_{v.size()} {}
+  template <typename A>
+  Span(std::vector<value_type, A>& v) noexcept : p_{v.data()}, n_{v.size()} {}
+  template <size_t N>
+  Span(const SmallVector<value_type, N>& v) noexcept
+      : p_{v.data()}, n_{v.size()} {}
+  template <size_t N>
+  Span(SmallVector<value_type, N>& v) noexcept : p_{v.data()}, n_{v.size()} {}
+  Span(const Span<value_type>& s) noexcept : p_{s.data()}, n_{s.size()} {}
+  // only for arguments, the list does not outlive the call
+  Span(std::initializer_list<value_type> v) noexcept
+      : p_{v.begin()}, n_{v.size()} {}
+
+  T* data() const noexcept { return p_; }
+  size_t size() const noexcept { return n_; }
+  bool empty() const noexcept { return n_ == 0; }
+  T* begin() const noexcept { return p_; }
+  T* end() const noexcept { return p_ + n_; }
+  T& operator[](size_t i) const noexcept { return p_[i]; }
+  T& front() const noexcept { return p_[0]; }
+  T& back() const noexcept { return p_[n_ - 1]; }
+  // the first or the last n elements
+  Span first(size_t n) const noexcept { return Span(p_, n); }
+  Span last(size_t n) const noexcept { return Span(p_ + n_ - n, n); }
+
+  std::vector<value_type> vec() const { return {p_, p_ + n_}; }
+  operator std::vector<value_type>() const { return this->vec(); }
+
+  template <typename U>
+  bool operator==(Span<U> rhs) const noexcept {
+    return std::equal(begin(), end(), rhs.begin(), rhs.end());
+  }
+  template <typename U>
+  bool operator!=(Span<U> rhs) const noexcept {
+    return !(*this == rhs);
+  }
+  template <typename A>
+  bool operator==(const std::vector<value_type, A>& rhs) const noexcept {
+    return std::equal(begin(), end(), rhs.begin(), rhs.end());
+  }
+  template <typename A>
+  bool operator!=(const std::vector<value_type, A>& rhs) const noexcept {
+    return !(*this == rhs);
+  }
+
+ private:
+  T* p_;
+  size_t n_;
+};
+
+template <typename T, typename A>
+bool operator==(const std::vector<std::remove_const_t<T>, A>& lhs,
+                Span<T> rhs) noexcept {
+  return rhs == lhs;
+}
+template <typename T, typename A>
+bool operator!=(const std::vector<std::remove_const_t<T>, A>& lhs,
+                Span<T> rhs) noexcept {
+  return rhs != lhs;
+}
+
+// a vector of trivially copyable elements that keeps up to N of them
+// inline and only allocates beyond that; shapes and strides of tensors
+// hardly ever have more than a few elements
+template <typename T, size_t N = 8>
+class SmallVector final {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SmallVector elements are trivially copyable");
+
+ public:
+  typedef T value_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  SmallVector() noexcept : p_{buf_}, n_{0}, cap_{N} {}
+  explicit SmallVector(size_t n, const T& v = T()) : SmallVector() {
+    this->resize(n, v);
+  }
+  SmallVector(std::initializer_list<T> v)
+      : SmallVector(Span<const T>(v.begin(), v.size())) {}
+  SmallVector(Span<const T> v) : SmallVector() {
+    this->reserve(v.size());
+    if (!v.empty()) memcpy(p_, v.data(), v.size() * sizeof(T));
+    n_ = v.size();
+  }
+  template <typename A>
+  SmallVector(const std::vector<T, A>& v)
+      : SmallVector(Span<const T>(v.data(), v.size())) {}
+  template <typename It,
+            typename = typename std::iterator_traits<It>::iterator_category>
+  SmallVector(It first, It last) : SmallVector() {
+    for (; first != last; ++first) this->push_back(*first);
+  }
+  SmallVector(const SmallVector& rhs) : SmallVector(Span<const T>(rhs)) {}
+  SmallVector(SmallVector&& rhs) noexcept : SmallVector() {
+    this->steal(rhs);
+  }
+  SmallVector& operator=(const SmallVector& rhs) {
+    if (this != &rhs) this->assign(rhs.begin(), rhs.end());
+    return *this;
+  }
+  SmallVector& operator=(SmallVector&& rhs) noexcept {
+    if (this != &rhs) {
+      this->free();
+      p_ = buf_;
+      cap_ = N;
+      this->steal(rhs);
+    }
+    return *this;
+  }
+  ~SmallVector() { this->free(); }
+
+  void assign(const T* first, const T* last) {
+    n_ = 0;
+    this->reserve(last - first);
+    if (first != last) memmove(p_, first, (last - first) * sizeof(T));
+    n_ = last - first;
+  }
+
+  T* data() noexcept { return p_; }
+  const T* data() const noexcept { return p_; }
+  size_t size() const noexcept { return n_; }
+  size_t capacity() const noexcept { return cap_; }
+  bool empty() const noexcept { return n_ == 0; }
+  bool is_inline() const noexcept { return p_ == buf_; }
+  T* begin() noexcept { return p_; }
+  T* end() noexcept { return p_ + n_; }
+  const T* begin() const noexcept { return p_; }
+  const T* end() const noexcept { return p_ + n_; }
+  T& operator[](size_t i) noexcept { return p_[i]; }
+  const T& operator[](size_t i) const noexcept { return p_[i]; }
+  T& front() noexcept { return p_[0]; }
+  const T& front() const noexcept { return p_[0]; }
+  T& back() noexcept { return p_[n_ - 1]; }
+  const T& back() const noexcept { return p_[n_ - 1]; }
+
+  void reserve(size_t n) {
+    if (n <= cap_) return;
+    const size_t cap = std::max(n, 2 * cap_);
+    T* p = static_cast<T*>(::operator new(cap * sizeof(T)));
+    if (n_ > 0) memcpy(p, p_, n_ * sizeof(T));
+    this->free();
+    p_ = p;
+    cap_ = cap;
+  }
+  void resize(size_t n, const T& v = T()) {
+    const T c = v;  // v may be an element
+    this->reserve(n);
+    for (size_t i = n_; i < n; ++i) p_[i] = c;
+    n_ = n;
+  }
+  void clear() noexcept { n_ = 0; }
+  void push_back(const T& v) {
+    if (n_ == cap_) {
+      const T c = v;  // v may be an element
+      this->reserve(n_ + 1);
+      p_[n_++] = c;
+    } else {
+      p_[n_++] = v;
+    }
+  }
+  void pop_back() noexcept { --n_; }
+  T* insert(const T* pos, const T& v) {
+    const size_t i = pos - p_;
+    const T c = v;  // v may be an element
+    this->reserve(n_ + 1);
+    memmove(p_ + i + 1, p_ + i, (n_ - i) * sizeof(T));
+    p_[i] = c;
+    ++n_;
+    return p_ + i;
+  }
+  T* erase(const T* pos) noexcept {
+    const size_t i = pos - p_;
+    memmove(p_ + i, p_ + i + 1, (n_ - i - 1) * sizeof(T));
+    --n_;
+    return p_ + i;
+  }
+
+  std::vector<T> vec() const { return {p_, p_ + n_}; }
+
+  bool operator==(Span<const T> rhs) const noexcept {
+    return Span<const T>(*this) == rhs;
+  }
+  bool operator!=(Span<const T> rhs) const noexcept {
+    return !(*this == rhs);
+  }
+  bool operator==(const SmallVector& rhs) const noexcept {
+    return Span<const T>(*this) == Span<const T>(rhs);
+  }
+  bool operator!=(const SmallVector& rhs) const noexcept {
+    return !(*this == rhs);
+  }
+
+ private:
+  void free() noexcept {
+    if (p_ != buf_) ::operator delete(p_);
+  }
+  // take the elements of rhs, its buffer if it is on the heap; this is
+  // empty and inline
+  void steal(SmallVector& rhs) noexcept {
+    if (rhs.p_ == rhs.buf_) {
+      if (rhs.n_ > 0) memcpy(buf_, rhs.buf_, rhs.n_ * sizeof(T));
+    } else {
+      p_ = rhs.p_;
+      cap_ = rhs.cap_;
+      rhs.p_ = rhs.buf_;
+      rhs.cap_ = N;
+    }
+    n_ = rhs.n_;
+    rhs.n_ = 0;
+  }
+
+  T* p_;
+  size_t n_;
+  size_t cap_;
+  T buf_[N];
+};
+
+}  // namespace kl
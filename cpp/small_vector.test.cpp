@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "small_vector.h"
+
+#include <gtest/gtest.h>
+
+#include "utils.h"
+
+using kl::SmallVector;
+using kl::Span;
+
+Rand rng(82 + time(nullptr));
+
+TEST(test_small_vector, matches_vector) {
+  // random edits, across the inline capacity and back
+  SmallVector<int64_t, 4> a;
+  std::vector<int64_t> b;
+  for (int i = 0; i < 2000; ++i) {
+    const int64_t v = rng.int32();
+    switch (rng.uint32(6)) {
+      case 0:
+      case 1:
+        a.push_back(v);
+        b.push_back(v);
+        break;
+      case 2:
+        if (!b.empty()) {
+          a.pop_back();
+          b.pop_back();
+        }
+        break;
+      case 3: {
+        const size_t k = rng.uint32(b.size() + 1);
+        a.insert(a.begin() + k, v);
+        b.insert(b.begin() + k, v);
+        break;
+      }
+      case 4:
+        if (!b.empty()) {
+          const size_t k = rng.uint32(b.size());
+          a.erase(a.begin() + k);
+          b.erase(b.begin() + k);
+        }
+        break;
+      default:
+        if (b.size() > 20) {
+          a.resize(3);
+          b.resize(3);
+        }
+    }
+    ASSERT_EQ(a.size(), b.size());
+    ASSERT_EQ(Span<const int64_t>(a), b);
+  }
+
+  // an element of itself as the argument
+  SmallVector<int, 2> c{7, 8};
+  c.push_back(c[0]);
+  c.insert(c.begin(), c.back());
+  EXPECT_EQ(c.vec(), std::vector<int>({7, 7, 8, 7}));
+};
+
+TEST(test_small_vector, copy_and_move) {
+  SmallVector<int, 3> in{1, 2}, out{1, 2, 3, 4, 5};
+  EXPECT_TRUE(in.is_inline());
+  EXPECT_FALSE(out.is_inline());
+  for (const auto& v : {in, out}) {
+    SmallVector<int, 3> c(v), d;
+    EXPECT_EQ(c, v);
+    d = c;
+    EXPECT_EQ(d, v);
+    const int* p = c.data();
+    SmallVector<int, 3> m(std::move(c));
+    EXPECT_EQ(m, v);
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(m.data() == p, !v.is_inline());
+    d = std::move(m);
+    EXPECT_EQ(d, v);
+    d = d;
+    EXPECT_EQ(d, v);
+  }
+
+  const std::vector<int> w{4, 5, 6};
+  const Span<const int> s(w);
+  EXPECT_EQ(SmallVector<int>(s), s);
+  EXPECT_EQ(s.first(2).vec(), std::vector<int>({4, 5}));
+  EXPECT_EQ(s.last(1).vec(), std::vector<int>({6}));
+  EXPECT_EQ(w, s);
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#include "algebra.h"
+#include "thread_pool.h"
+
+template <typename T>
+struct CSCMatrix;
+
+// compressed sparse row matrix
+// row i holds val[ptr[i]..ptr[i + 1]) at columns idx[...], sorted by column
+template <typename T>
+struct CSRMatrix {
+  int rows = 0, cols = 0;
+  std::vector<int64_t> ptr{0};
+  std::vector<int> idx;
+  std::vector<T> val;
+
+  int64_t nnz() const noexcept { return ptr.back(); }
+
+  // build from nnz (i[k], j[k], v[k]) entries, duplicates are summed
+  static CSRMatrix from_triplets(const int rows, const int cols,
+                                 const int64_t nnz, const int* i,
+                                 const int* j, const T* v) {
+    CSRMatrix res;
+    res.rows = rows;
+    res.cols = cols;
+    std::vector<int64_t> count(rows + 1, 0);
+    for (int64_t k = 0; k < nnz; ++k) ++count[i[k] + 1];
+    std::partial_sum(count.begin(), count.end(), count.begin());
+    std::vector<int64_t> order(nnz);
+    std::vector<int64_t> next(count.begin(), count.end() - 1);
+    for (int64_t k = 0; k < nnz; ++k) order[next[i[k]]++] = k;
+
+    res.ptr.assign(rows + 1, 0);
+    for (int r = 0; r < rows; ++r) {
+      auto first = order.begin() + count[r], last = order.begin() + count[r + 1];
+      std::sort(first, last, [j](int64_t a, int64_t b) { return j[a] < j[b]; });
+      for (auto it = first; it != last; ++it) {
+        if (res.idx.size() > static_cast<size_t>(res.ptr[r]) &&
+            res.idx.back() == j[*it]) {
+          res.val.back() += v[*it];
+        } else {
+          res.idx.push_back(j[*it]);
+          res.val.push_back(v[*it]);
+        }
+      }
+      res.ptr[r + 1] = res.idx.size();
+    }
+    return res;
+  }
+
+  CSCMatrix<T> to_csc() const;
+
+  // y = A x
+  void multiply(const T* x, T* y) const { this->multiply_rows(0, rows, x, y); }
+
+  // y = A x, rows are cut into contiguous blocks of about equal nnz
+  void multiply(const T* x, T* y, kl::ThreadPool& pool) const {
+    const int nblk = std::min<int>(rows, 4 * pool.size());
+    if (nblk < 2) return this->multiply(x, y);
+    std::vector<int> bound(nblk + 1, rows);
+    for (int b = 0; b < nblk; ++b) {
+      const int64_t target = this->nnz() * b / nblk;
+      bound[b] = std::lower_bound(ptr.begin(), ptr.end(), target) - ptr.begin();
+      bound[b] = std::min(bound[b], rows);
+    }
+    kl::parallel_for(pool, 0, nblk, 1, [&](size_t lo, size_t hi) {
+      for (size_t b = lo; b < hi; ++b)
+        this->multiply_rows(bound[b], bound[b + 1], x, y);
+    });
+  }
+
+  // y = A x, serial when pool is null
+  void multiply(const T* x, T* y, kl::ThreadPool* pool) const {
+    if (pool) return this->multiply(x, y, *pool);
+    this->multiply(x, y);
+  }
+
+ private:
+  void multiply_rows(const int r0, const int r1, const T* x, T* y) const {
+    for (int r = r0; r < r1; ++r) {
+      T sum = 0.0;
+      for (int64_t k = ptr[r]; k < ptr[r + 1]; ++k) sum += val[k] * x[idx[k]];
+      y[r] = sum;
+    }
+  }
+};
+
+// compressed sparse column matrix
+// column j holds val[ptr[j]..ptr[j + 1]) at rows idx[...], sorted by row
+template <typename T>
+struct CSCMatrix {
+  int rows = 0, cols = 0;
+  std::vector<int64_t> ptr{0};
+  std::vector<int> idx;
+  std::vector<T> val;
+
+  int64_t nnz() const noexcept { return ptr.back(); }
+
+  CSRMatrix<T> to_csr() const {
+    CSRMatrix<T> res;
+    res.rows = rows;
+    res.cols = cols;
+    transpose_compressed(cols, rows, ptr, idx, val, res.ptr, res.idx, res.val);
+    return res;
+  }
+
+  // y = A x, scattered column by column
+  void multiply(const T* x, T* y) const {
+    std::fill(y, y + rows, T(0.0));
+    for (int c = 0; c < cols; ++c) {
+      const T xc = x[c];
+      if (xc == 0.0) continue;
+      for (int64_t k = ptr[c]; k < ptr[c + 1]; ++k) y[idx[k]] += val[k] * xc;
+    }
+  }
+
+  // y = A**T x, a gather over columns that runs in parallel
+  void multiply_t(const T* x, T* y, kl::ThreadPool& pool) const {
+    kl::parallel_for(pool, 0, cols, 4096, [&](size_t lo, size_t hi) {
+      for (size_t c = lo; c < hi; ++c) {
+        T sum = 0.0;
+        for (int64_t k = ptr[c]; k < ptr[c + 1]; ++k) sum += val[k] * x[idx[k]];
+        y[c] = sum;
+      }
+    });
+  }
+
+  // outer dimension n, inner dimension m; the result comes out sorted
+  static void transpose_compressed(const int n, const int m,
+                                   const std::vector<int64_t>& ptr,
+                                   const std::vector<int>& idx,
+                                   const std::vector<T>& val,
+                                   std::vector<int64_t>& tptr,
+                                   std::vector<int>& tidx,
+                                   std::vector<T>& tval) {
+    tptr.assign(m + 1, 0);
+    for (auto i : idx) ++tptr[i + 1];
+    std::partial_sum(tptr.begin(), tptr.end(), tptr.begin());
+    tidx.resize(idx.size());
+    tval.resize(val.size());
+    std::vector<int64_t> next(tptr.begin(), tptr.end() - 1);
+    for (int o = 0; o < n; ++o) {
+      for (int64_t k = ptr[o]; k < ptr[o + 1]; ++k) {
+        const int64_t dst = next[idx[k]]++;
+        tidx[dst] = o;
+        tval[dst] = val[k];
+      }
+    }
+  }
+};
+
+template <typename T>
+CSCMatrix<T> CSRMatrix<T>::to_csc() const {
+  CSCMatrix<T> res;
+  res.rows = rows;
+  res.cols = cols;
+  CSCMatrix<T>::transpose_compressed(rows, cols, ptr, idx, val, res.ptr,
+                                     res.idx, res.val);
+  return res;
+}
+
+// vector kernels on the pool, serial when it is null; sums are formed per
+// fixed chunk and added in chunk order, so they are reproducible whatever
+// the pool size
+const size_t sparse_grain = 16384;
+
+template <typename F>
+void sparse_for(kl::ThreadPool* pool, const int n, F&& f) {
+  if (pool) return kl::parallel_for(*pool, 0, n, sparse_grain, f);
+  for (size_t lo = 0; lo < size_t(n); lo += sparse_grain)
+    f(lo, std::min(lo + sparse_grain, size_t(n)));
+}
+
+template <typename T>
+T vdot(const int n, const T* x, const T* y, kl::ThreadPool* pool) {
+  const size_t nchunk = (n + sparse_grain - 1) / sparse_grain;
+  std::vector<T> part(nchunk, 0.0);
+  sparse_for(pool, n, [&](size_t lo, size_t hi) {
+    T sum = 0.0;
+    for (size_t i = lo; i < hi; ++i) sum += x[i] * y[i];
+    part[lo / sparse_grain] = sum;
+  });
+  T res = 0.0;
+  for (auto p : part) res += p;
+  return res;
+}
+
+template <typename T>
+T vnrm2(const int n, const T* x, kl::ThreadPool* pool) {
+  using std::sqrt;
+  return sqrt(vdot<T>(n, x, x, pool));
+}
+
+// y = a * x + b * y
+template <typename T>
+void vaxpby(const int n, const T a, const T* x, const T b, T* y,
+            kl::ThreadPool* pool) {
+  sparse_for(pool, n, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i) y[i] = a * x[i] + b * y[i];
+  });
+}
+
+// preconditioners provide apply(r, z): z = M**-1 r
+template <typename T>
+struct IdentityPreconditioner {
+  int n;
+  void apply(const T* r, T* z) const { std::copy(r, r + n, z); }
+};
+
+// z = r / diag(A)
+template <typename T>
+struct JacobiPreconditioner {
+  std::vector<T> inv_diag;
+
+  explicit JacobiPreconditioner(const CSRMatrix<T>& A) : inv_diag(A.rows, 1.0) {
+    for (int r = 0; r < A.rows; ++r) {
+      for (int64_t k = A.ptr[r]; k < A.ptr[r + 1]; ++k) {
+        if (A.idx[k] == r && A.val[k] != 0.0) inv_diag[r] = 1.0 / A.val[k];
+      }
+    }
+  }
+  void apply(const T* r, T* z) const {
+    for (size_t i = 0; i < inv_diag.size(); ++i) z[i] = r[i] * inv_diag[i];
+  }
+};
+
+// incomplete LU without fill-in: L (unit) and U share the pattern of A
+// the triangular solves of apply are sequential
+template <typename T>
+struct ILU0Preconditioner {
+  CSRMatrix<T> LU;
+  std::vector<int64_t> diag;  // position of (i, i) in LU
+
+  explicit ILU0Preconditioner(const CSRMatrix<T>& A)
+      : LU(A), diag(A.rows, -1) {
+    const int n = A.rows;
+    std::vector<int64_t> where(A.cols, -1);
+    for (int i = 0; i < n; ++i) {
+      const int64_t k0 = LU.ptr[i], k1 = LU.ptr[i + 1];
+      for (int64_t k = k0; k < k1; ++k) where[LU.idx[k]] = k;
+      for (int64_t k = k0; k < k1 && LU.idx[k] < i; ++k) {
+        const int row = LU.idx[k];
+        if (diag[row] < 0) continue;  // structurally zero pivot, left alone
+        const T lik = LU.val[k] /= LU.val[diag[row]];
+        for (int64_t q = diag[row] + 1; q < LU.ptr[row + 1]; ++q) {
+          const int64_t w = where[LU.idx[q]];
+          if (w >= 0) LU.val[w] -= lik * LU.val[q];
+        }
+      }
+      for (int64_t k = k0; k < k1; ++k) {
+        if (LU.idx[k] == i) diag[i] = k;
+        where[LU.idx[k]] = -1;
+      }
+    }
+  }
+
+  void apply(const T* r, T* z) const {
+    const int n = LU.rows;
+    for (int i = 0; i < n; ++i) {  // L y = r
+      T sum = r[i];
+      for (int64_t k = LU.ptr[i]; k < LU.ptr[i + 1] && LU.idx[k] < i; ++k)
+        sum -= LU.val[k] * z[LU.idx[k]];
+      z[i] = sum;
+    }
+    for (int i = n - 1; i >= 0; --i) {  // U z = y
+      if (diag[i] < 0) continue;
+      T sum = z[i];
+      for (int64_t k = diag[i] + 1; k < LU.ptr[i + 1]; ++k)
+        sum -= LU.val[k] * z[LU.idx[k]];
+      z[i] = sum / LU.val[diag[i]];
+    }
+  }
+};
+
+struct SolverOptions {
+  int max_iter = 1000;
+  double tol = 1e-10;  // on ||b - A x|| / ||b||
+  int restart = 30;    // GMRES only
+};
+
+struct SolverResult {
+  int iterations = 0;
+  double residual = 0.0;  // final ||b - A x|| / ||b||
+  bool converged = false;
+};
+
+// preconditioned conjugate gradients for a symmetric positive definite A
+// x holds the initial guess on entry; the solvers run serially when pool
+// is null
+template <typename T, typename Precond>
+SolverResult cg(const CSRMatrix<T>& A, const T* b, T* x, const Precond& M,
+                const SolverOptions& opt, kl::ThreadPool* pool) {
+  const int n = A.rows;
+  SolverResult res;
+  std::vector<T> r(n), z(n), p(n), Ap(n);
+  const T bnorm = vnrm2<T>(n, b, pool);
+  if (bnorm == 0.0) {
+    std::fill(x, x + n, T(0.0));
+    res.converged = true;
+    return res;
+  }
+  A.multiply(x, r.data(), pool);
+  vaxpby<T>(n, 1.0, b, -1.0, r.data(), pool);  // r = b - A x
+  res.residual = vnrm2<T>(n, r.data(), pool) / bnorm;
+  M.apply(r.data(), z.data());
+  p = z;
+  T rz = vdot<T>(n, r.data(), z.data(), pool);
+
+  while (res.residual > opt.tol && res.iterations < opt.max_iter) {
+    A.multiply(p.data(), Ap.data(), pool);
+    const T alpha = rz / vdot<T>(n, p.data(), Ap.data(), pool);
+    vaxpby<T>(n, alpha, p.data(), 1.0, x, pool);
+    vaxpby<T>(n, -alpha, Ap.data(), 1.0, r.data(), pool);
+    ++res.iterations;
+    res.residual = vnrm2<T>(n, r.data(), pool) / bnorm;
+    if (res.residual <= opt.tol) break;
+    M.apply(r.data(), z.data());
+    const T rz_new = vdot<T>(n, r.data(), z.data(), pool);
+    vaxpby<T>(n, 1.0, z.data(), rz_new / rz, p.data(), pool);
+    rz = rz_new;
+  }
+  res.converged = res.residual <= opt.tol;
+  return res;
+}
+
+// right preconditioned BiCGSTAB for a general square A
+template <typename T, typename Precond>
+SolverResult bicgstab(const CSRMatrix<T>& A, const T* b, T* x,
+                      const Precond& M, const SolverOptions& opt,
+                      kl::ThreadPool* pool) {
+  const int n = A.rows;
+  SolverResult res;
+  std::vector<T> r(n), rhat(n), p(n, 0.0), v(n, 0.0), s(n), t(n), ph(n),
+      sh(n);
+  const T bnorm = vnrm2<T>(n, b, pool);
+  if (bnorm == 0.0) {
+    std::fill(x, x + n, T(0.0));
+    res.converged = true;
+    return res;
+  }
+  A.multiply(x, r.data(), pool);
+  vaxpby<T>(n, 1.0, b, -1.0, r.data(), pool);
+  rhat = r;
+  res.residual = vnrm2<T>(n, r.data(), pool) / bnorm;
+  T rho = 1.0, alpha = 1.0, omega = 1.0;
+
+  while (res.residual > opt.tol && res.iterations < opt.max_iter) {
+    const T rho_new = vdot<T>(n, rhat.data(), r.data(), pool);
+    if (rho_new == 0.0 || omega == 0.0) break;  // breakdown
+    const T beta = (rho_new / rho) * (alpha / omega);
+    vaxpby<T>(n, -omega, v.data(), 1.0, p.data(), pool);
+    vaxpby<T>(n, 1.0, r.data(), beta, p.data(), pool);  // p = r + b(p - wv)
+    M.apply(p.data(), ph.data());
+    A.multiply(ph.data(), v.data(), pool);
+    alpha = rho_new / vdot<T>(n, rhat.data(), v.data(), pool);
+    s = r;
+    vaxpby<T>(n, -alpha, v.data(), 1.0, s.data(), pool);
+    ++res.iterations;
+    vaxpby<T>(n, alpha, ph.data(), 1.0, x, pool);
+    res.residual = vnrm2<T>(n, s.data(), pool) / bnorm;
+    if (res.residual <= opt.tol) break;
+
+    M.apply(s.data(), sh.data());
+    A.multiply(sh.data(), t.data(), pool);
+    const T tt = vdot<T>(n, t.data(), t.data(), pool);
+    omega = (tt == 0.0) ? T(0.0) : vdot<T>(n, t.data(), s.data(), pool) / tt;
+    vaxpby<T>(n, omega, sh.data(), 1.0, x, pool);
+    r = s;
+    vaxpby<T>(n, -omega, t.data(), 1.0, r.data(), pool);
+    res.residual = vnrm2<T>(n, r.data(), pool) / bnorm;
+    rho = rho_new;
+  }
+  res.converged = res.residual <= opt.tol;
+  return res;
+}
+
+// right preconditioned restarted GMRES(opt.restart) for a general square A
+// Arnoldi with modified Gram-Schmidt, the small least squares problem is
+// kept triangular with Givens rotations
+template <typename T, typename Precond>
+SolverResult gmres(const CSRMatrix<T>& A, const T* b, T* x, const Precond& M,
+                   const SolverOptions& opt, kl::ThreadPool* pool) {
+  using std::sqrt;
+  const int n = A.rows, m = std::max(1, opt.restart);
+  SolverResult res;
+  std::vector<T> V((m + 1) * static_cast<size_t>(n)), H((m + 1) * m),
+      cs(m), sn(m), g(m + 1), w(n), z(n), y(m);
+  const T bnorm = vnrm2<T>(n, b, pool);
+  if (bnorm == 0.0) {
+    std::fill(x, x + n, T(0.0));
+    res.converged = true;
+    return res;
+  }
+
+  bool stalled = false;
+  while (!stalled) {
+    T* v0 = V.data();
+    A.multiply(x, v0, pool);
+    vaxpby<T>(n, 1.0, b, -1.0, v0, pool);
+    const T beta = vnrm2<T>(n, v0, pool);
+    res.residual = beta / bnorm;
+    if (res.residual <= opt.tol || res.iterations >= opt.max_iter) break;
+    vaxpby<T>(n, 0.0, v0, 1.0 / beta, v0, pool);
+    std::fill(g.begin(), g.end(), T(0.0));
+    g[0] = beta;
+
+    int k = 0;
+    while (k < m && res.iterations < opt.max_iter) {
+      T* vk = V.data() + static_cast<size_t>(n) * k;
+      T* vk1 = vk + n;
+      M.apply(vk, z.data());
+      A.multiply(z.data(), vk1, pool);
+      T* h = &H[(m + 1) * k];
+      for (int i = 0; i <= k; ++i) {
+        const T* vi = V.data() + static_cast<size_t>(n) * i;
+        h[i] = vdot<T>(n, vk1, vi, pool);
+        vaxpby<T>(n, -h[i], vi, 1.0, vk1, pool);
+      }
+      h[k + 1] = vnrm2<T>(n, vk1, pool);
+      if (h[k + 1] != 0.0) vaxpby<T>(n, 0.0, vk1, 1.0 / h[k + 1], vk1, pool);
+
+      for (int i = 0; i < k; ++i) {  // previous rotations
+        const T t = cs[i] * h[i] + sn[i] * h[i + 1];
+        h[i + 1] = -sn[i] * h[i] + cs[i] * h[i + 1];
+        h[i] = t;
+      }
+      const T d = sqrt(h[k] * h[k] + h[k + 1] * h[k + 1]);
+      cs[k] = (d == 0.0) ? T(1.0) : h[k] / d;
+      sn[k] = (d == 0.0) ? T(0.0) : h[k + 1] / d;
+      h[k] = d;
+      h[k + 1] = 0.0;
+      g[k + 1] = -sn[k] * g[k];
+      g[k] = cs[k] * g[k];
+
+      ++res.iterations;
+      if (d == 0.0) {  // H is singular, drop the column and stop
+        stalled = true;
+        break;
+      }
+      ++k;
+      res.residual = ABS<T>(g[k]) / bnorm;
+      if (res.residual <= opt.tol) break;
+    }
+
+    // y = H**-1 g, x += M**-1 V y
+    for (int i = k - 1; i >= 0; --i) {
+      T sum = g[i];
+      for (int j = i + 1; j < k; ++j) sum -= H[i + (m + 1) * j] * y[j];
+      y[i] = sum / H[i + (m + 1) * i];
+    }
+    std::fill(w.begin(), w.end(), T(0.0));
+    for (int j = 0; j < k; ++j)
+      vaxpby<T>(n, y[j], V.data() + static_cast<size_t>(n) * j, 1.0, w.data(),
+                pool);
+    M.apply(w.data(), z.data());
+    vaxpby<T>(n, 1.0, z.data(), 1.0, x, pool);
+  }
+  if (stalled) {
+    A.multiply(x, w.data(), pool);
+    vaxpby<T>(n, 1.0, b, -1.0, w.data(), pool);
+    res.residual = vnrm2<T>(n, w.data(), pool) / bnorm;
+  }
+  res.converged = res.residual <= opt.tol;
+  return res;
+}
+
+template <typename T, typename Precond>
+SolverResult cg(const CSRMatrix<T>& A, const T* b, T* x, const Precond& M,
+                const SolverOptions& opt, kl::ThreadPool& pool) {
+  return cg<T, Precond>(A, b, x, M, opt, &pool);
+}
+
+template <typename T, typename Precond>
+SolverResult bicgstab(const CSRMatrix<T>& A, const T* b, T* x,
+                      const Precond& M, const SolverOptions& opt,
+                      kl::ThreadPool& pool) {
+  return bicgstab<T, Precond>(A, b, x, M, opt, &pool);
+}
+
+template <typename T, typename Precond>
+SolverResult gmres(const CSRMatrix<T>& A, const T* b, T* x, const Precond& M,
+                   const SolverOptions& opt, kl::ThreadPool& pool) {
+  return gmres<T, Precond>(A, b, x, M, opt, &pool);
+}
+
+// serial versions of the solvers above
+template <typename T, typename Precond>
+SolverResult cg(const CSRMatrix<T>& A, const T* b, T* x, const Precond& M,
+                const SolverOptions& opt = SolverOptions()) {
+  return cg<T, Precond>(A, b, x, M, opt, nullptr);
+}
+
+template <typename T, typename Precond>
+SolverResult bicgstab(const CSRMatrix<T>& A, const T* b, T* x,
+                      const Precond& M,
+                      const SolverOptions& opt = SolverOptions()) {
+  return bicgstab<T, Precond>(A, b, x, M, opt, nullptr);
+}
+
+template <typename T, typename Precond>
+SolverResult gmres(const CSRMatrix<T>& A, const T* b, T* x, const Precond& M,
+                   const SolverOptions& opt = SolverOptions()) {
+  return gmres<T, Precond>(A, b, x, M, opt, nullptr);
+}
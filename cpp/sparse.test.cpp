@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "sparse.h"
+
+#include <gtest/gtest.h>
+#include <time.h>
+
+#include <cmath>
+#include <vector>
+
+#include "thread_pool.h"
+#include "utils.h"
+
+Rand rng(82 + time(nullptr));
+
+// 5-point stencil on a g by g grid, plus a convection term c on x
+static CSRMatrix<double> stencil(int g, double c) {
+  std::vector<int> I, J;
+  std::vector<double> V;
+  auto put = [&](int i, int j, double v) {
+    I.push_back(i);
+    J.push_back(j);
+    V.push_back(v);
+  };
+  for (int y = 0; y < g; ++y) {
+    for (int x = 0; x < g; ++x) {
+      const int k = x + g * y;
+      put(k, k, 4.0);
+      if (x > 0) put(k, k - 1, -1.0 - c);
+      if (x + 1 < g) put(k, k + 1, -1.0 + c);
+      if (y > 0) put(k, k - g, -1.0);
+      if (y + 1 < g) put(k, k + g, -1.0);
+    }
+  }
+  return CSRMatrix<double>::from_triplets(g * g, g * g, I.size(), I.data(),
+                                          J.data(), V.data());
+}
+
+static double residual(const CSRMatrix<double>& A, const double* x,
+                       const double* b) {
+  std::vector<double> r(A.rows);
+  A.multiply(x, r.data());
+  double res = 0.0, bn = 0.0;
+  for (int i = 0; i < A.rows; ++i) {
+    res += (r[i] - b[i]) * (r[i] - b[i]);
+    bn += b[i] * b[i];
+  }
+  return std::sqrt(res / bn);
+}
+
+TEST(test_sparse, formats_and_spmv) {
+  const int m = 70, n = 50, nnz = 600;
+  std::vector<int> I(nnz), J(nnz);
+  std::vector<double> V(nnz), D(m * n, 0.0), x(n);
+  for (int k = 0; k < nnz; ++k) {
+    I[k] = rng.uint32(m);
+    J[k] = rng.uint32(n);
+    V[k] = rng.doub() - 0.5;
+    D[I[k] + m * J[k]] += V[k];  // duplicates add up
+  }
+  for (auto& v : x) v = rng.doub() - 0.5;
+  auto A = CSRMatrix<double>::from_triplets(m, n, nnz, I.data(), J.data(),
+                                            V.data());
+  auto C = A.to_csc();
+  auto B = C.to_csr();
+  EXPECT_EQ(A.ptr, B.ptr);
+  EXPECT_EQ(A.idx, B.idx);
+  EXPECT_EQ(A.val, B.val);
+
+  kl::ThreadPool pool(4);
+  std::vector<double> y1(m), y2(m), y3(m), xt(m), yt(n);
+  A.multiply(x.data(), y1.data());
+  A.multiply(x.data(), y2.data(), pool);
+  C.multiply(x.data(), y3.data());
+  for (int i = 0; i < m; ++i) {
+    double v = 0.0;
+    for (int j = 0; j < n; ++j) v += D[i + m * j] * x[j];
+    ASSERT_NEAR(y1[i], v, 1e-12);
+    ASSERT_EQ(y1[i], y2[i]);
+    ASSERT_NEAR(y3[i], v, 1e-12);
+  }
+  for (auto& v : xt) v = rng.doub() - 0.5;
+  C.multiply_t(xt.data(), yt.data(), pool);
+  for (int j = 0; j < n; ++j) {
+    double v = 0.0;
+    for (int i = 0; i < m; ++i) v += D[i + m * j] * xt[i];
+    ASSERT_NEAR(yt[j], v, 1e-12);
+  }
+};
+
+TEST(test_sparse, krylov_solvers) {
+  const int g = 40, n = g * g;
+  SolverOptions opt;
+  opt.tol = 1e-10;
+  opt.max_iter = 2000;
+  std::vector<double> b(n);
+  for (auto& v : b) v = rng.doub() - 0.5;
+  kl::ThreadPool pool(4);
+
+  auto S = stencil(g, 0.0);  // symmetric positive definite
+  JacobiPreconditioner<double> jac(S);
+  ILU0Preconditioner<double> ilu(S);
+  std::vector<double> x1(n, 0.0), x2(n, 0.0), x3(n, 0.0);
+  auto r1 = cg<double>(S, b.data(), x1.data(), jac, opt);
+  auto r2 = cg<double>(S, b.data(), x2.data(), ilu, opt, pool);
+  auto r3 = cg<double>(S, b.data(), x3.data(), jac, opt, pool);
+  EXPECT_TRUE(r1.converged);
+  EXPECT_TRUE(r2.converged);
+  EXPECT_LT(r2.iterations, r1.iterations);
+  EXPECT_LT(residual(S, x1.data(), b.data()), 1e-9);
+  EXPECT_LT(residual(S, x2.data(), b.data()), 1e-9);
+  EXPECT_EQ(r1.iterations, r3.iterations);  // same result on any pool
+  EXPECT_EQ(x1, x3);
+
+  auto N = stencil(g, 0.4);  // nonsymmetric
+  ILU0Preconditioner<double> nilu(N);
+  IdentityPreconditioner<double> id{n};
+  std::vector<double> y1(n, 0.0), y2(n, 0.0), y3(n, 0.0);
+  auto q1 = bicgstab<double>(N, b.data(), y1.data(), nilu, opt, pool);
+  auto q2 = gmres<double>(N, b.data(), y2.data(), nilu, opt, pool);
+  opt.restart = 50;
+  auto q3 = gmres<double>(N, b.data(), y3.data(), id, opt);
+  EXPECT_TRUE(q1.converged);
+  EXPECT_TRUE(q2.converged);
+  EXPECT_TRUE(q3.converged);
+  EXPECT_LT(residual(N, y1.data(), b.data()), 1e-9);
+  EXPECT_LT(residual(N, y2.data(), b.data()), 1e-9);
+  EXPECT_LT(residual(N, y3.data(), b.data()), 1e-9);
+};
+
+TEST(test_sparse, gmres_breakdown) {
+  // A = 0: the first Arnoldi column already makes H singular
+  const int i[] = {0, 1}, j[] = {0, 1};
+  const double v[] = {0.0, 0.0}, b[] = {1.0, 2.0};
+  auto A = CSRMatrix<double>::from_triplets(2, 2, 2, i, j, v);
+  IdentityPreconditioner<double> id{2};
+  std::vector<double> x(2, 0.0);
+  auto r = gmres<double>(A, b, x.data(), id);
+  EXPECT_FALSE(r.converged);
+  EXPECT_EQ(r.iterations, 1);
+  EXPECT_EQ(r.residual, 1.0);
+  EXPECT_EQ(x, std::vector<double>(2, 0.0));
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Operation counters and scoped timers of the hot paths. The hooks are the
+// KL_STATS_* macros, which expand to nothing unless KL_STATS is defined
+// (cmake -DKL_STATS=ON), so a default build pays nothing and does not even
+// evaluate their arguments. Each thread counts into its own slots and
+// stats_snapshot() sums them, with the totals of threads that exited.
+
+#ifdef KL_STATS
+#define KL_STATS_CAT2(a, b) a##b
+#define KL_STATS_CAT(a, b) KL_STATS_CAT2(a, b)
+#define KL_STATS_ADD(stat, n) ::kl::stats_add(::kl::Stat::stat, (n))
+#define KL_STATS_TIMER(name) \
+  ::kl::ScopedTimer KL_STATS_CAT(kl_stats_timer_, __LINE__)(name)
+#else
+#define KL_STATS_ADD(stat, n) ((void)0)
+#define KL_STATS_TIMER(name) ((void)0)
+#endif
+
+namespace kl {
+enum class Stat {
+  limb_ops,       // 64-bit limbs processed by bigint arithmetic
+  bigint_allocs,  // limb buffers allocated by bigint
+  bigint_bytes,   // and their bytes
+  divisions,      // quotient digits estimated by divmod__
+  flops,          // floating point operations of the algebra.h kernels
+  tensor_bytes,   // bytes read and written by Tensor evaluation and copies
+  count
+};
+constexpr size_t num_stats = static_cast<size_t>(Stat::count);
+
+inline const char* stat_name(Stat s) {
+  static const char* names[num_stats] = {"limb_ops",     "bigint_allocs",
+                                         "bigint_bytes", "divmod_divisions",
+                                         "algebra_flops", "tensor_bytes"};
+  return names[static_cast<size_t>(s)];
+}
+
+struct TimerStats {
+  uint64_t count = 0, total_ns = 0, max_ns = 0;
+
+  void add(uint64_t ns) {
+    ++count;
+    total_ns += ns;
+    max_ns = std::max(max_ns, ns);
+  }
+  void merge(const TimerStats& rhs) {
+    count += rhs.count;
+    total_ns += rhs.total_ns;
+    max_ns = std::max(max_ns, rhs.max_ns);
+  }
+};
+
+// the counters and timers of all threads at one point in time
+struct StatsSnapshot {
+  std::array<uint64_t, num_stats> counters{};
+  std::map<std::string, TimerStats> timers;
+
+  uint64_t operator[](Stat s) const {
+    return counters[static_cast<size_t>(s)];
+  }
+
+  // {"counters": {name: value, ...}, "timers": {name: {"count": c,
+  // "total_ns": t, "max_ns": m}, ...}}
+  std::string json() const {
+    std::ostringstream o;
+    o << "{\"counters\": {";
+    for (size_t i = 0; i < num_stats; ++i)
+      o << (i ? ", " : "") << '"' << stat_name(Stat(i)) << "\": " << counters[i];
+    o << "}, \"timers\": {";
+    bool first = true;
+    for (const auto& [name, t] : timers) {
+      o << (first ? "" : ", ") << '"' << escaped(name) << "\": {\"count\": "
+        << t.count << ", \"total_ns\": " << t.total_ns
+        << ", \"max_ns\": " << t.max_ns << '}';
+      first = false;
+    }
+    o << "}}";
+    return o.str();
+  }
+
+  // the Prometheus text exposition format, counters as kl_<name>_total and
+  // timers as kl_timer_{count,seconds_total,max_seconds}{name="..."}
+  std::string prometheus() const {
+    std::ostringstream o;
+    for (size_t i = 0; i < num_stats; ++i) {
+      const std::string name = std::string("kl_") + stat_name(Stat(i));
+      o << "# TYPE " << name << "_total counter\n"
+        << name << "_total " << counters[i] << '\n';
+    }
+    if (timers.empty()) return o.str();
+    o << "# TYPE kl_timer_count counter\n";
+    for (const auto& [name, t] : timers)
+      o << "kl_timer_count{name=\"" << escaped(name) << "\"} " << t.count
+        << '\n';
+    o << "# TYPE kl_timer_seconds_total counter\n";
+    for (const auto& [name, t] : timers)
+      o << "kl_timer_seconds_total{name=\"" << escaped(name) << "\"} "
+        << t.total_ns * 1e-9 << '\n';
+    o << "# TYPE kl_timer_max_seconds gauge\n";
+    for (const auto& [name, t] : timers)
+      o << "kl_timer_max_seconds{name=\"" << escaped(name) << "\"} "
+        << t.max_ns * 1e-9 << '\n';
+    return o.str();
+  }
+
+ private:
+  static std::string escaped(const std::string& s) {
+    std::string res;
+    for (char c : s) {
+      if (c == '"' || c == '\\') res += '\\';
+      res += c;
+    }
+    return res;
+  }
+};
+
+// the slots of one thread; only that thread adds to them, the timers are
+// behind a mutex that snapshots are the only others to take
+struct ThreadStats {
+  std::array<std::atomic<uint64_t>, num_stats> counters{};
+  std::mutex m;
+  std::unordered_map<const char*, TimerStats> timers;
+};
+
+class StatsRegistry final {
+ public:
+  void attach(ThreadStats* t) {
+    std::lock_guard<std::mutex> lk(m_);
+    live_.push_back(t);
+  }
+  // fold the slots of an exiting thread into the totals
+  void detach(ThreadStats* t) {
+    std::lock_guard<std::mutex> lk(m_);
+    collect(*t, retired_);
+    for (auto& p : live_) {
+      if (p == t) {
+        p = live_.back();
+        live_.pop_back();
+        break;
+      }
+    }
+  }
+
+  StatsSnapshot snapshot() {
+    std::lock_guard<std::mutex> lk(m_);
+    StatsSnapshot res = retired_;
+    for (ThreadStats* t : live_) collect(*t, res);
+    return res;
+  }
+
+  // counts made by other threads during a reset may or may not be kept
+  void reset() {
+    std::lock_guard<std::mutex> lk(m_);
+    retired_ = StatsSnapshot();
+    for (ThreadStats* t : live_) {
+      for (auto& c : t->counters) c.store(0, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> tl(t->m);
+      t->timers.clear();
+    }
+  }
+
+ private:
+  static void collect(ThreadStats& t, StatsSnapshot& res) {
+    for (size_t i = 0; i < num_stats; ++i)
+      res.counters[i] += t.counters[i].load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lk(t.m);
+    for (const auto& [name, s] : t.timers) res.timers[name].merge(s);
+  }
+
+  std::mutex m_;
+  std::vector<ThreadStats*> live_;
+  StatsSnapshot retired_;
+};
+
+// never destroyed, threads may exit after static destructors ran
+inline StatsRegistry& stats_registry() {
+  static StatsRegistry* registry = new StatsRegistry();
+  return *registry;
+}
+
+inline ThreadStats& thread_stats() {
+  struct Holder {
+    ThreadStats stats;
+    Holder() { stats_registry().attach(&stats); }
+    ~Holder() { stats_registry().detach(&stats); }
+  };
+  thread_local Holder holder;
+  return holder.stats;
+}
+
+// only the owning thread writes its counters, so a plain load and store
+// do instead of a locked add
+inline void stats_add(Stat s, uint64_t n) {
+  auto& c = thread_stats().counters[static_cast<size_t>(s)];
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline StatsSnapshot stats_snapshot() { return stats_registry().snapshot(); }
+inline void stats_reset() { stats_registry().reset(); }
+
+// adds the time from construction to destruction to the timer name of the
+// calling thread; name is a string literal
+class ScopedTimer final {
+ public:
+  explicit ScopedTimer(const char* name)
+      : name_{name}, start_{std::chrono::steady_clock::now()} {}
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+  ~ScopedTimer() {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_)
+                        .count();
+    ThreadStats& t = thread_stats();
+    std::lock_guard<std::mutex> lk(t.m);
+    t.timers[name_].add(static_cast<uint64_t>(ns));
+  }
+
+ private:
+  const char* name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace kl
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "stats.h"
+
+#include <gtest/gtest.h>
+
+#include <time.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "algebra.h"
+#include "integer.h"
+#include "random_bigint.h"
+#include "tensor.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+using kl::Stat;
+
+Rand rng(82 + time(nullptr));
+
+// the hooks of integer.cpp, linked from a library built with them
+TEST(test_stats, bigint) {
+  const bigint x = random_bigint(rng, 512), y = random_bigint(rng, 200) + 1;
+  kl::stats_reset();
+  const bigint q = x / y;
+  auto s = kl::stats_snapshot();
+  EXPECT_GT(s[Stat::divisions], 0u);
+  EXPECT_GT(s[Stat::limb_ops], 0u);
+  EXPECT_GT(s[Stat::bigint_allocs], 0u);
+  EXPECT_GE(s[Stat::bigint_bytes], 8 * s[Stat::bigint_allocs]);
+  EXPECT_EQ(s[Stat::flops], 0u);
+  EXPECT_EQ(q * y + x % y, x);
+
+  kl::stats_reset();
+  const bigint p = random_bigint(rng, 128) + 2, r = pow_mod(x, y, p);
+  s = kl::stats_snapshot();
+  EXPECT_GT(s[Stat::divisions], 0u);
+  EXPECT_GT(s[Stat::limb_ops], 0u);
+  EXPECT_GT(s[Stat::bigint_allocs], 0u);
+  EXPECT_GT(s[Stat::bigint_bytes], 0u);
+  EXPECT_EQ(s.timers.at("pow_mod").count, 1u);
+  EXPECT_TRUE(r < p);
+};
+
+TEST(test_stats, counters) {
+  // nominal counts, whatever zeros the kernels skip
+  const int m = 1 + rng.uint32(40), n = 1 + rng.uint32(40),
+            k = 1 + rng.uint32(40);
+  std::vector<double> A(m * k), B(k * n), C(m * n), L(m * m, 0.0);
+  rng.fill_uniform(A.data(), A.size(), -1.0, 1.0);
+  for (int i = 0; i < m; ++i) L[i + m * i] = 1.0;
+  kl::stats_reset();
+  gemm_sub<double>(MatrixView<const double>(A.data(), m, k),
+                   MatrixView<const double>(B.data(), k, n),
+                   MatrixView<double>(C.data(), m, n));
+  EXPECT_EQ(kl::stats_snapshot()[Stat::flops], 2u * m * n * k);
+  kl::stats_reset();
+  trsm_low<double>(MatrixView<const double>(L.data(), m, m),
+                   MatrixView<double>(C.data(), m, n), false);
+  EXPECT_EQ(kl::stats_snapshot()[Stat::flops], 1u * m * m * n);
+
+  const uint64_t r = 1 + rng.uint32(10), c = 1 + rng.uint32(10);
+  kl::Tensor<double> x(kl::Shape({r, c}), std::vector<double>(r * c, 1.0));
+  kl::stats_reset();
+  kl::Tensor<double> y = x + x;
+  EXPECT_EQ(kl::stats_snapshot()[Stat::tensor_bytes], 3 * r * c * 8);
+  kl::stats_reset();
+  y = x.transpose().clone();
+  EXPECT_EQ(kl::stats_snapshot()[Stat::tensor_bytes], 2 * r * c * 8);
+};
+
+TEST(test_stats, threads) {
+  kl::stats_reset();
+  const size_t n = 1000 + rng.uint32(1000);
+  {
+    kl::ThreadPool pool(4);
+    kl::parallel_for(pool, 0, n, 7, [](size_t lo, size_t hi) {
+      KL_STATS_TIMER("chunk");
+      KL_STATS_ADD(flops, hi - lo);
+    });
+    EXPECT_EQ(kl::stats_snapshot()[Stat::flops], n);
+  }
+  // the counts of exited threads are kept
+  std::thread([] { KL_STATS_ADD(flops, 3); }).join();
+  const auto s = kl::stats_snapshot();
+  EXPECT_EQ(s[Stat::flops], n + 3);
+  EXPECT_EQ(s.timers.at("chunk").count, (n + 6) / 7);
+
+  kl::stats_reset();
+  EXPECT_EQ(kl::stats_snapshot()[Stat::flops], 0u);
+  EXPECT_TRUE(kl::stats_snapshot().timers.empty());
+};
+
+TEST(test_stats, timers_and_export) {
+  kl::stats_reset();
+  for (int i = 0; i < 3; ++i) {
+    KL_STATS_TIMER("sleep");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  KL_STATS_ADD(bigint_bytes, 42);
+  const auto s = kl::stats_snapshot();
+  const kl::TimerStats& t = s.timers.at("sleep");
+  EXPECT_EQ(t.count, 3u);
+  EXPECT_GE(t.total_ns, 6000000u);
+  EXPECT_GE(t.max_ns, 2000000u);
+  EXPECT_LE(t.max_ns, t.total_ns);
+
+  const std::string json = s.json();
+  EXPECT_NE(json.find("\"bigint_bytes\": 42"), std::string::npos) << json;
+  EXPECT_NE(json.find("\"sleep\": {\"count\": 3, \"total_ns\": "),
+            std::string::npos)
+      << json;
+  const std::string prom = s.prometheus();
+  EXPECT_NE(prom.find("\nkl_bigint_bytes_total 42\n"), std::string::npos)
+      << prom;
+  EXPECT_NE(prom.find("kl_timer_count{name=\"sleep\"} 3\n"), std::string::npos)
+      << prom;
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "tensor.h"
+
+using kl::Shape;
+using kl::Tensor;
+
+// state.range(0): number of elements, state.range(1): threads of the
+// shared pool, from 1 up to the number of cores
+static void args(benchmark::internal::Benchmark* b) {
+  const int64_t cores = std::max(1u, std::thread::hardware_concurrency());
+  for (int64_t n : {1 << 12, 1 << 22}) {
+    for (int64_t t = 1; t < cores; t *= 2) b->Args({n, t});
+    b->Args({n, cores});
+  }
+  b->UseRealTime();
+}
+
+static void set_threads(const benchmark::State& state) {
+  kl::set_tensor_threads(state.range(1));
+}
+
+static Tensor<float> filled(std::vector<uint64_t> dims, float v) {
+  const uint64_t n = Shape(dims).size();
+  return Tensor<float>(Shape(std::move(dims)), std::vector<float>(n, v));
+}
+
+// same shape operands
+static void BM_tensor_same(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t n = state.range(0);
+  auto x = filled({n / 256, 256}, 1.5f), y = filled({n / 256, 256}, 2.5f);
+  for (auto _ : state) {
+    Tensor<float> z = x * y + x;
+    benchmark::DoNotOptimize(z.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_same)->Apply(args);
+
+// a column broadcast along the rows
+static void BM_tensor_broadcast(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t n = state.range(0);
+  auto x = filled({n / 256, 256}, 1.5f), y = filled({n / 256, 1}, 2.5f);
+  for (auto _ : state) {
+    Tensor<float> z = x * y + x;
+    benchmark::DoNotOptimize(z.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_broadcast)->Apply(args);
+
+// an in place update, against the same update through a new tensor
+static void BM_tensor_inplace(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t n = state.range(0);
+  auto x = filled({n / 256, 256}, 1.5f), y = filled({n / 256, 256}, 2.5f);
+  for (auto _ : state) {
+    x += y;
+    benchmark::DoNotOptimize(x.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_inplace)->Apply(args);
+
+static void BM_tensor_outofplace(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t n = state.range(0);
+  auto x = filled({n / 256, 256}, 1.5f), y = filled({n / 256, 256}, 2.5f);
+  for (auto _ : state) {
+    Tensor<float> z = x + y;
+    benchmark::DoNotOptimize(z.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_outofplace)->Apply(args);
+
+// a transposed copy
+static void BM_tensor_transpose(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t n = state.range(0);
+  auto x = filled({n / 256, 256}, 1.5f);
+  for (auto _ : state) {
+    auto z = x.transpose().clone();
+    benchmark::DoNotOptimize(z.data());
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_transpose)->Apply(args);
+
+// sums over the inner and the outer axis
+static void BM_tensor_sum_inner(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t n = state.range(0);
+  auto x = filled({n / 256, 256}, 1.5f);
+  for (auto _ : state) benchmark::DoNotOptimize(kl::sum(x, {1}).data());
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_sum_inner)->Apply(args);
+
+static void BM_tensor_sum_outer(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t n = state.range(0);
+  auto x = filled({n / 256, 256}, 1.5f);
+  for (auto _ : state) benchmark::DoNotOptimize(kl::sum(x, {0}).data());
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_tensor_sum_outer)->Apply(args);
+
+// square matmul with n elements per operand
+static void BM_tensor_matmul(benchmark::State& state) {
+  set_threads(state);
+  const uint64_t m = std::sqrt(state.range(0)) / 4;
+  auto x = filled({m, m}, 1.5f), y = filled({m, m}, 2.5f);
+  for (auto _ : state) benchmark::DoNotOptimize(kl::matmul(x, y).data());
+  state.SetItemsProcessed(state.iterations() * m * m * m);
+}
+BENCHMARK(BM_tensor_matmul)->Apply(args);
+
+BENCHMARK_MAIN();
@@ -5,36 +5,62 @@
  */
 #pragma once
 
+#include "algebra.h"
+#include "allocator.h"
+#include "simd.h"
+#include "small_vector.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cmath>
 #include <functional>
+#include <initializer_list>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace kl {
 // we prefer composition over inheritance
 // so Shape is better be a component of Tensor
+// the dimensions are kept inline up to rank 8, with the number of elements
+// and the row major strides computed once, so shapes are cheap to copy and
+// value() and strides() are views rather than copies
 class Shape final {
  public:
   typedef uint64_t s_type;
-  Shape() : value_{} {}
-  Shape(std::vector<s_type>& val) : value_{val} {}
-  Shape(std::vector<s_type>&& val) : value_{std::move(val)} {}
-  Shape(const Shape& rhs) : value_{rhs.value_} {}
-  Shape(Shape& rhs) : value_{std::move(rhs.value_)} {}
-  Shape(Shape&& rhs) : value_{std::move(rhs.value_)} {}
-  s_type size() const {
-    return std::accumulate(value_.begin(), value_.end(), 1,
-                           std::multiplies<s_type>());
-  }
-  size_t rank() const { return (this->value_).size(); }
+  typedef SmallVector<s_type> dims_type;
+  Shape() { this->update(); }
+  Shape(const std::vector<s_type>& val) : value_{val} { this->update(); }
+  Shape(Span<const s_type> val) : value_{val} { this->update(); }
+  Shape(std::initializer_list<s_type> val) : value_{val} { this->update(); }
+  Shape(dims_type&& val) : value_{std::move(val)} { this->update(); }
+  Shape(const Shape& rhs) = default;
+  Shape(Shape&& rhs) noexcept = default;
+  Shape& operator=(const Shape& rhs) = default;
+  Shape& operator=(Shape&& rhs) noexcept = default;
+  s_type size() const noexcept { return size_; }
+  size_t rank() const noexcept { return value_.size(); }
 
   bool operator==(const Shape& rhs) const noexcept {
     return this->value_ == rhs.value_;
   }
+  bool operator==(Span<const s_type> rhs) const noexcept {
+    return this->value() == rhs;
+  }
 
   Shape operator+(const Shape& rhs) const noexcept {
     if (this->is_none() || rhs.is_none() || !this->is_compatible(rhs))
@@ -44,24 +70,20 @@ class Shape final {
     const Shape& big = (this->rank() > rhs.rank()) ? *this : rhs;
     const Shape& sml = (this->rank() > rhs.rank()) ? rhs : *this;
 
-    Shape res = big;
+    dims_type res(big.value_);
     auto bsz = big.rank(), ssz = sml.rank();
-    for (size_t i = 0; i < bsz; ++i) {
-      if (i < bsz - ssz) {
-        res.value_[i] = big.value_[i];
-      } else {
-        res.value_[i] = std::max(big.value_[i], sml.value_[i + ssz - bsz]);
-      }
-    }
-    return res;
+    for (size_t i = bsz - ssz; i < bsz; ++i)
+      res[i] = std::max(big.value_[i], sml.value_[i + ssz - bsz]);
+    return Shape(std::move(res));
   }
 
-  bool is_none() const { return this->rank() < 1; }
+  bool is_none() const noexcept { return this->rank() < 1; }
   void extend(int dim) {
     int sz = this->rank();
     if (dim < -sz) return;
     if (dim < 0) dim += sz;
     this->value_.insert(value_.begin() + dim, 1);
+    this->update();
   }
 
   void contract(int dim) {
@@ -75,9 +97,10 @@ class Shape final {
     } else {
       (*it) *= d;
     }
+    this->update();
   }
 
-  bool is_compatible(const Shape& rhs) const {
+  bool is_compatible(const Shape& rhs) const noexcept {
     if (rhs.is_none() || this->is_none()) return true;
     auto us_it = this->value_.end(), them_it = rhs.value_.end();
     const auto b_us = this->value_.begin(), b_them = rhs.value_.begin();
@@ -91,20 +114,28 @@ class Shape final {
     return (*us_it == *them_it || *us_it == 1 || *them_it == 1);
   }
 
-  void reshape(const std::vector<s_type>& v) {
-    if (this->is_none() ||
-        this->size() !=
-            std::accumulate(v.begin(), v.end(), 1, std::multiplies<s_type>()))
-      return;
-    value_ = std::vector<s_type>(v);
+  void reshape(Span<const s_type> v) {
+    if (this->is_none() || this->size() != product(v)) return;
+    value_ = dims_type(v);
+    this->update();
   }
 
   void flatten() noexcept {
     if (this->is_none()) return;
     value_ = {this->size()};
+    this->update();
+  }
+
+  // the dimensions, and the strides of a row major tensor of this shape
+  Span<const s_type> value() const noexcept { return value_; }
+  Span<const int64_t> strides() const noexcept { return strides_; }
+
+  static s_type product(Span<const s_type> v) noexcept {
+    s_type n = 1;
+    for (auto d : v) n *= d;
+    return n;
   }
 
-  auto value() const { return value_; }
   friend std::ostream& operator<<(std::ostream& o, const Shape& rhs) {
     if (rhs.is_none()) return o;
     auto it = rhs.value_.begin(), lt = rhs.value_.end();
@@ -117,139 +148,2049 @@ class Shape final {
   }
 
  private:
-  std::vector<s_type> value_;
+  void update() {
+    strides_.resize(value_.size());
+    int64_t st = 1;
+    for (size_t i = value_.size(); i-- > 0;) {
+      strides_[i] = st;
+      st *= value_[i];
+    }
+    size_ = product(value_);
+  }
+
+  dims_type value_;
+  SmallVector<int64_t> strides_;
+  s_type size_;
+};
+
+// row major strides of a tensor with dimensions dims
+inline SmallVector<int64_t> row_major_strides(Span<const Shape::s_type> dims) {
+  SmallVector<int64_t> res(dims.size());
+  int64_t st = 1;
+  for (size_t i = dims.size(); i-- > 0;) {
+    res[i] = st;
+    st *= dims[i];
+  }
+  return res;
+}
+
+// strides st of a tensor with dimensions dims broadcast to out_dims:
+// missing leading axes and size 1 axes that get stretched have stride 0
+inline SmallVector<int64_t> broadcast_strides(
+    Span<const Shape::s_type> dims, Span<const int64_t> st,
+    Span<const Shape::s_type> out_dims) {
+  SmallVector<int64_t> res(out_dims.size(), 0);
+  const size_t lead = out_dims.size() - dims.size();
+  for (size_t i = 0; i < dims.size(); ++i) {
+    if (dims[i] != 1 || out_dims[lead + i] == 1) res[lead + i] = st[i];
+  }
+  return res;
+}
+
+// the same for a row major tensor
+inline SmallVector<int64_t> broadcast_strides(
+    Span<const Shape::s_type> dims, Span<const Shape::s_type> out_dims) {
+  return broadcast_strides(dims, row_major_strides(dims), out_dims);
+}
+
+// strides that make a tensor with dimensions dims and strides st look like
+// one with dimensions new_dims without moving its data, false if the layout
+// does not allow that (axes merged or split by the reshape are not
+// contiguous with each other)
+inline bool reshape_strides(Span<const Shape::s_type> dims,
+                            Span<const int64_t> st,
+                            Span<const Shape::s_type> new_dims,
+                            SmallVector<int64_t>& res) {
+  res.clear();
+  res.resize(new_dims.size(), 1);
+  Shape::dims_type od;
+  SmallVector<int64_t> os;
+  for (size_t i = 0; i < dims.size(); ++i) {
+    if (dims[i] == 0) {
+      res = row_major_strides(new_dims);
+      return true;
+    }
+    if (dims[i] == 1) continue;
+    od.push_back(dims[i]);
+    os.push_back(st[i]);
+  }
+  // match groups of old and new axes with equal products
+  size_t oi = 0, oj = 1, ni = 0, nj = 1;
+  while (ni < new_dims.size() && oi < od.size()) {
+    Shape::s_type np = new_dims[ni], op = od[oi];
+    while (np != op) {
+      if (np < op) {
+        np *= new_dims[nj++];
+      } else {
+        op *= od[oj++];
+      }
+    }
+    for (size_t k = oi; k + 1 < oj; ++k) {
+      if (os[k] != os[k + 1] * static_cast<int64_t>(od[k + 1])) return false;
+    }
+    res[nj - 1] = os[oj - 1];
+    for (size_t k = nj - 1; k > ni; --k)
+      res[k - 1] = res[k] * static_cast<int64_t>(new_dims[k]);
+    ni = nj++;
+    oi = oj++;
+  }
+  // trailing size 1 axes
+  const int64_t last = (ni > 0) ? res[ni - 1] : 1;
+  for (size_t k = ni; k < new_dims.size(); ++k) res[k] = last;
+  return true;
+}
+
+// N-d loop over K operands given by their element strides along dims
+// size 1 axes are dropped and adjacent axes along which every operand is
+// contiguous are merged, so the innermost runs are as long as possible and
+// the outer axes are walked with additions only
+template <size_t K>
+class StridedLoop final {
+ public:
+  typedef std::array<int64_t, K> offsets;
+
+  StridedLoop(Span<const Shape::s_type> dims,
+              const std::array<Span<const int64_t>, K>& strides) {
+    for (size_t d = 0; d < dims.size(); ++d) {
+      if (dims[d] == 1) continue;
+      offsets st;
+      for (size_t k = 0; k < K; ++k) st[k] = strides[k][d];
+      bool merge = !dims_.empty();
+      for (size_t k = 0; k < K && merge; ++k)
+        merge = (steps_.back()[k] == st[k] * static_cast<int64_t>(dims[d]));
+      if (merge) {
+        dims_.back() *= dims[d];
+        steps_.back() = st;
+      } else {
+        dims_.push_back(dims[d]);
+        steps_.push_back(st);
+      }
+    }
+    if (dims_.empty()) {
+      dims_.push_back(1);
+      steps_.push_back(offsets{});
+    }
+  }
+
+  size_t rank() const noexcept { return dims_.size(); }
+  Shape::s_type inner() const noexcept { return dims_.back(); }
+
+  Shape::s_type size() const noexcept {
+    Shape::s_type n = 1;
+    for (auto d : dims_) n *= d;
+    return n;
+  }
+
+  // f(off, n, step) for every innermost run: off are the offsets of its
+  // first element, n its length and step the innermost strides; nothing
+  // when an axis is empty
+  template <typename F>
+  void run(F&& f) const {
+    if (this->size() == 0) return;
+    const int r = dims_.size();
+    Shape::dims_type idx(r, 0);
+    offsets off{};
+    while (true) {
+      f(off, dims_[r - 1], steps_[r - 1]);
+      int d = r - 2;
+      for (; d >= 0; --d) {
+        if (++idx[d] < dims_[d]) {
+          for (size_t k = 0; k < K; ++k) off[k] += steps_[d][k];
+          break;
+        }
+        idx[d] = 0;
+        for (size_t k = 0; k < K; ++k)
+          off[k] -= steps_[d][k] * static_cast<int64_t>(dims_[d] - 1);
+      }
+      if (d < 0) return;
+    }
+  }
+
+  // the same on the runs, partial at either end, of the elements
+  // [begin, end) in loop order
+  template <typename F>
+  void run(F&& f, Shape::s_type begin, Shape::s_type end) const {
+    if (end <= begin) return;
+    const int r = dims_.size();
+    Shape::dims_type idx(r, 0);
+    offsets off{};
+    Shape::s_type q = begin;
+    for (int d = r - 1; d >= 0; --d) {
+      idx[d] = q % dims_[d];
+      q /= dims_[d];
+      for (size_t k = 0; k < K; ++k)
+        off[k] += steps_[d][k] * static_cast<int64_t>(idx[d]);
+    }
+    Shape::s_type left = end - begin;
+    while (true) {
+      const Shape::s_type n = std::min(left, dims_[r - 1] - idx[r - 1]);
+      f(off, n, steps_[r - 1]);
+      left -= n;
+      if (left == 0) return;
+      for (size_t k = 0; k < K; ++k)
+        off[k] -= steps_[r - 1][k] * static_cast<int64_t>(idx[r - 1]);
+      idx[r - 1] = 0;
+      for (int d = r - 2; d >= 0; --d) {
+        if (++idx[d] < dims_[d]) {
+          for (size_t k = 0; k < K; ++k) off[k] += steps_[d][k];
+          break;
+        }
+        idx[d] = 0;
+        for (size_t k = 0; k < K; ++k)
+          off[k] -= steps_[d][k] * static_cast<int64_t>(dims_[d] - 1);
+      }
+    }
+  }
+
+ private:
+  Shape::dims_type dims_;
+  SmallVector<offsets> steps_;
+};
+
+// Parallel backend. Tensor operations without an explicit pool run on a
+// shared ThreadPool of tensor_threads() threads, in chunks of at least
+// tensor_grain() elements; an operation on fewer than two chunks' worth of
+// elements stays on the calling thread and never touches the pool.
+// set_tensor_threads() replaces the pool, it must not run concurrently with
+// tensor operations.
+struct TensorBackend {
+  std::atomic<size_t> threads{
+      std::max<size_t>(1, std::thread::hardware_concurrency())};
+  std::atomic<Shape::s_type> grain{1 << 15};
+  std::mutex m;
+  std::unique_ptr<ThreadPool> pool;
 };
 
+inline TensorBackend& tensor_backend() {
+  static TensorBackend backend;
+  return backend;
+}
+
+inline size_t tensor_threads() { return tensor_backend().threads.load(); }
+inline void set_tensor_threads(size_t n) {
+  auto& b = tensor_backend();
+  std::lock_guard<std::mutex> lk(b.m);
+  b.threads = std::max<size_t>(n, 1);
+  b.pool.reset();
+}
+inline Shape::s_type tensor_grain() { return tensor_backend().grain.load(); }
+inline void set_tensor_grain(Shape::s_type grain) {
+  tensor_backend().grain = std::max<Shape::s_type>(grain, 1);
+}
+
+// the shared pool, created on first use
+inline ThreadPool& tensor_pool() {
+  auto& b = tensor_backend();
+  std::lock_guard<std::mutex> lk(b.m);
+  if (!b.pool) b.pool = std::make_unique<ThreadPool>(b.threads.load());
+  return *b.pool;
+}
+
+// the shared pool, null with a single thread
+inline ThreadPool* shared_tensor_pool() {
+  return (tensor_threads() < 2) ? nullptr : &tensor_pool();
+}
+
+// the shared pool for an operation on size elements, null if it should run
+// on the calling thread
+inline ThreadPool* tensor_pool_for(Shape::s_type size) {
+  return (size < 2 * tensor_grain()) ? nullptr : shared_tensor_pool();
+}
+
+// f(lo, hi) on chunks of [0, size), in parallel on pool unless it is null;
+// a few chunks per thread, none smaller than tensor_grain()
+template <typename F>
+void tensor_for(ThreadPool* pool, Shape::s_type size, F&& f) {
+  if (pool == nullptr || pool->size() < 2) {
+    f(0, size);
+    return;
+  }
+  const Shape::s_type chunks = 4 * pool->size();
+  parallel_for(*pool, 0, size,
+               std::max(tensor_grain(), (size + chunks - 1) / chunks), f);
+}
+
+// Elementwise arithmetic is lazy: operators on tensors and expressions
+// build a tree of expression nodes that holds tensors by reference (or by
+// value when given a temporary) and is evaluated in one fused, broadcast
+// aware pass when it is assigned to or converted into a Tensor.
+//
+// An expression E provides
+//   value_type, leaves        element type and number of tensors in the tree
+//   expr_shape()              the broadcast shape, none if incompatible
+//   bind<J>(ptr, strides, out_dims)
+//                             record data and strides (broadcast to
+//                             out_dims) of its tensors from leaf J on
+//   at<Unit, J>(p, st, i)     element i of the current run, p are the run
+//                             starts of the leaves and st their steps
+//                             (st[0] is the output), Unit if all are 1
+//   kernel(o, p, st, n)       optionally run a whole run with a SIMD kernel
+//                             of simd.h, false if it could not
+//   reusable(out)             a temporary tensor held by the expression
+//                             that can take its result, or null
+struct TensorExprBase {};
+
+template <typename E>
+struct TensorExpr : TensorExprBase {
+  const E& self() const noexcept { return static_cast<const E&>(*this); }
+
+  bool is_none() const { return self().expr_shape().is_none(); }
+  size_t rank() const { return self().expr_shape().rank(); }
+  Span<const Shape::s_type> shape() const {
+    return self().expr_shape().value();
+  }
+  template <typename R>
+  bool is_compatible(const TensorExpr<R>& rhs) const {
+    return self().expr_shape().is_compatible(rhs.self().expr_shape());
+  }
+
+  friend std::ostream& operator<<(std::ostream& o, const TensorExpr& rhs) {
+    return o << rhs.self().expr_shape();
+  }
+};
+
+template <typename E>
+using is_tensor_expr = std::is_base_of<TensorExprBase, std::decay_t<E>>;
+
 template <typename val_type>
-class Tensor {
+class Tensor;
+
+// deleter of storage that must not be written to, e.g. a read only mapping
+// of a file; it keeps the owner of the memory alive, and a tensor viewing
+// such storage copies it before it is written to, as if it were shared
+struct ReadOnlyStorage {
+  std::shared_ptr<const void> owner;
+  void operator()(const void*) const noexcept {}
+};
+
+template <typename E>
+Tensor<typename E::value_type> evaluate(const TensorExpr<E>& expr);
+template <typename E>
+Tensor<typename E::value_type> evaluate(TensorExpr<E>&& expr);
+template <typename E>
+void evaluate_into(const E& e, typename E::value_type* o,
+                   Span<const int64_t> ostrides);
+
+// A tensor is a view: a shape, element strides and an offset into storage
+// that is shared, reference counted, between all tensors viewing it.
+// Copies, slices, permutations and reshapes of a tensor share its storage;
+// a tensor about to be written to (non const data(), assign, +=) first gets
+// storage of its own if it shares it or it is read only (copy on write), so
+// tensors behave as values. A contiguous tensor is laid out row major from
+// its offset.
+// Storage of trivially copyable elements comes from CachingAllocator.
+template <typename val_type>
+class Tensor : public TensorExpr<Tensor<val_type>> {
   static Tensor None() { return Tensor(); }
 
  public:
-  Tensor() : value_{}, shape_{} {}
+  typedef val_type value_type;
+  typedef std::shared_ptr<val_type> storage_type;
+
+  Tensor() : shape_{}, strides_{}, offset_{0}, storage_{} {}
   Tensor(const Shape& shape, const std::vector<val_type>& val)
-      : shape_{shape}, value_{val} {}
+      : Tensor(Shape(shape), std::vector<val_type>(val)) {}
+  // adopts the buffer of val
   Tensor(Shape&& shape, std::vector<val_type>&& val)
-      : value_{std::move(val)}, shape_{std::move(shape)} {}
-  Tensor(const Tensor& rhs) : shape_{rhs.shape_}, value_{rhs.value_} {}
+      : shape_{std::move(shape)},
+        strides_{shape_.strides()},
+        offset_{0},
+        storage_{share(std::move(val))} {}
+  // uninitialized elements, if trivially copyable
+  explicit Tensor(const Shape& shape)
+      : shape_{shape},
+        strides_{shape_.strides()},
+        offset_{0},
+        storage_{allocate(shape_.size())} {}
+  // a view of storage
+  Tensor(Shape&& shape, SmallVector<int64_t>&& strides, int64_t offset,
+         storage_type storage)
+      : shape_{std::move(shape)},
+        strides_{std::move(strides)},
+        offset_{offset},
+        storage_{std::move(storage)} {}
+  Tensor(const Tensor& rhs) = default;
+  Tensor(Tensor&& rhs) noexcept = default;
+  // evaluate an expression, into the buffer of a temporary tensor in it
+  // if the expression is itself a temporary
+  template <typename E>
+  Tensor(const TensorExpr<E>& expr) : Tensor(evaluate(expr)) {}
+  template <typename E>
+  Tensor(TensorExpr<E>&& expr) : Tensor(evaluate(std::move(expr))) {}
+  Tensor& operator=(const Tensor& rhs) = default;
+  Tensor& operator=(Tensor&& rhs) noexcept = default;
+  template <typename E>
+  Tensor& operator=(const TensorExpr<E>& expr) {
+    return (*this) = evaluate(expr);
+  }
+  template <typename E>
+  Tensor& operator=(TensorExpr<E>&& expr) {
+    return (*this) = evaluate(std::move(expr));
+  }
+
+  // evaluate an expression of the shape of this tensor into its elements,
+  // otherwise assign it; the expression may read this tensor
+  template <typename E>
+  Tensor& assign(const TensorExpr<E>& expr) {
+    const E& e = expr.self();
+    if (this->is_none() || !(e.expr_shape() == shape_))
+      return (*this) = evaluate(expr);
+    this->detach();
+    evaluate_into(e, storage_.get() + offset_, strides_);
+    return (*this);
+  }
+
   size_t rank() const { return shape_.rank(); }
   auto size() const { return shape_.size(); }
-  void reshape(const std::vector<Shape::s_type>& shape) {
-    shape_.reshape(shape);
+  // reshape, flatten, extend and contract change the view in place and
+  // only copy the data when the strides cannot express the new shape
+  void reshape(Span<const Shape::s_type> dims) {
+    if (this->is_none() || dims.empty() ||
+        this->size() != Shape::product(dims))
+      return;
+    Shape shape(dims);  // dims may view shape_
+    SmallVector<int64_t> st;
+    if (!reshape_strides(shape_.value(), strides_, shape.value(), st)) {
+      *this = this->clone();
+      st = row_major_strides(shape.value());
+    }
+    shape_ = std::move(shape);
+    strides_ = std::move(st);
   }
-  void flatten() noexcept {
-    shape_.flatten();
-  }  // flatten only affects shape of the tensor, not its value rep
-  void extend(int dim) noexcept { shape_.extend(dim); }
-  void contract(int dim) noexcept { shape_.contract(dim); }
-  bool is_compatible(const Tensor& rhs) const noexcept {
-    return shape_.is_compatible(rhs.shape_);
+  void flatten() {
+    if (this->is_none()) return;
+    this->reshape({this->size()});
+  }
+  void extend(int dim) {
+    const int sz = this->rank();
+    if (dim < -sz || dim > sz) return;
+    if (dim < 0) dim += sz;
+    this->insert_axis(dim);
+  }
+  void contract(int dim) {
+    if (this->rank() < 2) return;
+    Shape s(shape_.value());
+    s.contract(dim);
+    this->reshape(s.value());
   }
   constexpr bool is_none() const { return shape_.is_none(); }
 
-  Tensor& operator*=(val_type x) noexcept {
-    if (this->is_none()) return (*this);
-    for (auto& val : value_) val *= x;
-    return (*this);
+  // views, none if an axis or index is out of range
+  // elements begin, begin + step, ... before end along dim
+  Tensor slice(int dim, Shape::s_type begin, Shape::s_type end,
+               Shape::s_type step = 1) const {
+    if (!this->axis(dim) || step < 1) return None();
+    Shape::dims_type dims(shape_.value());
+    end = std::min(end, dims[dim]);
+    if (begin >= end) return None();
+    auto st = strides_;
+    dims[dim] = (end - begin + step - 1) / step;
+    st[dim] *= static_cast<int64_t>(step);
+    return Tensor(Shape(std::move(dims)), std::move(st),
+                  offset_ + static_cast<int64_t>(begin) * strides_[dim],
+                  storage_);
   }
-
-  Tensor operator*(val_type x) const noexcept {
-    if (this->is_none()) return *this;
-    auto res = (*this);
-    for (auto& val : res.value_) val *= x;
+  // the sub-tensor at index i along dim, without that axis; a single
+  // element stays a tensor of shape (1)
+  Tensor select(int dim, Shape::s_type i) const {
+    if (!this->axis(dim) || i >= shape_.value()[dim]) return None();
+    Shape::dims_type dims(shape_.value());
+    auto st = strides_;
+    const int64_t off = offset_ + static_cast<int64_t>(i) * st[dim];
+    dims.erase(dims.begin() + dim);
+    st.erase(st.begin() + dim);
+    if (dims.empty()) {
+      dims.push_back(1);
+      st.push_back(1);
+    }
+    return Tensor(Shape(std::move(dims)), std::move(st), off, storage_);
+  }
+  // axis i of the result is axis axes[i] of this tensor
+  Tensor permute(std::vector<int> axes) const {
+    if (axes.size() != this->rank()) return None();
+    std::vector<bool> seen(axes.size(), false);
+    Shape::dims_type dims(shape_.value());
+    auto st = strides_;
+    for (size_t i = 0; i < axes.size(); ++i) {
+      if (!this->axis(axes[i]) || seen[axes[i]]) return None();
+      seen[axes[i]] = true;
+      dims[i] = shape_.value()[axes[i]];
+      st[i] = strides_[axes[i]];
+    }
+    return Tensor(Shape(std::move(dims)), std::move(st), offset_, storage_);
+  }
+  // the diagonal of the equally long axes d0 and d1, as a last axis
+  Tensor diagonal(int d0 = 0, int d1 = 1) const {
+    if (!this->axis(d0) || !this->axis(d1) || d0 == d1) return None();
+    Shape::dims_type dims(shape_.value());
+    auto st = strides_;
+    if (dims[d0] != dims[d1]) return None();
+    const auto len = dims[d0];
+    const int64_t step = st[d0] + st[d1];
+    for (int d : {std::max(d0, d1), std::min(d0, d1)}) {
+      dims.erase(dims.begin() + d);
+      st.erase(st.begin() + d);
+    }
+    dims.push_back(len);
+    st.push_back(step);
+    return Tensor(Shape(std::move(dims)), std::move(st), offset_, storage_);
+  }
+  // swap two axes, the last two by default
+  Tensor transpose(int d0 = -2, int d1 = -1) const {
+    if (this->rank() == 1 && d0 == -2 && d1 == -1) return *this;
+    if (!this->axis(d0) || !this->axis(d1)) return None();
+    std::vector<int> axes(this->rank());
+    std::iota(axes.begin(), axes.end(), 0);
+    std::swap(axes[d0], axes[d1]);
+    return this->permute(std::move(axes));
+  }
+  // drop all size 1 axes, or only dim if it has size 1
+  Tensor squeeze() const {
+    if (this->is_none()) return None();
+    Shape::dims_type dims;
+    SmallVector<int64_t> st;
+    const auto cur = shape_.value();
+    for (size_t i = 0; i < cur.size(); ++i) {
+      if (cur[i] == 1) continue;
+      dims.push_back(cur[i]);
+      st.push_back(strides_[i]);
+    }
+    if (dims.empty()) return this->reshaped({1});
+    return Tensor(Shape(std::move(dims)), std::move(st), offset_, storage_);
+  }
+  Tensor squeeze(int dim) const {
+    if (!this->axis(dim)) return None();
+    if (shape_.value()[dim] != 1 || this->rank() == 1) return *this;
+    return this->select(dim, 0);
+  }
+  // a size 1 axis inserted at dim, in [-rank - 1, rank]
+  Tensor unsqueeze(int dim) const {
+    const int sz = this->rank();
+    if (this->is_none() || dim < -sz - 1 || dim > sz) return None();
+    if (dim < 0) dim += sz + 1;
+    Tensor res(*this);
+    res.insert_axis(dim);
+    return res;
+  }
+  // a view with dimensions dims if the strides allow it, otherwise a copy
+  Tensor reshaped(Span<const Shape::s_type> dims) const {
+    Tensor res(*this);
+    res.reshape(dims);
+    return (res.shape() == dims) ? res : None();
+  }
+  // this tensor if it is contiguous, otherwise a contiguous copy
+  Tensor contiguous() const {
+    return this->is_contiguous() ? *this : this->clone();
+  }
+  // a contiguous copy with storage of its own
+  Tensor clone() const {
+    if (this->is_none()) return None();
+    Tensor res(shape_);
+    const StridedLoop<2> loop(shape_.value(), {res.strides_, strides_});
+    const val_type* src = storage_.get() + offset_;
+    val_type* dst = res.storage_.get();
+    KL_STATS_ADD(tensor_bytes, 2 * loop.size() * sizeof(val_type));
+    auto body = [&](const StridedLoop<2>::offsets& off, Shape::s_type n,
+                    const StridedLoop<2>::offsets& st) {
+      val_type* po = dst + off[0];
+      const val_type* pi = src + off[1];
+      for (Shape::s_type i = 0; i < n; ++i) po[i * st[0]] = pi[i * st[1]];
+    };
+    tensor_for(tensor_pool_for(loop.size()), loop.size(),
+               [&](size_t lo, size_t hi) { loop.run(body, lo, hi); });
     return res;
   }
 
-  Tensor operator+(val_type x) noexcept {
-    if (this->is_none()) return (*this);
-    auto value = this->value_;
-    for (auto& val : value) val += x;
-    return Tensor(this->shape_, value);
+  bool is_contiguous() const noexcept {
+    const auto dims = shape_.value();
+    int64_t st = 1;
+    for (size_t i = dims.size(); i-- > 0;) {
+      if (dims[i] != 1 && strides_[i] != st) return false;
+      st *= dims[i];
+    }
+    return true;
+  }
+  // true if both view the same storage
+  bool shares_storage(const Tensor& rhs) const noexcept {
+    return storage_ && storage_ == rhs.storage_;
+  }
+  // true if no other tensor views its storage
+  bool is_unique() const noexcept { return storage_.use_count() == 1; }
+  // true if its storage is a ReadOnlyStorage
+  bool is_read_only() const noexcept {
+    return std::get_deleter<ReadOnlyStorage>(storage_) != nullptr;
   }
 
-  Tensor operator-(val_type x) noexcept { return (*this) + (-x); }
+  bool operator==(const Tensor& rhs) const {
+    if (this->is_none() && rhs.is_none()) return true;
+    if (!(this->shape_ == rhs.shape_)) return false;
+    const StridedLoop<2> loop(shape_.value(), {strides_, rhs.strides_});
+    const val_type *a = this->data(), *b = rhs.data();
+    bool eq = true;
+    loop.run([&](const StridedLoop<2>::offsets& off, Shape::s_type n,
+                 const StridedLoop<2>::offsets& st) {
+      for (Shape::s_type i = 0; i < n && eq; ++i)
+        eq = (a[off[0] + i * st[0]] == b[off[1] + i * st[1]]);
+    });
+    return eq;
+  }
 
-  Tensor operator+(const Tensor& rhs) const noexcept {
-    if (this->is_none() || rhs.is_none() || !this->is_compatible(rhs))
-      return Tensor::None();
+  auto shape() const { return shape_.value(); }
+  const Shape& expr_shape() const noexcept { return shape_; }
+  Span<const int64_t> strides() const noexcept { return strides_; }
+  int64_t offset() const noexcept { return offset_; }
+  // the first element, the others are at multiples of strides() from it
+  const val_type* data() const noexcept { return storage_.get() + offset_; }
+  val_type* data() {
+    this->detach();
+    return storage_.get() + offset_;
+  }
+  // element at index idx
+  const val_type& at(Span<const Shape::s_type> idx) const {
+    int64_t off = offset_;
+    for (size_t i = 0; i < idx.size(); ++i)
+      off += static_cast<int64_t>(idx[i]) * strides_[i];
+    return storage_.get()[off];
+  }
 
-    if (this->shape_ == rhs.shape_) {
-      Tensor res = *this;
-      for (auto i = 0; i < res.value_.size(); ++i)
-        res.value_[i] += rhs.value_[i];
-      return res;
+  friend std::ostream& operator<<(std::ostream& o, const Tensor& rhs) {
+    o << rhs.shape_;
+    return o;
+  }
+
+ private:
+  static storage_type share(std::vector<val_type>&& val) {
+    auto p = std::make_shared<std::vector<val_type>>(std::move(val));
+    return storage_type(p, p->data());
+  }
+  // storage for n elements, its control block is cached as well
+  static storage_type allocate(Shape::s_type n) {
+    if constexpr (std::is_trivially_copyable<val_type>::value) {
+      const size_t bytes = std::max<Shape::s_type>(n, 1) * sizeof(val_type);
+      auto& alloc = CachingAllocator::instance();
+      return storage_type(static_cast<val_type*>(alloc.allocate(bytes)),
+                          [bytes](val_type* p) {
+                            CachingAllocator::instance().deallocate(p, bytes);
+                          },
+                          CachingStdAllocator<val_type>());
+    } else {
+      return share(std::vector<val_type>(n));
     }
+  }
+  // normalize a possibly negative axis, false if out of range
+  bool axis(int& dim) const noexcept {
+    const int sz = this->rank();
+    if (dim < 0) dim += sz;
+    return 0 <= dim && dim < sz;
+  }
+  void insert_axis(int dim) {
+    Shape::dims_type dims(shape_.value());
+    const int64_t st = (dim < static_cast<int>(dims.size()))
+                           ? strides_[dim] * static_cast<int64_t>(dims[dim])
+                           : 1;
+    dims.insert(dims.begin() + dim, 1);
+    strides_.insert(strides_.begin() + dim, st);
+    shape_ = Shape(std::move(dims));
+  }
+  // copy on write
+  void detach() {
+    if (storage_.use_count() > 1 || this->is_read_only())
+      *this = this->clone();
+  }
+
+  Shape shape_;
+  SmallVector<int64_t> strides_;
+  int64_t offset_;
+  storage_type storage_;
+};
+
+// a tensor in an expression, held by value if Own
+template <typename T, bool Own>
+class TensorLeaf final : public TensorExpr<TensorLeaf<T, Own>> {
+ public:
+  typedef T value_type;
+  static constexpr size_t leaves = 1;
+
+  explicit TensorLeaf(const Tensor<T>& t) : t_(t) {}
+  explicit TensorLeaf(Tensor<T>&& t) : t_(std::move(t)) {}
+
+  const Shape& expr_shape() const noexcept { return get().expr_shape(); }
 
-    const Shape shp = this->shape_ + rhs.shape_;
-    std::vector<val_type> value(shp.size(), 0);
-    return this->op_diff_shape(
-        rhs, shp, [](val_type l, val_type r) -> val_type { return l + r; });
+  template <size_t J, typename P, typename S>
+  void bind(P& ptr, S& strides, Span<const Shape::s_type> out) const {
+    ptr[J] = get().data();
+    strides[J + 1] = broadcast_strides(get().shape(), get().strides(), out);
   }
 
-  Tensor operator-(const Tensor& rhs) const noexcept {
-    return (*this) + rhs * (-1);
+  template <bool Unit, size_t J, typename P, typename S>
+  T at(const P& p, const S& st, Shape::s_type i) const {
+    if constexpr (Unit) {
+      return p[J][i];
+    } else {
+      return p[J][i * st[J + 1]];
+    }
   }
 
-  Tensor operator*(const Tensor& rhs) const noexcept {
-    if (this->is_none() || rhs.is_none() || !this->is_compatible(rhs))
-      return Tensor::None();
+  template <typename P, typename S>
+  bool kernel(T*, const P&, const S&, Shape::s_type) const {
+    return false;
+  }
 
-    if (this->shape_ == rhs.shape_) {
-      Tensor res = *this;
-      for (auto i = 0; i < res.value_.size(); ++i)
-        res.value_[i] *= rhs.value_[i];
-      return res;
+  // the held temporary if it can take the output of shape out
+  Tensor<T>* reusable(const Shape& out) noexcept {
+    if constexpr (Own) {
+      if (t_.expr_shape() == out && t_.is_contiguous() && t_.is_unique() &&
+          !t_.is_read_only())
+        return &t_;
     }
+    return nullptr;
+  }
+
+ private:
+  const Tensor<T>& get() const noexcept { return t_; }
+  std::conditional_t<Own, Tensor<T>, const Tensor<T>&> t_;
+};
+
+template <typename E>
+struct is_leaf : std::false_type {};
+template <typename T, bool Own>
+struct is_leaf<TensorLeaf<T, Own>> : std::true_type {};
+
+// f(e) elementwise
+template <typename E, typename F>
+class UnaryExpr final : public TensorExpr<UnaryExpr<E, F>> {
+ public:
+  typedef typename E::value_type value_type;
+  static constexpr size_t leaves = E::leaves;
+
+  UnaryExpr(E e, F f) : e_(std::move(e)), f_(f) {}
 
-    Shape shp = this->shape_ + rhs.shape_;
-    return this->op_diff_shape(
-        rhs, shp, [](val_type l, val_type r) -> val_type { return l * r; });
+  const Shape& expr_shape() const noexcept { return e_.expr_shape(); }
+
+  template <size_t J, typename P, typename S>
+  void bind(P& ptr, S& strides, Span<const Shape::s_type> out) const {
+    e_.template bind<J>(ptr, strides, out);
   }
 
-  bool operator==(const Tensor& rhs) const noexcept {
-    if (this->is_none() && rhs.is_none()) return true;
-    return (this->shape_ == rhs.shape_ && this->value_ == rhs.value_);
+  template <bool Unit, size_t J, typename P, typename S>
+  value_type at(const P& p, const S& st, Shape::s_type i) const {
+    return f_(e_.template at<Unit, J>(p, st, i));
   }
 
-  auto shape() const { return shape_.value(); }
+  // a whole run of f over one tensor goes to a SIMD kernel
+  template <typename P, typename S>
+  bool kernel(value_type* o, const P& p, const S& st, Shape::s_type n) const {
+    if constexpr (is_leaf<E>::value) {
+      if (st[0] == 1 && st[1] == 1) {
+        f_.kernel(n, p[0], o);
+        return true;
+      }
+    }
+    return false;
+  }
 
-  friend std::ostream& operator<<(std::ostream& o, const Tensor& rhs) {
-    o << rhs.shape_;
-    return o;
+  Tensor<value_type>* reusable(const Shape& out) noexcept {
+    return e_.reusable(out);
   }
 
  private:
-  Tensor op_diff_shape(const Tensor& rhs, const Shape& out_shape,
-                   std::function<val_type(val_type, val_type)> bin_op) const {
-    auto expand = [&out_shape](Shape& shp) {
-      while (shp.rank() < out_shape.rank()) {
-        shp.extend(0);
+  E e_;
+  F f_;
+};
+
+// f(l, r) elementwise with broadcasting
+template <typename L, typename R, typename F>
+class BinaryExpr final : public TensorExpr<BinaryExpr<L, R, F>> {
+ public:
+  typedef typename L::value_type value_type;
+  static_assert(std::is_same<value_type, typename R::value_type>::value,
+                "operands of a tensor expression have the same value_type");
+  static constexpr size_t leaves = L::leaves + R::leaves;
+
+  BinaryExpr(L l, R r, F f)
+      : l_(std::move(l)),
+        r_(std::move(r)),
+        f_(f),
+        shape_(l_.expr_shape().is_compatible(r_.expr_shape())
+                   ? l_.expr_shape() + r_.expr_shape()
+                   : Shape()) {}
+
+  const Shape& expr_shape() const noexcept { return shape_; }
+
+  template <size_t J, typename P, typename S>
+  void bind(P& ptr, S& strides, Span<const Shape::s_type> out) const {
+    l_.template bind<J>(ptr, strides, out);
+    r_.template bind<J + L::leaves>(ptr, strides, out);
+  }
+
+  template <bool Unit, size_t J, typename P, typename S>
+  value_type at(const P& p, const S& st, Shape::s_type i) const {
+    return f_(l_.template at<Unit, J>(p, st, i),
+              r_.template at<Unit, J + L::leaves>(p, st, i));
+  }
+
+  // a whole run of f over two tensors, each either contiguous or broadcast
+  // along the run, goes to a SIMD kernel
+  template <typename P, typename S>
+  bool kernel(value_type* o, const P& p, const S& st, Shape::s_type n) const {
+    if constexpr (is_leaf<L>::value && is_leaf<R>::value) {
+      if (st[0] != 1) return false;
+      if (st[1] == 1 && st[2] == 1) {
+        F::kernel(n, p[0], p[1], o);
+      } else if (st[1] == 1 && st[2] == 0) {
+        F::kernel(n, p[0], *p[1], o);
+      } else if (st[1] == 0 && st[2] == 1) {
+        F::kernel(n, *p[0], p[1], o);
+      } else {
+        return false;
       }
-    };
-    auto div = [&out_shape](const Shape& shp) {
-      auto res = 1;
-      for (auto i = 0; i < shp.rank(); ++i) {
-        if (shp.value()[i] == 1)
-          res *= out_shape.value()[i];
-        else
-          break;
+      return true;
+    }
+    return false;
+  }
+
+  Tensor<value_type>* reusable(const Shape& out) noexcept {
+    Tensor<value_type>* t = l_.reusable(out);
+    return t ? t : r_.reusable(out);
+  }
+
+ private:
+  L l_;
+  R r_;
+  F f_;
+  Shape shape_;
+};
+
+// the node type an operand is kept as: lvalue tensors by reference,
+// temporary tensors by value, subexpressions by value
+template <typename A, typename D = std::decay_t<A>>
+struct expr_node {
+  typedef D type;
+};
+template <typename A, typename T>
+struct expr_node<A, Tensor<T>> {
+  typedef TensorLeaf<T, !std::is_lvalue_reference<A>::value> type;
+};
+template <typename A>
+using expr_node_t = typename expr_node<A>::type;
+
+// evaluate e into the elements at o with strides ostrides, in one pass
+// over the output split across the shared pool
+template <typename E>
+void evaluate_into(const E& e, typename E::value_type* o,
+                   Span<const int64_t> ostrides) {
+  typedef typename E::value_type T;
+  constexpr size_t K = E::leaves;
+  const auto out = e.expr_shape().value();
+  std::array<const T*, K> ptr;
+  std::array<SmallVector<int64_t>, K + 1> strides;
+  strides[0] = ostrides;
+  e.template bind<0>(ptr, strides, out);
+
+  std::array<Span<const int64_t>, K + 1> views;
+  for (size_t k = 0; k <= K; ++k) views[k] = strides[k];
+  const StridedLoop<K + 1> loop(out, views);
+  KL_STATS_ADD(tensor_bytes, (K + 1) * loop.size() * sizeof(T));
+  auto body = [&](const typename StridedLoop<K + 1>::offsets& off,
+                  Shape::s_type n,
+                  const typename StridedLoop<K + 1>::offsets& st) {
+    std::array<const T*, K> p;
+    bool unit = (st[0] == 1);
+    for (size_t j = 0; j < K; ++j) {
+      p[j] = ptr[j] + off[j + 1];
+      unit = unit && (st[j + 1] == 1);
+    }
+    T* po = o + off[0];
+    if (e.kernel(po, p, st, n)) return;
+    if (unit) {
+      for (Shape::s_type i = 0; i < n; ++i)
+        po[i] = e.template at<true, 0>(p, st, i);
+    } else {
+      for (Shape::s_type i = 0; i < n; ++i)
+        po[i * st[0]] = e.template at<false, 0>(p, st, i);
+    }
+  };
+  tensor_for(tensor_pool_for(loop.size()), loop.size(),
+             [&](size_t lo, size_t hi) { loop.run(body, lo, hi); });
+}
+
+template <typename E>
+Tensor<typename E::value_type> evaluate(const TensorExpr<E>& expr) {
+  typedef typename E::value_type T;
+  const E& e = expr.self();
+  if (e.is_none()) return Tensor<T>();
+  Tensor<T> res(e.expr_shape());
+  evaluate_into(e, res.data(), res.strides());
+  return res;
+}
+
+// a temporary expression is evaluated into the buffer of a temporary
+// tensor it holds when that has the output's shape and layout
+template <typename E>
+Tensor<typename E::value_type> evaluate(TensorExpr<E>&& expr) {
+  typedef typename E::value_type T;
+  E& e = static_cast<E&>(expr);
+  if (e.is_none()) return Tensor<T>();
+  if (Tensor<T>* t = e.reusable(e.expr_shape())) {
+    evaluate_into(e, t->data(), t->strides());
+    return std::move(*t);
+  }
+  return evaluate(static_cast<const TensorExpr<E>&>(expr));
+}
+
+// elementwise functors, kernel() runs them over arrays with the SIMD
+// kernels of simd.h
+struct op_add {
+  template <typename T>
+  T operator()(T l, T r) const { return l + r; }
+  template <typename L, typename R, typename T>
+  static void kernel(size_t n, L l, R r, T* o) { simd::add(n, l, r, o); }
+};
+struct op_sub {
+  template <typename T>
+  T operator()(T l, T r) const { return l - r; }
+  template <typename L, typename R, typename T>
+  static void kernel(size_t n, L l, R r, T* o) { simd::sub(n, l, r, o); }
+};
+struct op_mul {
+  template <typename T>
+  T operator()(T l, T r) const { return l * r; }
+  template <typename L, typename R, typename T>
+  static void kernel(size_t n, L l, R r, T* o) { simd::mul(n, l, r, o); }
+};
+struct op_div {
+  template <typename T>
+  T operator()(T l, T r) const { return l / r; }
+  template <typename L, typename R, typename T>
+  static void kernel(size_t n, L l, R r, T* o) { simd::div(n, l, r, o); }
+};
+struct op_neg {
+  template <typename T>
+  T operator()(T x) const { return -x; }
+  template <typename T>
+  void kernel(size_t n, const T* a, T* o) const { simd::mul(n, a, T(-1), o); }
+};
+
+#define KL_TENSOR_MATH_OP(name)                                   \
+  struct op_##name {                                              \
+    template <typename T>                                         \
+    T operator()(T x) const { return std::name(x); }              \
+    template <typename T>                                         \
+    void kernel(size_t n, const T* a, T* o) const {               \
+      if constexpr (std::is_floating_point<T>::value) {           \
+        simd::name(n, a, o);                                      \
+      } else {                                                    \
+        for (size_t i = 0; i < n; ++i) o[i] = (*this)(a[i]);      \
+      }                                                           \
+    }                                                             \
+  };
+KL_TENSOR_MATH_OP(exp)
+KL_TENSOR_MATH_OP(log)
+KL_TENSOR_MATH_OP(tanh)
+#undef KL_TENSOR_MATH_OP
+
+// f(x, v) and f(v, x) with the scalar v bound
+template <typename T, typename F>
+struct bind_right {
+  T v;
+  T operator()(T x) const { return F()(x, v); }
+  void kernel(size_t n, const T* a, T* o) const { F::kernel(n, a, v, o); }
+};
+template <typename T, typename F>
+struct bind_left {
+  T v;
+  T operator()(T x) const { return F()(v, x); }
+  void kernel(size_t n, const T* a, T* o) const { F::kernel(n, v, a, o); }
+};
+
+template <typename F, typename A, typename B>
+auto make_binary(A&& a, B&& b) {
+  typedef expr_node_t<A> L;
+  typedef expr_node_t<B> R;
+  return BinaryExpr<L, R, F>(L(std::forward<A>(a)), R(std::forward<B>(b)),
+                             F());
+}
+
+template <typename F, typename A>
+auto make_scalar_right(A&& a, typename std::decay_t<A>::value_type v) {
+  typedef expr_node_t<A> E;
+  typedef bind_right<typename E::value_type, F> G;
+  return UnaryExpr<E, G>(E(std::forward<A>(a)), G{v});
+}
+
+template <typename F, typename A>
+auto make_scalar_left(typename std::decay_t<A>::value_type v, A&& a) {
+  typedef expr_node_t<A> E;
+  typedef bind_left<typename E::value_type, F> G;
+  return UnaryExpr<E, G>(E(std::forward<A>(a)), G{v});
+}
+
+#define KL_TENSOR_BINARY_OP(op, F)                                         \
+  template <typename A, typename B,                                        \
+            std::enable_if_t<is_tensor_expr<A>::value &&                   \
+                                 is_tensor_expr<B>::value,                 \
+                             int> = 0>                                     \
+  auto operator op(A&& a, B&& b) {                                         \
+    return make_binary<F>(std::forward<A>(a), std::forward<B>(b));         \
+  }                                                                        \
+  template <typename A,                                                    \
+            std::enable_if_t<is_tensor_expr<A>::value, int> = 0>           \
+  auto operator op(A&& a, typename std::decay_t<A>::value_type v) {        \
+    return make_scalar_right<F>(std::forward<A>(a), v);                    \
+  }                                                                        \
+  template <typename A,                                                    \
+            std::enable_if_t<is_tensor_expr<A>::value, int> = 0>           \
+  auto operator op(typename std::decay_t<A>::value_type v, A&& a) {        \
+    return make_scalar_left<F>(v, std::forward<A>(a));                     \
+  }
+
+KL_TENSOR_BINARY_OP(+, op_add)
+KL_TENSOR_BINARY_OP(-, op_sub)
+KL_TENSOR_BINARY_OP(*, op_mul)
+KL_TENSOR_BINARY_OP(/, op_div)
+#undef KL_TENSOR_BINARY_OP
+
+template <typename A, std::enable_if_t<is_tensor_expr<A>::value, int> = 0>
+auto operator-(A&& a) {
+  typedef expr_node_t<A> E;
+  return UnaryExpr<E, op_neg>(E(std::forward<A>(a)), op_neg());
+}
+
+// a op= b with b a tensor, an expression or a scalar broadcast to the shape
+// of a, in place in the storage of a; if b would broadcast a to a larger
+// shape, a becomes a op b
+#define KL_TENSOR_ASSIGN_OP(op, F)                                          \
+  template <typename T, typename B>                                         \
+  Tensor<T>& operator op(Tensor<T>& a, B&& b) {                             \
+    if constexpr (is_tensor_expr<B>::value) {                               \
+      return a.assign(make_binary<F>(a, std::forward<B>(b)));               \
+    } else {                                                                \
+      return a.assign(make_scalar_right<F>(a, static_cast<T>(b)));          \
+    }                                                                       \
+  }
+KL_TENSOR_ASSIGN_OP(+=, op_add)
+KL_TENSOR_ASSIGN_OP(-=, op_sub)
+KL_TENSOR_ASSIGN_OP(*=, op_mul)
+KL_TENSOR_ASSIGN_OP(/=, op_div)
+#undef KL_TENSOR_ASSIGN_OP
+
+// exp(a), log(a) and tanh(a) elementwise
+#define KL_TENSOR_MATH_FN(name)                                            \
+  template <typename A, std::enable_if_t<is_tensor_expr<A>::value, int> = 0> \
+  auto name(A&& a) {                                                       \
+    typedef expr_node_t<A> E;                                              \
+    return UnaryExpr<E, op_##name>(E(std::forward<A>(a)), op_##name());    \
+  }
+KL_TENSOR_MATH_FN(exp)
+KL_TENSOR_MATH_FN(log)
+KL_TENSOR_MATH_FN(tanh)
+#undef KL_TENSOR_MATH_FN
+
+// expressions compare by value once evaluated
+template <typename A, typename B,
+          std::enable_if_t<is_tensor_expr<A>::value &&
+                               is_tensor_expr<B>::value,
+                           int> = 0>
+bool operator==(const A& a, const B& b) {
+  typedef typename A::value_type T;
+  return Tensor<T>(a) == Tensor<T>(b);
+}
+template <typename A, typename B,
+          std::enable_if_t<is_tensor_expr<A>::value &&
+                               is_tensor_expr<B>::value,
+                           int> = 0>
+bool operator!=(const A& a, const B& b) {
+  return !(a == b);
+}
+
+// Reductions over axes. A reduction walks its input in memory order (axes
+// by decreasing stride) and either folds a whole run into one output or
+// updates a run of outputs elementwise, so reducing inner and outer axes
+// both stream through memory. Sums are pairwise within a run and Kahan
+// compensated across runs. Given a pool, inputs of more than two grains
+// are split along the outermost axis of the walk.
+
+struct ReducePlan {
+  Shape::dims_type dims;                        // loop axes, memory order
+  std::array<SmallVector<int64_t>, 3> strides;  // output, input, index
+  Shape::dims_type out_dims;
+  Shape::s_type out_size = 1, count = 1;  // count reduced per output
+};
+
+// plan the reduction of a tensor with dimensions dims and strides st over
+// axes, all of them if empty; false if an axis is out of range
+// the index stride walks the row major index within the reduced axes
+inline bool reduce_plan(Span<const Shape::s_type> dims,
+                        Span<const int64_t> st,
+                        const std::vector<int>& axes, bool keepdims,
+                        ReducePlan& plan) {
+  const int r = dims.size();
+  SmallVector<bool> red(r, axes.empty());
+  for (int a : axes) {
+    if (a < 0) a += r;
+    if (a < 0 || a >= r) return false;
+    red[a] = true;
+  }
+  Shape::dims_type kept(dims);
+  for (int i = 0; i < r; ++i) {
+    if (red[i]) kept[i] = 1;
+  }
+  auto ost = row_major_strides(kept);
+  SmallVector<int64_t> ist(r, 0);
+  plan.count = 1;
+  for (int i = r; i-- > 0;) {
+    if (!red[i]) continue;
+    ost[i] = 0;
+    ist[i] = plan.count;
+    plan.count *= dims[i];
+  }
+  plan.out_size = 1;
+  plan.out_dims.clear();
+  for (int i = 0; i < r; ++i) {
+    plan.out_size *= kept[i];
+    if (keepdims || !red[i]) plan.out_dims.push_back(kept[i]);
+  }
+  if (plan.out_dims.empty()) plan.out_dims.push_back(1);
+
+  SmallVector<int> order;
+  for (int i = 0; i < r; ++i) {
+    if (dims[i] != 1) order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return std::abs(st[a]) > std::abs(st[b]);
+  });
+  plan.dims.clear();
+  for (auto& s : plan.strides) s.clear();
+  for (int i : order) {
+    plan.dims.push_back(dims[i]);
+    plan.strides[0].push_back(ost[i]);
+    plan.strides[1].push_back(st[i]);
+    plan.strides[2].push_back(ist[i]);
+  }
+  if (plan.dims.empty()) {
+    plan.dims.push_back(1);
+    for (auto& s : plan.strides) s.push_back(0);
+  }
+  return true;
+}
+
+template <typename T>
+inline void kahan_add(T& s, T& c, T x) {
+  if constexpr (std::is_floating_point<T>::value) {
+    const T y = x - c;
+    const T t = s + y;
+    c = (t - s) - y;
+    s = t;
+  } else {
+    s += x;
+  }
+}
+
+// sum of f(p[i * step]) for i < n, halving down to blocks summed with 8
+// independent accumulators; the error grows with log n
+template <typename T, typename F>
+T pairwise_sum(const T* p, Shape::s_type n, int64_t step, F f) {
+  if (n > 128) {
+    const Shape::s_type h = n / 16 * 8;
+    return pairwise_sum(p, h, step, f) +
+           pairwise_sum(p + static_cast<int64_t>(h) * step, n - h, step, f);
+  }
+  T s[8] = {};
+  Shape::s_type i = 0;
+  for (; i + 8 <= n; i += 8) {
+    for (int j = 0; j < 8; ++j) s[j] += f(p[(i + j) * step]);
+  }
+  T r = T(0);
+  for (; i < n; ++i) r += f(p[i * step]);
+  return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7])) +
+         r;
+}
+
+struct op_ident {
+  template <typename T>
+  T operator()(T x) const { return x; }
+};
+struct op_square {
+  template <typename T>
+  T operator()(T x) const { return x * x; }
+};
+
+// A reduction op has an accumulator acc_type per output, init() for it and
+//   run(a, p, n, step, idx, idx_step)      fold a run into one output
+//   map(a, a_step, p, n, step, idx, idx_step)
+//                                          fold a run into a run of outputs
+//   merge(a, b)                            fold a partial result b into a
+// idx is the index within the reduced axes of the first element of a run.
+
+// compensated sum of f(x)
+template <typename T, typename F>
+struct SumOp {
+  struct acc_type {
+    T s, c;
+  };
+  acc_type init() const { return {T(0), T(0)}; }
+  void run(acc_type& a, const T* p, Shape::s_type n, int64_t step, int64_t,
+           int64_t) const {
+    kahan_add(a.s, a.c, pairwise_sum(p, n, step, F()));
+  }
+  void map(acc_type* a, int64_t as, const T* p, Shape::s_type n,
+           int64_t step, int64_t, int64_t) const {
+    for (Shape::s_type i = 0; i < n; ++i) {
+      acc_type& x = a[i * as];
+      kahan_add(x.s, x.c, F()(p[i * step]));
+    }
+  }
+  void merge(acc_type& a, const acc_type& b) const {
+    kahan_add(a.s, a.c, b.s);
+    kahan_add(a.s, a.c, T(-b.c));
+  }
+  static T value(const acc_type& a) { return a.s - a.c; }
+};
+
+// the first of the largest elements under Cmp with its index, NaNs are
+// skipped
+template <typename T, typename Cmp>
+struct ExtremumOp {
+  struct acc_type {
+    T v;
+    int64_t i;
+  };
+  acc_type init() const {
+    const bool up = Cmp()(T(0), T(1));
+    if constexpr (std::numeric_limits<T>::has_infinity) {
+      const T inf = std::numeric_limits<T>::infinity();
+      return {up ? inf : -inf, -1};
+    } else {
+      return {up ? std::numeric_limits<T>::max()
+                 : std::numeric_limits<T>::lowest(),
+              -1};
+    }
+  }
+  static bool better(T v, int64_t i, const acc_type& a) {
+    return Cmp()(v, a.v) || (v == a.v && (a.i < 0 || i < a.i));
+  }
+  void run(acc_type& a, const T* p, Shape::s_type n, int64_t step,
+           int64_t idx, int64_t is) const {
+    for (Shape::s_type k = 0; k < n; ++k) {
+      const T v = p[k * step];
+      const int64_t i = idx + static_cast<int64_t>(k) * is;
+      if (better(v, i, a)) a = {v, i};
+    }
+  }
+  void map(acc_type* a, int64_t as, const T* p, Shape::s_type n,
+           int64_t step, int64_t idx, int64_t is) const {
+    for (Shape::s_type k = 0; k < n; ++k)
+      this->run(a[k * as], p + k * step, 1, 0, idx + k * is, 0);
+  }
+  void merge(acc_type& a, const acc_type& b) const {
+    if (b.i >= 0 && better(b.v, b.i, a)) a = b;
+  }
+};
+
+// the accumulators of a planned reduction of the elements at in
+template <typename T, typename Op>
+std::vector<typename Op::acc_type> reduce_acc(const ReducePlan& pl,
+                                              const T* in, const Op& op,
+                                              ThreadPool* pool) {
+  typedef typename Op::acc_type A;
+  std::vector<A> acc(pl.out_size, op.init());
+  // the loop over [lo, hi) of the outermost axis into the outputs at a
+  auto body = [&](A* a, Shape::s_type lo, Shape::s_type hi) {
+    auto dims = pl.dims;
+    dims[0] = hi - lo;
+    const StridedLoop<3> loop(
+        dims, {pl.strides[0], pl.strides[1], pl.strides[2]});
+    const int64_t l = lo;
+    const T* p = in + l * pl.strides[1][0];
+    A* o = a + l * pl.strides[0][0];
+    const int64_t idx = l * pl.strides[2][0];
+    loop.run([&](const StridedLoop<3>::offsets& off, Shape::s_type n,
+                 const StridedLoop<3>::offsets& st) {
+      if (st[0] == 0) {
+        op.run(o[off[0]], p + off[1], n, st[1], idx + off[2], st[2]);
+      } else {
+        op.map(o + off[0], st[0], p + off[1], n, st[1], idx + off[2], st[2]);
       }
-      return res;
-    };
-    Shape l_shp = this->shape_, r_shp = rhs.shape_;
-    auto const l_val = this->value_, r_val = rhs.value_;
-    expand(l_shp);
-    expand(r_shp);
-    auto l_div = div(l_shp), r_div = div(r_shp);
-    std::vector<val_type> val(out_shape.size(), 0);
-    auto lsz = l_shp.size(), rsz = r_shp.size(), osz = out_shape.size();
-    for (auto i = 0; i < osz; ++i) {
-      auto l_idx = (i / l_div) % lsz, r_idx = (i / r_div) % rsz; // hacky but works
-      val[i] = bin_op(l_val[l_idx], r_val[r_idx]);
-    }
-    return Tensor(out_shape, val);
+    });
   };
-  Shape shape_;
-  std::vector<val_type> value_;
+
+  const Shape::s_type d0 = pl.dims[0], total = pl.count * pl.out_size;
+  if (pool == nullptr || pool->size() < 2 || total < 2 * tensor_grain() ||
+      d0 < 2) {
+    body(acc.data(), 0, d0);
+    return acc;
+  }
+  const Shape::s_type rows = std::max<Shape::s_type>(
+      1, tensor_grain() / std::max<Shape::s_type>(1, total / d0));
+  if (pl.strides[0][0] != 0) {
+    // the outermost axis is kept, chunks write to disjoint outputs
+    parallel_for(*pool, 0, d0, rows,
+                 [&](size_t lo, size_t hi) { body(acc.data(), lo, hi); });
+    return acc;
+  }
+  // partial results per chunk, merged in chunk order
+  const size_t nchunk = (d0 + rows - 1) / rows;
+  std::vector<std::vector<A>> part(nchunk);
+  parallel_for(*pool, 0, nchunk, 1, [&](size_t lo, size_t hi) {
+    for (size_t c = lo; c < hi; ++c) {
+      part[c].assign(pl.out_size, op.init());
+      body(part[c].data(), c * rows,
+           std::min<Shape::s_type>(d0, (c + 1) * rows));
+    }
+  });
+  for (const auto& pa : part) {
+    for (size_t i = 0; i < acc.size(); ++i) op.merge(acc[i], pa[i]);
+  }
+  return acc;
+}
+
+// reduce t with op and turn each accumulator into value(a, count)
+template <typename R, typename T, typename Op, typename V>
+Tensor<R> reduce(const Tensor<T>& t, const std::vector<int>& axes,
+                 bool keepdims, ThreadPool* pool, const Op& op, V value) {
+  ReducePlan pl;
+  if (t.is_none() || !reduce_plan(t.shape(), t.strides(), axes, keepdims, pl))
+    return Tensor<R>();
+  KL_STATS_ADD(tensor_bytes, t.size() * sizeof(T) + pl.out_size * sizeof(R));
+  const auto acc = reduce_acc(pl, t.data(), op, pool);
+  Tensor<R> res(Shape(std::move(pl.out_dims)));
+  R* o = res.data();
+  for (size_t i = 0; i < acc.size(); ++i) o[i] = value(acc[i], pl.count);
+  return res;
+}
+
+template <typename T>
+Tensor<T> reduce_sum(const Tensor<T>& t, const std::vector<int>& axes,
+                     bool keepdims, ThreadPool* pool) {
+  typedef SumOp<T, op_ident> Op;
+  return reduce<T>(t, axes, keepdims, pool, Op(),
+                   [](const typename Op::acc_type& a, Shape::s_type) {
+                     return Op::value(a);
+                   });
+}
+
+// integer means are truncated, the mean of no elements is NaN (0 for
+// integers)
+template <typename T>
+Tensor<T> reduce_mean(const Tensor<T>& t, const std::vector<int>& axes,
+                      bool keepdims, ThreadPool* pool) {
+  typedef SumOp<T, op_ident> Op;
+  return reduce<T>(t, axes, keepdims, pool, Op(),
+                   [](const typename Op::acc_type& a, Shape::s_type n) {
+                     if (n == 0) return std::numeric_limits<T>::quiet_NaN();
+                     return static_cast<T>(Op::value(a) / static_cast<T>(n));
+                   });
+}
+
+// euclidean norm
+template <typename T>
+Tensor<T> reduce_norm(const Tensor<T>& t, const std::vector<int>& axes,
+                      bool keepdims, ThreadPool* pool) {
+  static_assert(std::is_floating_point<T>::value,
+                "norm needs a floating point tensor");
+  typedef SumOp<T, op_square> Op;
+  return reduce<T>(t, axes, keepdims, pool, Op(),
+                   [](const typename Op::acc_type& a, Shape::s_type) {
+                     return std::sqrt(Op::value(a));
+                   });
+}
+
+#define KL_TENSOR_EXTREMUM(name, Cmp, R, field)                          \
+  template <typename T>                                                  \
+  Tensor<R> reduce_##name(const Tensor<T>& t, const std::vector<int>& axes, \
+                          bool keepdims, ThreadPool* pool) {             \
+    typedef ExtremumOp<T, Cmp> Op;                                       \
+    return reduce<R>(t, axes, keepdims, pool, Op(),                      \
+                     [](const typename Op::acc_type& a, Shape::s_type) { \
+                       return a.field;                                   \
+                     });                                                 \
+  }
+KL_TENSOR_EXTREMUM(max, std::greater<T>, T, v)
+KL_TENSOR_EXTREMUM(min, std::less<T>, T, v)
+KL_TENSOR_EXTREMUM(argmax, std::greater<T>, int64_t, i)
+KL_TENSOR_EXTREMUM(argmin, std::less<T>, int64_t, i)
+#undef KL_TENSOR_EXTREMUM
+
+// sum(a, axes, keepdims[, pool]) and the like reduce a tensor or an
+// expression over axes, all of them by default, on pool or the shared one;
+// reduced axes are dropped unless keepdims, a full reduction has shape (1).
+// argmax and argmin give the row major index within the reduced axes.
+// Over no elements, sum is 0, max is -inf (or the lowest value) and argmax
+// is -1, and the like for min and argmin
+#define KL_TENSOR_REDUCE(name)                                             \
+  template <typename A, std::enable_if_t<is_tensor_expr<A>::value, int> = 0> \
+  auto name(const A& a, const std::vector<int>& axes = {},                 \
+            bool keepdims = false) {                                       \
+    const Tensor<typename A::value_type> t(a);                             \
+    return reduce_##name(t, axes, keepdims, tensor_pool_for(t.size()));    \
+  }                                                                        \
+  template <typename A, std::enable_if_t<is_tensor_expr<A>::value, int> = 0> \
+  auto name(const A& a, const std::vector<int>& axes, bool keepdims,       \
+            ThreadPool& pool) {                                            \
+    return reduce_##name(Tensor<typename A::value_type>(a), axes, keepdims, \
+                         &pool);                                           \
+  }
+KL_TENSOR_REDUCE(sum)
+KL_TENSOR_REDUCE(mean)
+KL_TENSOR_REDUCE(norm)
+KL_TENSOR_REDUCE(max)
+KL_TENSOR_REDUCE(min)
+KL_TENSOR_REDUCE(argmax)
+KL_TENSOR_REDUCE(argmin)
+#undef KL_TENSOR_REDUCE
+
+// Matrix products. matmul(a, b[, pool]) multiplies the matrices in the last
+// two axes of a and b and broadcasts over the leading batch axes like the
+// elementwise operators do; a 1-d a is taken as a row and a 1-d b as a
+// column, and the axis they add is dropped from the result. Every product
+// is one blocked gemm_acc of algebra.h on the storage of the operands, run
+// on pool or the shared one.
+
+// minimum number of multiply-adds per task of a parallel matmul
+constexpr Shape::s_type matmul_grain = 1 << 16;
+
+// the layout the last two axes of t have as a MatrixView, false if neither
+// of their strides is 1
+template <typename T>
+bool matrix_layout(const Tensor<T>& t, int& ld, Layout& layout) {
+  const auto dims = t.shape();
+  const auto& st = t.strides();
+  const size_t r = dims.size();
+  if (st[r - 1] == 1 || dims[r - 1] == 1) {
+    layout = Layout::RowMajor;
+    ld = static_cast<int>(st[r - 2]);
+  } else if (st[r - 2] == 1 || dims[r - 2] == 1) {
+    layout = Layout::ColMajor;
+    ld = static_cast<int>(st[r - 1]);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// the broadcast of the batch dimensions (all but the last two) of
+// dimensions da and db into bo, false if they do not broadcast
+inline bool batch_dims(Span<const Shape::s_type> da,
+                       Span<const Shape::s_type> db, Shape::dims_type& bo) {
+  const Shape sa(da.first(da.size() - 2)), sb(db.first(db.size() - 2));
+  if (sa.is_none() || sb.is_none()) {
+    bo = Shape::dims_type(sa.is_none() ? sb.value() : sa.value());
+    return true;
+  }
+  if (!sa.is_compatible(sb)) return false;
+  bo = Shape::dims_type((sa + sb).value());
+  return true;
+}
+
+// offsets of the matrices of t broadcast to the batch dimensions bo, in
+// row major order of bo
+template <typename T>
+std::vector<int64_t> batch_offsets(const Tensor<T>& t,
+                                   Span<const Shape::s_type> bo) {
+  const size_t r = t.rank();
+  const StridedLoop<1> loop(
+      bo, {broadcast_strides(t.shape().first(r - 2), t.strides().first(r - 2),
+                             bo)});
+  std::vector<int64_t> res;
+  res.reserve(loop.size());
+  loop.run([&](const StridedLoop<1>::offsets& off, Shape::s_type len,
+               const StridedLoop<1>::offsets& st) {
+    for (Shape::s_type i = 0; i < len; ++i)
+      res.push_back(off[0] + static_cast<int64_t>(i) * st[0]);
+  });
+  return res;
+}
+
+template <typename T>
+Tensor<T> matmul_impl(Tensor<T> a, Tensor<T> b, ThreadPool* pool) {
+  KL_STATS_TIMER("tensor_matmul");
+  typedef Shape::s_type s_type;
+  if (a.is_none() || b.is_none()) return Tensor<T>();
+  const bool row = (a.rank() == 1), col = (b.rank() == 1);
+  if (row) a = a.unsqueeze(0);
+  if (col) b = b.unsqueeze(1);
+  const Shape::dims_type da(a.shape()), db(b.shape());
+  const size_t ra = da.size(), rb = db.size();
+  const s_type m = da[ra - 2], k = da[ra - 1], n = db[rb - 1];
+  if (db[rb - 2] != k) return Tensor<T>();
+  Shape::dims_type bo;
+  if (!batch_dims(da, db, bo)) return Tensor<T>();
+
+  // a in either layout, b row major so that gemm_acc runs its fast path
+  int lda, ldb;
+  Layout la, lb;
+  if (!matrix_layout(a, lda, la)) {
+    a = a.clone();
+    matrix_layout(a, lda, la);
+  }
+  if (!matrix_layout(b, ldb, lb) || lb != Layout::RowMajor) {
+    b = b.clone();
+    matrix_layout(b, ldb, lb);
+  }
+
+  const std::vector<int64_t> oa = batch_offsets(a, bo),
+                             ob = batch_offsets(b, bo);
+
+  // tasks of rows consecutive rows of one product
+  const s_type nb = oa.size(), work = std::max<s_type>(1, k * n);
+  const s_type rows =
+      (pool == nullptr)
+          ? m
+          : std::min(m, std::max<s_type>(1, matmul_grain / work));
+  const s_type nrb = (m + rows - 1) / rows;
+  Shape::dims_type dims(bo);
+  if (!row) dims.push_back(m);
+  if (!col) dims.push_back(n);
+  if (dims.empty()) dims.push_back(1);
+  Tensor<T> res{Shape(std::move(dims))};
+  T* pc = res.data();
+  std::fill(pc, pc + nb * m * n, T(0));
+  const T *pa = std::as_const(a).data(), *pb = std::as_const(b).data();
+  auto task = [&](size_t lo, size_t hi) {
+    for (size_t t = lo; t < hi; ++t) {
+      const s_type g = t / nrb, r0 = (t % nrb) * rows,
+                   r1 = std::min(m, r0 + rows);
+      const MatrixView<const T> A(pa + oa[g], m, k, lda, la);
+      const MatrixView<const T> B(pb + ob[g], k, n, ldb, lb);
+      MatrixView<T> C(pc + g * m * n, m, n, Layout::RowMajor);
+      gemm_acc<T>(A.block(r0, 0, r1 - r0, k), B,
+                  C.block(r0, 0, r1 - r0, n), T(1));
+    }
+  };
+  if (pool == nullptr) {
+    task(0, nb * nrb);
+  } else {
+    parallel_for(*pool, 0, nb * nrb,
+                 std::max<s_type>(1, matmul_grain / (rows * work)), task);
+  }
+
+  return res;
+}
+
+template <typename A, typename B,
+          std::enable_if_t<is_tensor_expr<A>::value &&
+                               is_tensor_expr<B>::value,
+                           int> = 0>
+auto matmul(const A& a, const B& b) {
+  typedef Tensor<typename A::value_type> T;
+  const T ta(a), tb(b);
+  if (ta.is_none() || tb.is_none()) return T();
+  return matmul_impl(ta, tb, tensor_pool_for(ta.size() * tb.shape().back()));
+}
+template <typename A, typename B,
+          std::enable_if_t<is_tensor_expr<A>::value &&
+                               is_tensor_expr<B>::value,
+                           int> = 0>
+auto matmul(const A& a, const B& b, ThreadPool& pool) {
+  typedef Tensor<typename A::value_type> T;
+  return matmul_impl(T(a), T(b), &pool);
+}
+
+// Einstein summation. einsum("ij,jk->ik", {a, b}[, pool]) names the axes
+// of every operand with one letter each; letters shared between operands
+// are multiplied along, letters missing from the output (after "->") are
+// summed over, and without "->" the output has the letters that occur once,
+// in alphabetic order. A letter repeated within an operand takes its
+// diagonal. The expression is planned into views and batched matmuls:
+// letters an operand alone has are summed out first, then the pair of
+// operands that is cheapest to contract (fewest multiply-adds, then
+// smallest result) is contracted, again and again, by permuting both into
+// (batch, free, summed) order, reshaping them to 3-d and one matmul.
+
+template <typename T>
+struct EinsumTerm {
+  Tensor<T> t;
+  std::string idx;  // one letter per axis of t
 };
 
-}  // namespace kl
\ No newline at end of file
+// sum t over its letters not in keep
+template <typename T>
+void einsum_reduce(EinsumTerm<T>& x, const std::string& keep,
+                   ThreadPool* pool) {
+  std::vector<int> axes;
+  std::string idx;
+  for (size_t i = 0; i < x.idx.size(); ++i) {
+    if (keep.find(x.idx[i]) == std::string::npos) {
+      axes.push_back(i);
+    } else {
+      idx += x.idx[i];
+    }
+  }
+  if (axes.empty()) return;
+  x.t = reduce_sum(x.t, axes, false, pool);
+  x.idx = idx;
+}
+
+// x and y contracted over their shared letters not in keep
+template <typename T>
+EinsumTerm<T> einsum_pair(EinsumTerm<T> x, EinsumTerm<T> y,
+                          const std::string& keep, ThreadPool* pool) {
+  einsum_reduce(x, keep + y.idx, pool);
+  einsum_reduce(y, keep + x.idx, pool);
+  std::string batch, left, sum, right;
+  for (char c : x.idx) {
+    if (y.idx.find(c) == std::string::npos) {
+      left += c;
+    } else if (keep.find(c) == std::string::npos) {
+      sum += c;
+    } else {
+      batch += c;
+    }
+  }
+  for (char c : y.idx) {
+    if (x.idx.find(c) == std::string::npos) right += c;
+  }
+  auto view = [](const EinsumTerm<T>& e, const std::string& g0,
+                 const std::string& g1, const std::string& g2,
+                 std::vector<Shape::s_type>& dims) {
+    const auto d = e.t.shape();
+    std::vector<int> axes;
+    std::vector<Shape::s_type> sz;
+    for (const auto& g : {g0, g1, g2}) {
+      Shape::s_type p = 1;
+      for (char c : g) {
+        axes.push_back(e.idx.find(c));
+        p *= d[axes.back()];
+        dims.push_back(d[axes.back()]);
+      }
+      sz.push_back(p);
+    }
+    // a term without letters is a scalar of shape (1)
+    return (e.idx.empty() ? e.t : e.t.permute(axes)).reshaped(sz);
+  };
+  std::vector<Shape::s_type> dx, dy;
+  const Tensor<T> a = view(x, batch, left, sum, dx);
+  const Tensor<T> b = view(y, batch, sum, right, dy);
+  EinsumTerm<T> res{matmul_impl(a, b, pool), batch + left + right};
+  // batch and left dimensions of x, right ones of y
+  std::vector<Shape::s_type> dims(dx.begin(), dx.end() - sum.size());
+  dims.insert(dims.end(), dy.end() - right.size(), dy.end());
+  if (dims.empty()) dims.push_back(1);
+  res.t.reshape(dims);
+  return res;
+}
+
+template <typename T>
+Tensor<T> einsum_impl(const std::string& spec,
+                      const std::vector<Tensor<T>>& ops, ThreadPool* pool) {
+  std::string s;
+  for (char c : spec) {
+    if (c != ' ') s += c;
+  }
+  const size_t arrow = s.find("->");
+  std::vector<EinsumTerm<T>> terms(1);
+  for (size_t i = 0; i < std::min(arrow, s.size()); ++i) {
+    if (s[i] == ',') {
+      terms.emplace_back();
+    } else {
+      terms.back().idx += s[i];
+    }
+  }
+  if (terms.size() != ops.size()) return Tensor<T>();
+
+  // letters, their dimensions and in how many operands they occur
+  std::array<Shape::s_type, 256> dim{};
+  std::array<int, 256> occurs{};
+  for (size_t i = 0; i < terms.size(); ++i) {
+    auto& x = terms[i];
+    const auto d = ops[i].shape();
+    if (ops[i].is_none() || x.idx.size() != d.size()) return Tensor<T>();
+    x.t = ops[i];
+    for (size_t j = 0; j < d.size(); ++j) {
+      const unsigned char c = x.idx[j];
+      if (!std::isalpha(c) || (dim[c] != 0 && dim[c] != d[j]))
+        return Tensor<T>();
+      dim[c] = d[j];
+    }
+    // repeated letters take the diagonal
+    for (size_t j = 0; j < x.idx.size();) {
+      const size_t k = x.idx.find(x.idx[j], j + 1);
+      if (k == std::string::npos) {
+        ++j;
+        continue;
+      }
+      const char c = x.idx[j];
+      x.t = x.t.diagonal(j, k);
+      x.idx.erase(k, 1);
+      x.idx.erase(j, 1);
+      x.idx += c;
+    }
+    for (unsigned char c : x.idx) ++occurs[c];
+  }
+  std::string out;
+  if (arrow == std::string::npos) {
+    std::array<int, 256> written{};
+    for (unsigned char c : s) ++written[c];
+    for (int c = 0; c < 256; ++c) {
+      if (written[c] == 1 && std::isalpha(c)) out += static_cast<char>(c);
+    }
+  } else {
+    out = s.substr(arrow + 2);
+    for (size_t j = 0; j < out.size(); ++j) {
+      const unsigned char c = out[j];
+      if (occurs[c] == 0 || out.find(c, j + 1) != std::string::npos)
+        return Tensor<T>();
+    }
+  }
+
+  // letters needed by the output or by another term than skip
+  auto needed = [&](size_t skip0, size_t skip1) {
+    std::string keep = out;
+    for (size_t i = 0; i < terms.size(); ++i) {
+      if (i != skip0 && i != skip1) keep += terms[i].idx;
+    }
+    return keep;
+  };
+  for (size_t i = 0; i < terms.size(); ++i)
+    einsum_reduce(terms[i], needed(i, i), pool);
+  while (terms.size() > 1) {
+    size_t bi = 0, bj = 1;
+    Shape::s_type best_cost = 0, best_size = 0;
+    for (size_t i = 0; i < terms.size(); ++i) {
+      for (size_t j = i + 1; j < terms.size(); ++j) {
+        const std::string keep = needed(i, j);
+        Shape::s_type cost = 1, size = 1;
+        std::string seen;
+        for (char c : terms[i].idx + terms[j].idx) {
+          if (seen.find(c) != std::string::npos) continue;
+          seen += c;
+          cost *= dim[static_cast<unsigned char>(c)];
+          if (keep.find(c) != std::string::npos)
+            size *= dim[static_cast<unsigned char>(c)];
+        }
+        if (best_cost == 0 || cost < best_cost ||
+            (cost == best_cost && size < best_size)) {
+          bi = i;
+          bj = j;
+          best_cost = cost;
+          best_size = size;
+        }
+      }
+    }
+    auto res = einsum_pair(terms[bi], terms[bj], needed(bi, bj), pool);
+    terms.erase(terms.begin() + bj);
+    terms[bi] = std::move(res);
+  }
+
+  auto& x = terms[0];
+  einsum_reduce(x, out, pool);
+  if (out.empty()) return x.t.reshaped({1});
+  std::vector<int> axes;
+  for (char c : out) axes.push_back(x.idx.find(c));
+  return x.t.permute(axes).contiguous();
+}
+
+template <typename T>
+Tensor<T> einsum(const std::string& spec, const std::vector<Tensor<T>>& ops) {
+  return einsum_impl(spec, ops, shared_tensor_pool());
+}
+template <typename T>
+Tensor<T> einsum(const std::string& spec, const std::vector<Tensor<T>>& ops,
+                 ThreadPool& pool) {
+  return einsum_impl(spec, ops, &pool);
+}
+template <typename T>
+Tensor<T> einsum(const std::string& spec,
+                 std::initializer_list<Tensor<T>> ops) {
+  return einsum_impl(spec, std::vector<Tensor<T>>(ops), shared_tensor_pool());
+}
+template <typename T>
+Tensor<T> einsum(const std::string& spec, std::initializer_list<Tensor<T>> ops,
+                 ThreadPool& pool) {
+  return einsum_impl(spec, std::vector<Tensor<T>>(ops), &pool);
+}
+
+// Linear algebra on batches of matrices. solve, inv, det and lstsq take
+// the matrices in the last two axes of their operands and broadcast over
+// the leading batch axes like matmul. Each matrix is read in place through
+// a MatrixView of its strides (copied only if neither of its last two
+// strides is 1) and factored with the LU and Cholesky routines of
+// algebra.h into scratch space of the task; the batches are spread over
+// pool or the shared one, and a single large matrix uses the parallel
+// factorizations instead.
+
+// t, or a copy if its last two axes have no MatrixView layout
+template <typename T>
+Tensor<T> as_matrices(Tensor<T> t, int& ld, Layout& layout) {
+  if (!matrix_layout(t, ld, layout)) {
+    t = t.clone();
+    matrix_layout(t, ld, layout);
+  }
+  return t;
+}
+
+// f(lo, hi) over the batches [lo, hi) of nb, each of about work
+// multiply-adds, in parallel on pool unless it is null
+template <typename F>
+void batch_for(ThreadPool* pool, Shape::s_type nb, Shape::s_type work,
+               F&& f) {
+  if (pool == nullptr) {
+    f(0, nb);
+    return;
+  }
+  const Shape::s_type grain = matmul_grain / std::max<Shape::s_type>(1, work);
+  parallel_for(*pool, 0, nb, std::max<Shape::s_type>(1, grain), f);
+}
+
+// true if a single matrix of about work multiply-adds should be factored
+// in parallel on pool
+inline bool parallel_matrix(ThreadPool* pool, Shape::s_type nb,
+                            Shape::s_type work) {
+  return pool != nullptr && pool->size() > 1 && nb == 1 &&
+         work >= 2 * matmul_grain;
+}
+
+template <typename T>
+Tensor<T> solve_impl(Tensor<T> a, Tensor<T> b, ThreadPool* pool) {
+  KL_STATS_TIMER("tensor_solve");
+  typedef Shape::s_type s_type;
+  if (a.rank() < 2 || b.is_none()) return Tensor<T>();
+  const bool vec = (b.rank() == 1);
+  if (vec) b = b.unsqueeze(1);
+  const s_type n = a.shape().back(), k = b.shape().back();
+  if (a.shape()[a.rank() - 2] != n || b.shape()[b.rank() - 2] != n)
+    return Tensor<T>();
+  Shape::dims_type bo;
+  if (!batch_dims(a.shape(), b.shape(), bo)) return Tensor<T>();
+  int lda, ldb;
+  Layout la, lb;
+  a = as_matrices(std::move(a), lda, la);
+  b = as_matrices(std::move(b), ldb, lb);
+  const std::vector<int64_t> oa = batch_offsets(a, bo),
+                             ob = batch_offsets(b, bo);
+
+  Shape::dims_type dims(bo);
+  dims.push_back(n);
+  if (!vec) dims.push_back(k);
+  Tensor<T> res{Shape(std::move(dims))};
+  T* px = res.data();
+  const T *pa = std::as_const(a).data(), *pb = std::as_const(b).data();
+  const int nn = n, kk = k;
+  auto A = [&](size_t g) {
+    return MatrixView<const T>(pa + oa[g], nn, nn, lda, la);
+  };
+  auto B = [&](size_t g) {
+    return MatrixView<const T>(pb + ob[g], nn, kk, ldb, lb);
+  };
+  auto X = [&](size_t g) {
+    return MatrixView<T>(px + g * n * k, nn, kk, Layout::RowMajor);
+  };
+  const s_type nb = oa.size(), work = n * n * (n + k);
+  if (parallel_matrix(pool, nb, work)) {
+    LUFactorization<T>(A(0), *pool).solve(X(0), B(0), *pool);
+    return res;
+  }
+  batch_for(pool, nb, work, [&](size_t lo, size_t hi) {
+    std::vector<T> lu(n * n);
+    std::vector<int> piv(n);
+    for (size_t g = lo; g < hi; ++g) {
+      const LUFactorization<T> f(A(g), MatrixView<T>(lu.data(), nn, nn, la),
+                                 piv.data());
+      f.solve(X(g), B(g));
+    }
+  });
+  return res;
+}
+
+// the inverses (inv) or determinants (det) of the matrices of a
+template <typename T>
+Tensor<T> lu_impl(Tensor<T> a, ThreadPool* pool, bool inv) {
+  typedef Shape::s_type s_type;
+  if (a.rank() < 2) return Tensor<T>();
+  const s_type n = a.shape().back();
+  if (a.shape()[a.rank() - 2] != n) return Tensor<T>();
+  int lda;
+  Layout la;
+  a = as_matrices(std::move(a), lda, la);
+  const Shape::dims_type bo(a.shape().first(a.rank() - 2));
+  const std::vector<int64_t> oa = batch_offsets(a, bo);
+
+  Shape::dims_type dims(bo);
+  if (inv) {
+    dims.push_back(n);
+    dims.push_back(n);
+  }
+  if (dims.empty()) dims.push_back(1);
+  Tensor<T> res{Shape(std::move(dims))};
+  T* pr = res.data();
+  const T* pa = std::as_const(a).data();
+  const int nn = n;
+  auto A = [&](size_t g) {
+    return MatrixView<const T>(pa + oa[g], nn, nn, lda, la);
+  };
+  auto put = [&](const LUFactorization<T>& f, size_t g) {
+    if (inv)
+      f.inverse(MatrixView<T>(pr + g * n * n, nn, nn, Layout::RowMajor));
+    else
+      pr[g] = f.determinant();
+  };
+  const s_type nb = oa.size(), work = n * n * n;
+  if (parallel_matrix(pool, nb, work)) {
+    put(LUFactorization<T>(A(0), *pool), 0);
+    return res;
+  }
+  batch_for(pool, nb, work, [&](size_t lo, size_t hi) {
+    std::vector<T> lu(n * n);
+    std::vector<int> piv(n);
+    for (size_t g = lo; g < hi; ++g)
+      put(LUFactorization<T>(A(g), MatrixView<T>(lu.data(), nn, nn, la),
+                             piv.data()),
+          g);
+  });
+  return res;
+}
+
+// least squares by the Householder QR of a copy of each A, see qrsolve of
+// algebra.h; the batches are spread over the pool
+template <typename T>
+Tensor<T> lstsq_impl(Tensor<T> a, Tensor<T> b, ThreadPool* pool) {
+  typedef Shape::s_type s_type;
+  if (a.rank() < 2 || b.is_none()) return Tensor<T>();
+  const bool vec = (b.rank() == 1);
+  if (vec) b = b.unsqueeze(1);
+  const s_type m = a.shape()[a.rank() - 2], n = a.shape().back(),
+               k = b.shape().back();
+  if (m < n || b.shape()[b.rank() - 2] != m) return Tensor<T>();
+  Shape::dims_type bo;
+  if (!batch_dims(a.shape(), b.shape(), bo)) return Tensor<T>();
+  int lda, ldb;
+  Layout la, lb;
+  a = as_matrices(std::move(a), lda, la);
+  b = as_matrices(std::move(b), ldb, lb);
+  const std::vector<int64_t> oa = batch_offsets(a, bo),
+                             ob = batch_offsets(b, bo);
+
+  Shape::dims_type dims(bo);
+  dims.push_back(n);
+  if (!vec) dims.push_back(k);
+  Tensor<T> res{Shape(std::move(dims))};
+  T* px = res.data();
+  const T *pa = std::as_const(a).data(), *pb = std::as_const(b).data();
+  const int mm = m, nn = n, kk = k;
+  const s_type nb = oa.size(), work = m * n * (n + k);
+  batch_for(pool, nb, work, [&](size_t lo, size_t hi) {
+    std::vector<T> qa(m * n), qb(m * k);
+    for (size_t g = lo; g < hi; ++g) {
+      const MatrixView<const T> A(pa + oa[g], mm, nn, lda, la);
+      const MatrixView<const T> B(pb + ob[g], mm, kk, ldb, lb);
+      MatrixView<T> QA(qa.data(), mm, nn), QB(qb.data(), mm, kk);
+      copymat<T>(A, QA);
+      copymat<T>(B, QB);
+      qrsolve<T>(QA, QB, MatrixView<T>(px + g * n * k, nn, kk,
+                                        Layout::RowMajor));
+    }
+  });
+  return res;
+}
+
+#define KL_TENSOR_LINALG2(name)                                              \
+  template <typename A, typename B,                                          \
+            std::enable_if_t<is_tensor_expr<A>::value &&                     \
+                                 is_tensor_expr<B>::value,                   \
+                             int> = 0>                                       \
+  auto name(const A& a, const B& b) {                                        \
+    typedef Tensor<typename A::value_type> T;                                \
+    return name##_impl(T(a), T(b), shared_tensor_pool());                    \
+  }                                                                          \
+  template <typename A, typename B,                                          \
+            std::enable_if_t<is_tensor_expr<A>::value &&                     \
+                                 is_tensor_expr<B>::value,                   \
+                             int> = 0>                                       \
+  auto name(const A& a, const B& b, ThreadPool& pool) {                      \
+    typedef Tensor<typename A::value_type> T;                                \
+    return name##_impl(T(a), T(b), &pool);                                   \
+  }
+// X with A X = B for the square matrices A of a and B of b, or the vector
+// b; a singular A gives infinities or NaNs
+KL_TENSOR_LINALG2(solve)
+// X minimizing |A X - B| for the m by n (m >= n) matrices A of a and B of
+// b, or the vector b, with A of full column rank; a rank deficient A gives
+// infinities or NaNs
+KL_TENSOR_LINALG2(lstsq)
+#undef KL_TENSOR_LINALG2
+
+#define KL_TENSOR_LINALG1(name, inv)                                         \
+  template <typename A,                                                      \
+            std::enable_if_t<is_tensor_expr<A>::value, int> = 0>             \
+  auto name(const A& a) {                                                    \
+    return lu_impl(Tensor<typename A::value_type>(a), shared_tensor_pool(),  \
+                   inv);                                                     \
+  }                                                                          \
+  template <typename A,                                                      \
+            std::enable_if_t<is_tensor_expr<A>::value, int> = 0>             \
+  auto name(const A& a, ThreadPool& pool) {                                  \
+    return lu_impl(Tensor<typename A::value_type>(a), &pool, inv);           \
+  }
+// inverses of the square matrices of a, of shape (..., n, n)
+KL_TENSOR_LINALG1(inv, true)
+// determinants of the square matrices of a, of the batch shape of a or (1)
+KL_TENSOR_LINALG1(det, false)
+#undef KL_TENSOR_LINALG1
+
+// Random tensors are drawn in chunks of random_chunk elements, chunk c
+// from philox stream c of the seed, so that the values only depend on the
+// seed and the shape, not on the number of threads.
+constexpr Shape::s_type random_chunk = 1 << 16;
+
+template <typename T, typename F>
+Tensor<T> random_impl(const Shape& shape, uint64_t seed, ThreadPool* pool,
+                      F fill) {
+  Tensor<T> res(shape);
+  T* p = res.data();
+  const Shape::s_type size = res.size();
+  const Shape::s_type nchunk = (size + random_chunk - 1) / random_chunk;
+  auto run = [&](size_t lo, size_t hi) {
+    for (size_t c = lo; c < hi; ++c) {
+      PhiloxLanes src{seed, c, 0};
+      const Shape::s_type begin = c * random_chunk;
+      fill(src, p + begin, std::min(random_chunk, size - begin));
+    }
+  };
+  if (pool == nullptr || nchunk < 2)
+    run(0, nchunk);
+  else
+    parallel_for(*pool, 0, nchunk, 1, run);
+  return res;
+}
+
+template <typename T>
+Tensor<T> uniform_impl(const Shape& shape, T lo, T hi, uint64_t seed,
+                       ThreadPool* pool) {
+  return random_impl<T>(shape, seed, pool, [=](auto& src, T* p, size_t n) {
+    fill_uniform(src, p, n, lo, hi);
+  });
+}
+template <typename T>
+Tensor<T> normal_impl(const Shape& shape, T mean, T stddev, uint64_t seed,
+                      ThreadPool* pool) {
+  return random_impl<T>(shape, seed, pool, [=](auto& src, T* p, size_t n) {
+    fill_normal(src, p, n, mean, stddev);
+  });
+}
+
+// values uniform in [lo, hi) for integer and floating point T
+template <typename T>
+Tensor<T> random_uniform(const Shape& shape, T lo, T hi, uint64_t seed) {
+  return uniform_impl(shape, lo, hi, seed, shared_tensor_pool());
+}
+template <typename T>
+Tensor<T> random_uniform(const Shape& shape, T lo, T hi, uint64_t seed,
+                         ThreadPool& pool) {
+  return uniform_impl(shape, lo, hi, seed, &pool);
+}
+
+// normal values of the given mean and standard deviation
+template <typename T>
+Tensor<T> random_normal(const Shape& shape, T mean, T stddev, uint64_t seed) {
+  return normal_impl(shape, mean, stddev, seed, shared_tensor_pool());
+}
+template <typename T>
+Tensor<T> random_normal(const Shape& shape, T mean, T stddev, uint64_t seed,
+                        ThreadPool& pool) {
+  return normal_impl(shape, mean, stddev, seed, &pool);
+}
+
+template <typename E>
+Tensor(const TensorExpr<E>&) -> Tensor<typename E::value_type>;
+
+}  // namespace kl
@@ -63,6 +63,534 @@ TEST(test_dynamic, dynamic_foo) {
   }
 };
 
+TEST(test_broadcast, any_axis) {
+  // (4, 1, 5) op (3, 1) -> (4, 3, 5), broadcast along middle and inner axes
+  std::vector<int> a(4 * 5), b(3), sum(4 * 3 * 5), prod(4 * 3 * 5);
+  for (auto& v : a) v = rng.uniform<int32_t>(-100, 100);
+  for (auto& v : b) v = rng.uniform<int32_t>(-100, 100);
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      for (int k = 0; k < 5; ++k) {
+        sum[(i * 3 + j) * 5 + k] = a[i * 5 + k] + b[j];
+        prod[(i * 3 + j) * 5 + k] = a[i * 5 + k] * b[j];
+      }
+    }
+  }
+  Tensor<int> x(Shape({4, 1, 5}), a), y(Shape({3, 1}), b);
+  EXPECT_EQ(x + y, Tensor<int>(Shape({4, 3, 5}), sum));
+  EXPECT_EQ(y + x, Tensor<int>(Shape({4, 3, 5}), sum));
+  EXPECT_EQ(x * y, Tensor<int>(Shape({4, 3, 5}), prod));
+  EXPECT_EQ((x + y) - y, x + Tensor<int>(Shape({3, 1}), {0, 0, 0}));
+
+  // scalar shaped operand
+  Tensor<int> s(Shape({1}), {7});
+  EXPECT_EQ(x * s, x * 7);
+  EXPECT_TRUE((x + Tensor<int>(Shape({2, 4}), std::vector<int>(8))).is_none());
+};
+
+TEST(test_expression, fused_chain) {
+  // a * b + c * 2 - d with a (3, 4), b (4), c (3, 1), d a scalar tensor
+  std::vector<double> a(12), b(4), c(3), r(12);
+  for (auto& v : a) v = rng.doub();
+  for (auto& v : b) v = rng.doub();
+  for (auto& v : c) v = rng.doub();
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 4; ++j)
+      r[i * 4 + j] = a[i * 4 + j] * b[j] + c[i] * 2 - 0.5;
+  Tensor<double> x(Shape({3, 4}), a), y(Shape({4}), b), z(Shape({3, 1}), c),
+      d(Shape({1}), {0.5});
+  auto e = x * y + z * 2.0 - d;  // nothing evaluated yet
+  EXPECT_EQ(e.shape(), std::vector<uint64_t>({3, 4}));
+  Tensor<double> t = e;
+  EXPECT_EQ(t, Tensor<double>(Shape({3, 4}), r));
+
+  // temporaries are held by value, unary minus and division
+  auto f = -(Tensor<double>(Shape({3, 4}), a) / 2.0) + x;
+  EXPECT_EQ(Tensor<double>(f), x * 0.5);
+  EXPECT_EQ(Tensor<double>(1.0 - x), -x + 1.0);
+  EXPECT_TRUE((x + Tensor<double>(Shape({2}), {1, 2})).is_none());
+};
+
+TEST(test_simd_ops, kernels_match_scalar) {
+  // broadcast along the inner axis (scalar runs) and contiguous runs
+  const uint64_t n = 37, m = 5;
+  std::vector<float> a(n * m), b(m);
+  for (auto& v : a) v = static_cast<float>(rng.doub() * 4 - 2);
+  for (auto& v : b) v = static_cast<float>(rng.doub() + 0.5);
+  Tensor<float> x(Shape({m, n}), a), y(Shape({m, 1}), b);
+  std::vector<Tensor<float>> res;
+  for (auto isa : {kl::simd::Isa::scalar, kl::simd::detect_isa()}) {
+    kl::simd::set_isa(isa);
+    res.push_back(x / y);  // single kernels
+    res.push_back(kl::exp(x));
+    res.push_back(kl::exp(x) + kl::tanh(x) * kl::log(x * x + 1.0f));
+  }
+  EXPECT_EQ(res[0], res[3]);
+  for (uint64_t i = 0; i < n * m; ++i) {
+    EXPECT_NEAR(res[1].data()[i], std::exp(a[i]), 1e-6f * std::exp(a[i]));
+    EXPECT_NEAR(res[4].data()[i], std::exp(a[i]), 1e-6f * std::exp(a[i]));
+  }
+  Tensor<float> d = res[2] - res[5];
+  for (uint64_t i = 0; i < n * m; ++i)
+    EXPECT_LT(std::abs(d.data()[i] / res[2].data()[i]), 1e-6f);
+  for (uint64_t i = 0; i < m; ++i)
+    for (uint64_t j = 0; j < n; ++j)
+      ASSERT_EQ(res[0].data()[i * n + j], a[i * n + j] / b[i]);
+};
+
+TEST(test_views, share_and_copy_on_write) {
+  // x (2, 3, 4) with x[i][j][k] = 100 i + 10 j + k
+  std::vector<int> a(24);
+  for (int i = 0; i < 24; ++i) a[i] = 100 * (i / 12) + 10 * (i / 4 % 3) + i % 4;
+  Tensor<int> x(Shape({2, 3, 4}), a);
+
+  auto s = x.slice(2, 1, 4, 2);  // k = 1, 3
+  EXPECT_EQ(s.shape(), std::vector<uint64_t>({2, 3, 2}));
+  EXPECT_TRUE(s.shares_storage(x));
+  EXPECT_FALSE(s.is_contiguous());
+  EXPECT_EQ(s.at({1, 2, 1}), 123);
+  auto p = x.permute({2, 0, 1});
+  EXPECT_EQ(p.shape(), std::vector<uint64_t>({4, 2, 3}));
+  EXPECT_EQ(p.at({3, 1, 2}), 123);
+  EXPECT_EQ(x.transpose().at({1, 2, 1}), 112);
+  EXPECT_EQ(x.select(1, 2).at({1, 3}), 123);
+  EXPECT_TRUE(x.slice(3, 0, 1).is_none());
+  EXPECT_TRUE(x.permute({0, 0, 1}).is_none());
+
+  // size 1 axes
+  auto u = x.unsqueeze(-1).unsqueeze(0);
+  EXPECT_EQ(u.shape(), std::vector<uint64_t>({1, 2, 3, 4, 1}));
+  EXPECT_EQ(u.squeeze(), x);
+  EXPECT_EQ(u.squeeze(0).rank(), 4);
+  EXPECT_EQ(u.squeeze(1).rank(), 5);
+
+  // reshape is a view when the strides allow it, a copy otherwise
+  auto r = x.reshaped({6, 4});
+  EXPECT_TRUE(r.shares_storage(x));
+  EXPECT_EQ(r.at({5, 3}), 123);
+  auto t = x.transpose(0, 2).reshaped({4, 6});
+  EXPECT_FALSE(t.shares_storage(x));
+  EXPECT_TRUE(t.is_contiguous());
+  EXPECT_EQ(t.at({3, 5}), 123);
+  EXPECT_TRUE(x.slice(0, 1, 2).reshaped({12}).shares_storage(x));
+  EXPECT_TRUE(x.reshaped({5, 5}).is_none());
+
+  // expressions read views through their strides
+  Tensor<int> d = p - x.permute({2, 0, 1}).contiguous();
+  EXPECT_EQ(d, Tensor<int>(Shape({4, 2, 3}), std::vector<int>(24, 0)));
+  Tensor<int> m = x.transpose(0, 2) * s.select(2, 0).transpose(0, 1);
+  EXPECT_EQ(m.at({3, 2, 1}), 123 * 121);
+
+  // writes go to storage of the writer only
+  Tensor<int> y = x;
+  EXPECT_TRUE(y.shares_storage(x));
+  y.data()[0] = -1;
+  EXPECT_FALSE(y.shares_storage(x));
+  EXPECT_EQ(x.at({0, 0, 0}), 0);
+  s *= 2;
+  EXPECT_EQ(s.at({1, 2, 1}), 246);
+  EXPECT_EQ(x.at({1, 2, 3}), 123);
+  EXPECT_EQ(x.clone(), x);
+  EXPECT_FALSE(x.clone().shares_storage(x));
+};
+
+TEST(test_reduce, axes_and_keepdims) {
+  // x (3, 4, 5)
+  std::vector<double> a(60);
+  for (auto& v : a) v = rng.doub() * 2 - 1;
+  Tensor<double> x(Shape({3, 4, 5}), a);
+  auto s1 = kl::sum(x, {1});
+  auto m02 = kl::mean(x, {0, -1}, true);
+  auto mx = kl::max(x.transpose(0, 2), {2});  // (5, 4, 3) over axis of 3
+  auto am = kl::argmax(x.transpose(0, 2), {2});
+  EXPECT_EQ(s1.shape(), std::vector<uint64_t>({3, 5}));
+  EXPECT_EQ(m02.shape(), std::vector<uint64_t>({1, 4, 1}));
+  EXPECT_EQ(mx.shape(), std::vector<uint64_t>({5, 4}));
+  for (uint64_t i = 0; i < 3; ++i) {
+    for (uint64_t k = 0; k < 5; ++k) {
+      double r = 0;
+      for (uint64_t j = 0; j < 4; ++j) r += x.at({i, j, k});
+      EXPECT_NEAR(s1.at({i, k}), r, 1e-14);
+    }
+  }
+  for (uint64_t j = 0; j < 4; ++j) {
+    double r = 0;
+    for (uint64_t i = 0; i < 3; ++i)
+      for (uint64_t k = 0; k < 5; ++k) r += x.at({i, j, k});
+    EXPECT_NEAR(m02.at({0, j, 0}), r / 15, 1e-14);
+  }
+  for (uint64_t k = 0; k < 5; ++k) {
+    for (uint64_t j = 0; j < 4; ++j) {
+      uint64_t best = 0;
+      for (uint64_t i = 1; i < 3; ++i)
+        if (x.at({i, j, k}) > x.at({best, j, k})) best = i;
+      EXPECT_EQ(mx.at({k, j}), x.at({best, j, k}));
+      EXPECT_EQ(am.at({k, j}), static_cast<int64_t>(best));
+    }
+  }
+  EXPECT_EQ(kl::sum(x).shape(), std::vector<uint64_t>({1}));
+  EXPECT_NEAR(kl::norm(x).at({0}),
+              std::sqrt(kl::sum(x * x).at({0})), 1e-14);
+  EXPECT_EQ(kl::argmin(-x, {}, true).at({0, 0, 0}),
+            kl::argmax(x).at({0}));
+  EXPECT_TRUE(kl::sum(x, {3}).is_none());
+
+  // integer ties go to the first index
+  Tensor<int> y(Shape({2, 3}), {1, 5, 5, 7, 2, 7});
+  EXPECT_EQ(kl::argmax(y, {1}), Tensor<int64_t>(Shape({2}), {1, 0}));
+  EXPECT_EQ(kl::min(y, {0}), Tensor<int>(Shape({3}), {1, 2, 5}));
+};
+
+TEST(test_reduce, accurate_and_parallel) {
+  // 2^20 times 0.1f, a naive float sum is off by about 1%
+  const uint64_t n = 1 << 20;
+  Tensor<float> x(Shape({n}), std::vector<float>(n, 0.1f));
+  kl::ThreadPool pool(4);
+  EXPECT_NEAR(kl::sum(x).at({0}), 0.1 * n, 1e-6 * n);
+  EXPECT_NEAR(kl::sum(x, {}, false, pool).at({0}), 0.1 * n, 1e-6 * n);
+
+  // inner and outer axes of a large tensor, serial and parallel
+  const uint64_t r = 300, c = 500;
+  std::vector<double> a(r * c);
+  for (auto& v : a) v = rng.doub();
+  Tensor<double> y(Shape({r, c}), a);
+  for (int axis : {0, 1}) {
+    auto s = kl::sum(y, {axis}), p = kl::sum(y, {axis}, false, pool);
+    ASSERT_EQ(s.shape(), p.shape());
+    for (uint64_t i = 0; i < s.size(); ++i)
+      EXPECT_NEAR(s.data()[i], p.data()[i], 1e-11);
+    EXPECT_EQ(kl::argmax(y, {axis}), kl::argmax(y, {axis}, false, pool));
+  }
+  EXPECT_NEAR(kl::sum(y.transpose(), {1}, false, pool).at({7}),
+              kl::sum(y, {0}).at({7}), 1e-11);
+};
+
+TEST(test_reduce, empty_axes) {
+  const double inf = std::numeric_limits<double>::infinity();
+  Tensor<double> x(Shape({0, 5})), y(Shape({5, 0}));
+  kl::ThreadPool pool(4);
+  const Tensor<double> zeros(Shape({5}), std::vector<double>(5, 0.0));
+  EXPECT_EQ(kl::sum(x, {0}), zeros);
+  EXPECT_EQ(kl::sum(x, {0}, false, pool), kl::sum(x, {0}));
+  EXPECT_EQ(kl::sum(x, {1}).shape(), std::vector<uint64_t>({0}));
+  EXPECT_EQ(kl::sum(y, {0}).shape(), std::vector<uint64_t>({0}));
+  EXPECT_EQ(kl::sum(y, {1}), zeros);
+  EXPECT_EQ(kl::sum(y).at({0}), 0.0);
+  EXPECT_TRUE(std::isnan(kl::mean(x, {0}).at({3})));
+  EXPECT_TRUE(std::isnan(kl::mean(y).at({0})));
+  EXPECT_EQ(kl::mean(Tensor<int>(Shape({5, 0})), {1}).at({2}), 0);
+  EXPECT_EQ(kl::max(x, {0}).at({4}), -inf);
+  EXPECT_EQ(kl::max(y).at({0}), -inf);
+  EXPECT_EQ(kl::max(y, {0}).shape(), std::vector<uint64_t>({0}));
+  EXPECT_EQ(kl::argmax(x, {0}),
+            Tensor<int64_t>(Shape({5}), std::vector<int64_t>(5, -1)));
+  EXPECT_EQ(kl::argmax(y, {1}, true).shape(), std::vector<uint64_t>({5, 1}));
+  EXPECT_EQ(kl::argmax(y).at({0}), -1);
+};
+
+// naive c[i][j] = sum_p a[i][p] b[p][j] of rank 2 tensors
+template <typename T>
+Tensor<T> naive_matmul(const Tensor<T>& a, const Tensor<T>& b) {
+  const uint64_t m = a.shape()[0], k = a.shape()[1], n = b.shape()[1];
+  std::vector<T> c(m * n, 0);
+  for (uint64_t i = 0; i < m; ++i)
+    for (uint64_t j = 0; j < n; ++j)
+      for (uint64_t p = 0; p < k; ++p) c[i * n + j] += a.at({i, p}) * b.at({p, j});
+  return Tensor<T>(Shape({m, n}), c);
+}
+
+template <typename T>
+Tensor<T> random_tensor(std::vector<uint64_t> dims) {
+  std::vector<T> v(Shape(dims).size());
+  for (auto& x : v) x = rng.uniform<int32_t>(-9, 9);
+  return Tensor<T>(Shape(std::move(dims)), v);
+}
+
+TEST(test_matmul, batch_broadcast) {
+  // (2, 1, 3, 4) x (5, 4, 6) -> (2, 5, 3, 6), exact on small integers
+  auto a = random_tensor<double>({2, 1, 3, 4});
+  auto b = random_tensor<double>({5, 4, 6});
+  auto c = kl::matmul(a, b);
+  ASSERT_EQ(c.shape(), std::vector<uint64_t>({2, 5, 3, 6}));
+  for (uint64_t i = 0; i < 2; ++i)
+    for (uint64_t j = 0; j < 5; ++j)
+      ASSERT_EQ(c.select(0, i).select(0, j),
+                naive_matmul(a.select(0, i).select(0, 0), b.select(0, j)));
+
+  // transposed views, vectors, parallel rows
+  auto x = random_tensor<double>({70, 90});
+  auto y = random_tensor<double>({70, 80});
+  kl::ThreadPool pool(4);
+  EXPECT_EQ(kl::matmul(x.transpose(), y), naive_matmul(x.transpose(), y));
+  EXPECT_EQ(kl::matmul(y.transpose(), x, pool),
+            naive_matmul(y.transpose(), x));
+  auto v = x.select(1, 3);  // (70)
+  EXPECT_EQ(kl::matmul(v, y).shape(), std::vector<uint64_t>({80}));
+  EXPECT_EQ(kl::matmul(v, y), naive_matmul(v.unsqueeze(0), y).select(0, 0));
+  EXPECT_EQ(kl::matmul(y.transpose(), v),
+            naive_matmul(y.transpose(), v.unsqueeze(1)).select(1, 0));
+  EXPECT_EQ(kl::matmul(v, v).shape(), std::vector<uint64_t>({1}));
+  EXPECT_TRUE(kl::matmul(x, y).is_none());
+  EXPECT_TRUE(kl::matmul(x, Tensor<double>()).is_none());
+  EXPECT_TRUE(kl::matmul(Tensor<double>(), x).is_none());
+  EXPECT_TRUE(kl::matmul(random_tensor<double>({2, 3, 4}),
+                         random_tensor<double>({3, 4, 5}))
+                  .is_none());
+};
+
+TEST(test_einsum, contractions) {
+  auto a = random_tensor<double>({3, 4});
+  auto b = random_tensor<double>({4, 5});
+  auto c = random_tensor<double>({5, 2});
+  auto ab = naive_matmul(a, b);
+  EXPECT_EQ(kl::einsum("ij,jk->ik", {a, b}), ab);
+  EXPECT_EQ(kl::einsum("ij,jk", {a, b}), ab);
+  EXPECT_EQ(kl::einsum("ij,jk->ki", {a, b}), ab.transpose().contiguous());
+  EXPECT_EQ(kl::einsum("ij, jk, kl -> il", {a, b, c}),
+            naive_matmul(ab, c));
+  EXPECT_EQ(kl::einsum("ij->", {a}).at({0}), kl::sum(a).at({0}));
+  EXPECT_EQ(kl::einsum("ij->j", {a}), kl::sum(a, {0}));
+  EXPECT_EQ(kl::einsum("ij,ij->", {a, a}).at({0}), kl::sum(a * a).at({0}));
+  EXPECT_EQ(kl::einsum("ij,ij->ij", {a, a}), a * a);
+  EXPECT_EQ(kl::einsum("i,j->ij", {a.select(1, 0), b.select(1, 0)}),
+            naive_matmul(a.slice(1, 0, 1), b.slice(1, 0, 1).transpose()));
+
+  // diagonal, batches and a scalar factor
+  auto s = random_tensor<double>({4, 4});
+  double tr = 0;
+  for (uint64_t i = 0; i < 4; ++i) tr += s.at({i, i});
+  EXPECT_EQ(kl::einsum("ii", {s}).at({0}), tr);
+  EXPECT_EQ(kl::einsum("ii->i", {s}).at({2}), s.at({2, 2}));
+  auto x = random_tensor<double>({6, 3, 4}), y = random_tensor<double>({6, 4, 5});
+  kl::ThreadPool pool(2);
+  EXPECT_EQ(kl::einsum("bij,bjk->bik", {x, y}, pool), kl::matmul(x, y));
+  EXPECT_EQ(kl::einsum("bij,bjk,k->ib", {x, y, c.select(1, 1)}),
+            kl::sum(kl::matmul(x, y) * c.select(1, 1), {2}).transpose()
+                .contiguous());
+  EXPECT_EQ(kl::einsum("ij,k->i", {a, c.select(1, 0)}),
+            kl::sum(a, {1}) * kl::sum(c.select(1, 0)).at({0}));
+  EXPECT_TRUE(kl::einsum("ij,jk->ik", {a, a}).is_none());
+  EXPECT_TRUE(kl::einsum("ij->iz", {a}).is_none());
+};
+
+TEST(test_parallel, matches_serial) {
+  // a small grain so that these tensors are split across the shared pool
+  const auto threads = kl::tensor_threads();
+  const auto grain = kl::tensor_grain();
+  kl::set_tensor_grain(64);
+  std::vector<double> a(37 * 41 * 5), b(41);
+  for (auto& v : a) v = rng.doub();
+  for (auto& v : b) v = rng.doub();
+  Tensor<double> x(Shape({37, 41, 5}), a), y(Shape({41, 1}), b);
+  std::vector<std::vector<Tensor<double>>> res;
+  for (size_t n : {1, 4}) {
+    kl::set_tensor_threads(n);
+    res.emplace_back();
+    auto& r = res.back();
+    r.push_back(x * y + kl::exp(x));
+    r.push_back(x.transpose(0, 2).clone());
+    r.push_back(x.slice(1, 3, 40, 2));
+    r.back() *= 3.0;
+    r.push_back(kl::sum(x, {0, 2}));
+    r.push_back(kl::max(x.transpose(), {0}));
+    r.push_back(kl::matmul(x, x.transpose()));
+  }
+  for (size_t i = 0; i < res[0].size(); ++i) {
+    ASSERT_EQ(res[0][i].shape(), res[1][i].shape());
+    EXPECT_LT(kl::norm(res[0][i] - res[1][i]).at({0}), 1e-12) << i;
+  }
+  kl::set_tensor_threads(threads);
+  kl::set_tensor_grain(grain);
+};
+
+TEST(test_inplace, compound_and_reuse) {
+  auto x = random_tensor<double>({4, 5}), y = random_tensor<double>({5});
+  Tensor<double> x0 = x.clone(), r = x + y;
+  x += y;
+  EXPECT_EQ(x, r);
+  x -= y;
+  EXPECT_EQ(x, x0);
+  x *= 2;
+  x /= 2.0;
+  EXPECT_EQ(x, x0);
+  x += x;
+  EXPECT_EQ(x, x0 * 2.0);
+
+  // views write to storage of their own, reading an alias of themselves
+  Tensor<double> s = x.slice(1, 1, 3);
+  s += 1.0;
+  EXPECT_EQ(x, x0 * 2.0);
+  EXPECT_EQ(s, x.slice(1, 1, 3) + 1.0);
+  auto z = random_tensor<double>({4, 4});
+  Tensor<double> zt = z + z.transpose();
+  z += z.transpose();
+  EXPECT_EQ(z, zt);
+
+  // a result of a larger shape replaces the tensor
+  auto a = random_tensor<double>({4, 1}), b = random_tensor<double>({1, 3});
+  Tensor<double> ab = a * b;
+  a *= b;
+  EXPECT_EQ(a, ab);
+
+  // a temporary operand lends its buffer to the result
+  const double* px = x.data();
+  Tensor<double> t = std::move(x) * 2.0 + y;
+  EXPECT_EQ(t.data(), px);
+  EXPECT_EQ(t, x0 * 4.0 + y);
+  Tensor<double> u = y * 3.0 + std::move(t);
+  EXPECT_EQ(u.data(), px);
+
+  // steady state pipelines get their buffers from the cache
+  auto& alloc = kl::CachingAllocator::instance();
+  Tensor<float> w(Shape({64, 64}), std::vector<float>(64 * 64, 1.0f));
+  for (int i = 0; i < 3; ++i) w = kl::exp(w * 0.5f) - w;
+  const auto misses = alloc.stats().misses;
+  for (int i = 0; i < 10; ++i) {
+    w = kl::exp(w * 0.5f) - w;
+    w = std::move(w) * 0.5f;
+  }
+  EXPECT_EQ(alloc.stats().misses, misses);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(w.data()) % 64, 0u);
+};
+
+TEST(test_shape, size_and_strides) {
+  // sizes beyond 2^31 and strides computed once
+  Shape s{1 << 20, 1 << 12, 3};
+  EXPECT_EQ(s.size(), uint64_t(3) << 32);
+  EXPECT_EQ(s.strides(), std::vector<int64_t>({3 << 12, 3, 1}));
+  s.reshape({3 << 20, 1 << 12});
+  EXPECT_EQ(s.value(), std::vector<uint64_t>({3 << 20, 1 << 12}));
+  EXPECT_EQ(s.strides(), std::vector<int64_t>({1 << 12, 1}));
+  s.extend(0);
+  s.contract(-1);
+  EXPECT_EQ(s, Shape({1, uint64_t(3) << 32}));
+  EXPECT_EQ(s.strides(), std::vector<int64_t>({int64_t(3) << 32, 1}));
+
+  // ranks beyond the inline ones
+  std::vector<uint64_t> dims(11, 1);
+  dims[0] = 2, dims[5] = 3, dims[10] = 4;
+  auto x = random_tensor<double>(dims);
+  EXPECT_EQ(x.shape(), dims);
+  auto y = x.transpose(0, 10).transpose(0, 10);
+  EXPECT_EQ(y, x);
+  EXPECT_EQ(kl::sum(x.squeeze(), {1}), kl::sum(x, {5}).squeeze());
+  EXPECT_EQ(x.reshaped({4, 6}).reshaped(dims), x);
+  EXPECT_EQ((x + x.select(0, 1)).shape(), dims);
+};
+
+// well conditioned (..., n, n) matrices, diagonally dominant
+static Tensor<double> dominant(std::vector<uint64_t> dims) {
+  const uint64_t n = dims.back();
+  auto a = random_tensor<double>(dims);
+  double* p = a.data();
+  for (uint64_t g = 0; g < a.size(); g += n * n)
+    for (uint64_t i = 0; i < n; ++i) p[g + i * (n + 1)] += 10.0 * n;
+  return a;
+}
+
+static double error(const Tensor<double>& x, const Tensor<double>& y) {
+  return kl::norm(x - y).at({0});
+}
+
+TEST(test_linalg, batched) {
+  auto a = dominant({3, 1, 5, 5});
+  auto b = random_tensor<double>({4, 5, 2}), v = random_tensor<double>({5});
+  auto x = kl::solve(a, b);
+  ASSERT_EQ(x.shape(), std::vector<uint64_t>({3, 4, 5, 2}));
+  EXPECT_LT(error(kl::matmul(a, x), b), 1e-10);
+  auto xv = kl::solve(a, v);
+  ASSERT_EQ(xv.shape(), std::vector<uint64_t>({3, 1, 5}));
+  EXPECT_LT(error(kl::matmul(a, xv.unsqueeze(-1)).squeeze(-1), v), 1e-10);
+  // any layout of the operands
+  auto at = a.transpose().clone().transpose();
+  auto bt = b.transpose().clone().transpose();
+  EXPECT_LT(error(kl::solve(at, bt), x), 1e-12);
+  EXPECT_LT(error(kl::solve(a, b.slice(2, 1, 2)), x.slice(3, 1, 2)), 1e-12);
+
+  auto ai = kl::inv(a.transpose());
+  ASSERT_EQ(ai.shape(), a.shape());
+  std::vector<double> e(25, 0.0);
+  for (int i = 0; i < 5; ++i) e[6 * i] = 1.0;
+  const Tensor<double> eye(Shape({5, 5}), e);
+  EXPECT_LT(error(kl::matmul(ai, a.transpose()), eye), 1e-12);
+
+  Tensor<double> m(Shape({2, 2}), {1, 2, 3, 4});
+  EXPECT_DOUBLE_EQ(kl::det(m).at({0}), -2.0);
+  EXPECT_DOUBLE_EQ(kl::det(m.transpose()).at({0}), -2.0);
+  auto c = dominant({3, 5, 5});
+  auto dab = kl::det(kl::matmul(a, c)), da = kl::det(a), dc = kl::det(c);
+  ASSERT_EQ(dab.shape(), std::vector<uint64_t>({3, 3}));
+  EXPECT_LT(kl::norm(dab / (da * dc) - 1.0).at({0}), 1e-12);
+
+  // an exact fit, and the normal equations of a noisy one
+  auto f = random_tensor<double>({2, 9, 3});
+  auto c0 = random_tensor<double>({3, 2});
+  EXPECT_LT(error(kl::lstsq(f, kl::matmul(f, c0)), c0), 1e-9);
+  auto y = random_tensor<double>({9});
+  auto fit = kl::lstsq(f, y);
+  ASSERT_EQ(fit.shape(), std::vector<uint64_t>({2, 3}));
+  Tensor<double> r = kl::matmul(f, fit.unsqueeze(-1)).squeeze(-1) - y;
+  EXPECT_LT(kl::norm(kl::einsum("bij,bi->bj", {f, r})).at({0}), 1e-9);
+  EXPECT_TRUE(kl::lstsq(f.transpose(), y).is_none());
+
+  // monomials up to x^11 on [0, 1] are ill conditioned enough that the
+  // normal equations lose all but a couple of digits
+  const uint64_t rows = 40, deg = 12;
+  Tensor<double> vm(Shape({rows, deg}));
+  for (uint64_t i = 0; i < rows; ++i)
+    for (uint64_t j = 0; j < deg; ++j)
+      vm.data()[i * deg + j] = std::pow((i + 0.5) / rows, double(j));
+  auto cv = random_tensor<double>({deg});
+  auto yv = kl::matmul(vm, cv);
+  EXPECT_LT(error(kl::lstsq(vm, yv), cv), 1e-6);
+  EXPECT_TRUE(kl::solve(f, y).is_none());
+};
+
+TEST(test_linalg, parallel_batches) {
+  // batches across the pool, and a single matrix factored on it
+  const auto threads = kl::tensor_threads();
+  auto a = dominant({8, 40, 40}), s = dominant({150, 150});
+  auto b = random_tensor<double>({8, 40, 3});
+  auto f = random_tensor<double>({8, 90, 40});
+  auto y = random_tensor<double>({8, 90, 2});
+  std::vector<std::vector<Tensor<double>>> res;
+  for (size_t n : {1, 4}) {
+    kl::set_tensor_threads(n);
+    res.push_back({kl::solve(a, b), kl::inv(a), kl::det(a), kl::inv(s),
+                   kl::det(s), kl::lstsq(f, y)});
+  }
+  for (size_t i = 0; i < res[0].size(); ++i)
+    EXPECT_EQ(res[0][i], res[1][i]) << i;
+  kl::set_tensor_threads(threads);
+};
+
+TEST(test_random, threads_and_chunks) {
+  // chunks of their own streams, whatever the threads
+  const auto threads = kl::tensor_threads();
+  const Shape shape({3, kl::random_chunk / 2 + 5});
+  std::vector<Tensor<double>> u, z;
+  std::vector<Tensor<int>> k;
+  for (size_t n : {1, 3}) {
+    kl::set_tensor_threads(n);
+    u.push_back(kl::random_uniform(shape, -2.0, 2.0, 42));
+    z.push_back(kl::random_normal(shape, 0.0, 1.0, 42));
+    k.push_back(kl::random_uniform(shape, -3, 4, 42));
+  }
+  kl::set_tensor_threads(threads);
+  EXPECT_EQ(u[0], u[1]);
+  EXPECT_EQ(z[0], z[1]);
+  EXPECT_EQ(k[0], k[1]);
+  EXPECT_FALSE(u[0] == kl::random_uniform(shape, -2.0, 2.0, 43));
+
+  const double n = shape.size();
+  EXPECT_NEAR(kl::mean(u[0]).at({0}), 0.0, 0.01);
+  EXPECT_NEAR(kl::mean(z[0]).at({0}), 0.0, 0.01);
+  EXPECT_NEAR(kl::norm(z[0]).at({0}) / std::sqrt(n), 1.0, 0.01);
+  EXPECT_LT(kl::max(u[0]).at({0}), 2.0);
+  EXPECT_GE(kl::min(k[0]).at({0}), -3);
+  EXPECT_EQ(kl::max(k[0]).at({0}), 3);
+};
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
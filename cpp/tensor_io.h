@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <complex>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "tensor.h"
+
+// Tensor files
+//
+// save_npy / load_npy read and write the NumPy .npy format (versions 1.0 to
+// 3.0, either byte order, C or Fortran order); save_tensor / load_tensor
+// the native format below. Both load in one of two ways:
+//   copy    the file is mapped and its elements are copied, converted to
+//           the element type if the file holds another, in parallel
+//   mapped  the tensor views a read only mapping of the file, so opening
+//           it costs nothing and only the pages touched are read; writing
+//           to the tensor copies it first (see ReadOnlyStorage). A file of
+//           another element type or byte order is copied instead
+// Element types are bool, the integer and floating point types and
+// std::complex of float and double. A failure returns a None tensor, or
+// false from the savers.
+//
+// The native format, all integers little endian:
+//   0   "KLTENSOR"
+//   8   uint32 version (1)
+//   12  uint32 rank
+//   16  char[8] element type as a .npy descr, e.g. "<f8", NUL padded
+//   24  uint64 elements per chunk
+//   32  uint64 dims[rank]
+//       uint64 checksums[chunks], of the bytes of each chunk
+//       the elements in row major order, from the next multiple of 64
+// The elements are split in chunks of a fixed count, the last one shorter,
+// and each chunk has a checksum that a copying load verifies, in parallel
+// over the chunks; a mapped load does not read the data to verify it.
+namespace kl {
+
+// .npy descr of an element type, "" if it has none
+template <typename T>
+std::string npy_descr() {
+  const char order =
+      (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || sizeof(T) == 1) ? '<'
+                                                                    : '>';
+  if constexpr (std::is_same<T, bool>::value) {
+    return "|b1";
+  } else if constexpr (std::is_integral<T>::value) {
+    return std::string(1, sizeof(T) == 1 ? '|' : order) +
+           (std::is_signed<T>::value ? 'i' : 'u') + std::to_string(sizeof(T));
+  } else if constexpr (std::is_floating_point<T>::value) {
+    return std::string(1, order) + 'f' + std::to_string(sizeof(T));
+  } else if constexpr (std::is_same<T, std::complex<float>>::value ||
+                       std::is_same<T, std::complex<double>>::value) {
+    return std::string(1, order) + 'c' + std::to_string(sizeof(T));
+  } else {
+    return "";
+  }
+}
+
+template <typename T>
+struct is_complex : std::false_type {};
+template <typename T>
+struct is_complex<std::complex<T>> : std::true_type {};
+
+// element type of a file: kind ('b', 'i', 'u', 'f' or 'c'), size in bytes
+// and whether its byte order is not ours
+struct FileDType {
+  char kind = 0;
+  int size = 0;
+  bool swap = false;
+
+  bool parse(const std::string& descr) {
+    if (descr.size() < 3) return false;
+    const char o = descr[0];
+    if (o != '<' && o != '>' && o != '|' && o != '=') return false;
+    kind = descr[1];
+    size = 0;
+    for (size_t i = 2; i < descr.size(); ++i) {
+      if (!isdigit(static_cast<unsigned char>(descr[i])) || size > 64)
+        return false;
+      size = size * 10 + (descr[i] - '0');
+    }
+    const bool little = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+    swap = (size > 1) && ((o == '<' && !little) || (o == '>' && little));
+    return std::string("biufc").find(kind) != std::string::npos && size > 0;
+  }
+  // true if the file holds elements of type T as they are in memory
+  template <typename T>
+  bool is() const {
+    FileDType t;
+    return t.parse(npy_descr<T>()) && t.kind == kind && t.size == size &&
+           !swap;
+  }
+};
+
+// f(S()) with S the element type of dt, false if it is not supported
+template <typename F>
+bool with_file_dtype(const FileDType& dt, F&& f) {
+  switch (dt.kind) {
+    case 'b':
+      return dt.size == 1 && f(bool());
+    case 'i':
+      if (dt.size == 1) return f(int8_t());
+      if (dt.size == 2) return f(int16_t());
+      if (dt.size == 4) return f(int32_t());
+      if (dt.size == 8) return f(int64_t());
+      return false;
+    case 'u':
+      if (dt.size == 1) return f(uint8_t());
+      if (dt.size == 2) return f(uint16_t());
+      if (dt.size == 4) return f(uint32_t());
+      if (dt.size == 8) return f(uint64_t());
+      return false;
+    case 'f':
+      if (dt.size == 4) return f(float());
+      if (dt.size == 8) return f(double());
+      return false;
+    case 'c':
+      if (dt.size == 8) return f(std::complex<float>());
+      if (dt.size == 16) return f(std::complex<double>());
+      return false;
+  }
+  return false;
+}
+
+// the element of type S at p, its bytes (of each part) reversed if swap
+template <typename S>
+S load_element(const char* p, bool swap) {
+  char b[sizeof(S)];
+  std::memcpy(b, p, sizeof(S));
+  if (swap) {
+    constexpr size_t part = is_complex<S>::value ? sizeof(S) / 2 : sizeof(S);
+    for (size_t i = 0; i < sizeof(S); i += part)
+      std::reverse(b + i, b + i + part);
+  }
+  S v;
+  std::memcpy(&v, b, sizeof(S));
+  return v;
+}
+
+// n elements of type dt at src converted into dst, false if dt has no
+// conversion to T; only checks if dst is null
+template <typename T>
+bool convert_elements(const FileDType& dt, const char* src, T* dst,
+                      size_t n) {
+  return with_file_dtype(dt, [&](auto tag) {
+    typedef decltype(tag) S;
+    if constexpr (is_complex<S>::value && !is_complex<T>::value) {
+      return false;
+    } else {
+      if (dst == nullptr) return true;
+      for (size_t i = 0; i < n; ++i) {
+        const S v = load_element<S>(src + i * sizeof(S), dt.swap);
+        if constexpr (is_complex<T>::value && !is_complex<S>::value)
+          dst[i] = T(static_cast<typename T::value_type>(v));
+        else
+          dst[i] = static_cast<T>(v);
+      }
+      return true;
+    }
+  });
+}
+
+// a read only mapping of the whole file at path, null on failure
+inline std::shared_ptr<const char> map_file(const std::string& path,
+                                            size_t& size) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  void* p = MAP_FAILED;
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    size = st.st_size;
+    p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) return nullptr;
+  const size_t len = size;
+  return std::shared_ptr<const char>(
+      static_cast<const char*>(p),
+      [len](const char* q) { ::munmap(const_cast<char*>(q), len); });
+}
+
+// a tensor of dims over the elements of type dt at data, in the mapping
+// map, in row major order or column major if fortran: a view of the mapping
+// if mapped and dt is T, otherwise a contiguous copy
+template <typename T>
+Tensor<T> tensor_from_file(std::shared_ptr<const char> map, const char* data,
+                           const FileDType& dt,
+                           std::vector<Shape::s_type>&& dims, bool fortran,
+                           bool mapped) {
+  // a column major array is the permutation of a row major one
+  std::vector<int> axes(dims.size());
+  for (size_t i = 0; i < axes.size(); ++i) axes[i] = axes.size() - 1 - i;
+  if (fortran) std::reverse(dims.begin(), dims.end());
+  if (dt.is<T>() && reinterpret_cast<uintptr_t>(data) % alignof(T) == 0) {
+    SmallVector<int64_t> strides = row_major_strides(dims);
+    Tensor<T> res(Shape(std::move(dims)), std::move(strides), 0,
+                  typename Tensor<T>::storage_type(
+                      reinterpret_cast<T*>(const_cast<char*>(data)),
+                      ReadOnlyStorage{std::move(map)}));
+    if (fortran) res = res.permute(axes);
+    return mapped ? res : res.clone();
+  }
+  if (!convert_elements<T>(dt, data, nullptr, 0)) return Tensor<T>();
+  Tensor<T> res(Shape(std::move(dims)));
+  T* dst = res.data();
+  tensor_for(tensor_pool_for(res.size()), res.size(),
+             [&](size_t lo, size_t hi) {
+               convert_elements<T>(dt, data + lo * dt.size, dst + lo, hi - lo);
+             });
+  return fortran ? res.permute(axes).contiguous() : res;
+}
+
+// write the elements of t in row major order in chunks of chunk elements,
+// through a buffer if t is not contiguous; f(p, n) sees each chunk first
+template <typename T, typename F>
+bool write_elements(std::FILE* out, const Tensor<T>& t, Shape::s_type chunk,
+                    F&& f) {
+  const Shape::s_type n = t.size();
+  const bool direct = t.is_contiguous();
+  const StridedLoop<1> loop(t.shape(), {t.strides()});
+  std::unique_ptr<T[]> buf(new T[direct ? 0 : std::min(n, chunk)]);
+  const T* src = t.data();
+  for (Shape::s_type lo = 0; lo < n; lo += chunk) {
+    const Shape::s_type hi = std::min(n, lo + chunk);
+    const T* p = src + lo;
+    if (!direct) {
+      T* q = buf.get();
+      loop.run(
+          [&](const StridedLoop<1>::offsets& off, Shape::s_type m,
+              const StridedLoop<1>::offsets& st) {
+            for (Shape::s_type i = 0; i < m; ++i)
+              *q++ = src[off[0] + i * st[0]];
+          },
+          lo, hi);
+      p = buf.get();
+    }
+    f(p, hi - lo);
+    if (std::fwrite(p, sizeof(T), hi - lo, out) != hi - lo) return false;
+  }
+  return true;
+}
+
+// .npy
+
+// save t to path in .npy format, false on failure
+template <typename T>
+bool save_npy(const std::string& path, const Tensor<T>& t) {
+  const std::string descr = npy_descr<T>();
+  if (descr.empty() || t.is_none()) return false;
+  std::string header = "{'descr': '" + descr +
+                       "', 'fortran_order': False, 'shape': (";
+  const auto dims = t.shape();
+  for (size_t i = 0; i < dims.size(); ++i)
+    header += std::to_string(dims[i]) + (i + 1 < dims.size() ? ", " : "");
+  header += (dims.size() == 1) ? ",), }" : "), }";
+  // the data starts at a multiple of 64, the header ends in a newline;
+  // version 2 when the padded header overflows the 16 bit length of 1
+  auto padding = [&](size_t pre) { return 63 - (pre + header.size()) % 64; };
+  const bool v2 = header.size() + padding(10) + 1 > 0xffff;
+  const size_t pre = v2 ? 12 : 10;
+  header.append(padding(pre), ' ');
+  header += '\n';
+
+  std::FILE* out = std::fopen(path.c_str(), "wb");
+  if (out == nullptr) return false;
+  std::string magic("\x93NUMPY", 6);
+  magic += static_cast<char>(v2 ? 2 : 1);
+  magic += '\0';
+  const size_t hl = header.size();
+  for (size_t i = 0; i < pre - 8; ++i)
+    magic += static_cast<char>((hl >> (8 * i)) & 0xff);
+  bool ok = std::fwrite(magic.data(), 1, pre, out) == pre &&
+            std::fwrite(header.data(), 1, hl, out) == hl &&
+            write_elements(out, t, Shape::s_type(1) << 20,
+                           [](const T*, Shape::s_type) {});
+  ok = (std::fclose(out) == 0) && ok;
+  return ok;
+}
+
+// the value of key in a .npy header dict, npos if it has none
+inline size_t npy_field(const std::string& header, const std::string& key) {
+  for (const char q : {'\'', '"'}) {
+    const size_t p = header.find(q + key + q);
+    if (p == std::string::npos) continue;
+    const size_t c = header.find(':', p + key.size() + 2);
+    if (c == std::string::npos) return c;
+    return header.find_first_not_of(" \t", c + 1);
+  }
+  return std::string::npos;
+}
+
+// load a tensor from a .npy file, mapped or copied (see above); a Fortran
+// ordered array is a column major view, an array of rank 0 has shape (1)
+template <typename T>
+Tensor<T> load_npy(const std::string& path, bool mapped = false) {
+  size_t size = 0;
+  auto map = map_file(path, size);
+  if (!map || size < 10 || std::memcmp(map.get(), "\x93NUMPY", 6) != 0)
+    return Tensor<T>();
+  const char* f = map.get();
+  const int major = static_cast<unsigned char>(f[6]);
+  if (major < 1 || major > 3) return Tensor<T>();
+  const size_t pre = (major == 1) ? 10 : 12;
+  if (size < pre) return Tensor<T>();
+  size_t hl = 0;
+  for (size_t i = pre - 1; i >= 8; --i)
+    hl = (hl << 8) | static_cast<unsigned char>(f[i]);
+  if (size < pre + hl) return Tensor<T>();
+  const std::string header(f + pre, hl);
+
+  // 'descr': '<f8', 'fortran_order': False, 'shape': (2, 3)
+  FileDType dt;
+  size_t p = npy_field(header, "descr");
+  if (p == std::string::npos || (header[p] != '\'' && header[p] != '"'))
+    return Tensor<T>();
+  const size_t e = header.find(header[p], p + 1);
+  if (e == std::string::npos || !dt.parse(header.substr(p + 1, e - p - 1)))
+    return Tensor<T>();
+  p = npy_field(header, "fortran_order");
+  if (p == std::string::npos) return Tensor<T>();
+  const bool fortran = header.compare(p, 4, "True") == 0;
+  p = npy_field(header, "shape");
+  if (p == std::string::npos || header[p] != '(') return Tensor<T>();
+  std::vector<Shape::s_type> dims;
+  for (++p; p < header.size() && header[p] != ')';) {
+    if (isdigit(static_cast<unsigned char>(header[p]))) {
+      dims.push_back(std::strtoull(header.c_str() + p, nullptr, 10));
+      p = header.find_first_not_of("0123456789", p);
+    } else if (header[p] == ',' || header[p] == ' ') {
+      ++p;
+    } else {
+      return Tensor<T>();
+    }
+  }
+  if (p >= header.size()) return Tensor<T>();
+  if (dims.empty()) dims.push_back(1);
+
+  // the elements must fit in the file
+  Shape::s_type n = 1;
+  for (auto d : dims) {
+    if (d != 0 && n > (size - pre - hl) / d) return Tensor<T>();
+    n *= d;
+  }
+  if (n * dt.size > size - pre - hl) return Tensor<T>();
+  return tensor_from_file<T>(std::move(map), f + pre + hl, dt,
+                             std::move(dims), fortran, mapped);
+}
+
+// native format
+
+// FNV-1a over 64 bit words, then the remaining bytes
+inline uint64_t chunk_checksum(const char* p, size_t bytes) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; i + 8 <= bytes; i += 8) {
+    uint64_t w;
+    std::memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0x100000001b3ull;
+  }
+  for (; i < bytes; ++i)
+    h = (h ^ static_cast<unsigned char>(p[i])) * 0x100000001b3ull;
+  return h;
+}
+
+inline void put_le(std::string& s, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    s += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+inline uint64_t get_le(const char* p, int bytes) {
+  uint64_t v = 0;
+  for (int i = bytes; i-- > 0;)
+    v = (v << 8) | static_cast<unsigned char>(p[i]);
+  return v;
+}
+
+// save t to path in the native format with chunks of about chunk_bytes,
+// false on failure
+template <typename T>
+bool save_tensor(const std::string& path, const Tensor<T>& t,
+                 size_t chunk_bytes = size_t(1) << 22) {
+  const std::string descr = npy_descr<T>();
+  if (descr.empty() || t.is_none()) return false;
+  const auto dims = t.shape();
+  const Shape::s_type n = t.size();
+  const Shape::s_type chunk = std::max<size_t>(1, chunk_bytes / sizeof(T));
+  const Shape::s_type chunks = (n + chunk - 1) / chunk;
+  std::string header("KLTENSOR");
+  put_le(header, 1, 4);
+  put_le(header, dims.size(), 4);
+  header += descr;
+  header.append(8 - descr.size(), '\0');
+  put_le(header, chunk, 8);
+  for (auto d : dims) put_le(header, d, 8);
+  const size_t sums = header.size();
+  header.append(8 * chunks, '\0');
+  header.append((64 - header.size() % 64) % 64, '\0');
+
+  std::FILE* out = std::fopen(path.c_str(), "wb");
+  if (out == nullptr) return false;
+  std::string checksums;
+  bool ok = std::fwrite(header.data(), 1, header.size(), out) ==
+                header.size() &&
+            write_elements(out, t, chunk, [&](const T* p, Shape::s_type m) {
+              put_le(checksums,
+                     chunk_checksum(reinterpret_cast<const char*>(p),
+                                    m * sizeof(T)),
+                     8);
+            });
+  ok = ok && std::fseek(out, sums, SEEK_SET) == 0 &&
+       std::fwrite(checksums.data(), 1, checksums.size(), out) ==
+           checksums.size();
+  ok = (std::fclose(out) == 0) && ok;
+  return ok;
+}
+
+// load a tensor saved by save_tensor, mapped or copied (see above)
+template <typename T>
+Tensor<T> load_tensor(const std::string& path, bool mapped = false) {
+  size_t size = 0;
+  auto map = map_file(path, size);
+  if (!map || size < 32 || std::memcmp(map.get(), "KLTENSOR", 8) != 0)
+    return Tensor<T>();
+  const char* f = map.get();
+  const uint64_t rank = get_le(f + 12, 4);
+  FileDType dt;
+  if (get_le(f + 8, 4) != 1 || rank < 1 ||
+      !dt.parse(std::string(f + 16, strnlen(f + 16, 8))))
+    return Tensor<T>();
+  uint64_t chunk = get_le(f + 24, 8);
+  if (chunk < 1 || size < 32 + 8 * rank) return Tensor<T>();
+  std::vector<Shape::s_type> dims(rank);
+  Shape::s_type n = 1;
+  for (uint64_t i = 0; i < rank; ++i) {
+    dims[i] = get_le(f + 32 + 8 * i, 8);
+    if (dims[i] != 0 && n > size / dims[i]) return Tensor<T>();
+    n *= dims[i];
+  }
+  // a chunk longer than the data holds all of it; clamped, the chunk
+  // arithmetic below cannot wrap
+  chunk = std::min<uint64_t>(chunk, std::max<Shape::s_type>(n, 1));
+  const Shape::s_type chunks = (n + chunk - 1) / chunk;
+  const size_t sums = 32 + 8 * rank;
+  if (chunks > size / 8) return Tensor<T>();
+  const size_t begin = (sums + 8 * chunks + 63) / 64 * 64;
+  if (begin > size || n * dt.size > size - begin) return Tensor<T>();
+  const char* data = f + begin;
+
+  if (!(mapped && dt.is<T>())) {
+    std::atomic<bool> ok{true};
+    auto verify = [&](size_t lo, size_t hi) {
+      for (size_t c = lo; c < hi && ok; ++c) {
+        const size_t bytes =
+            (std::min(n, (c + 1) * chunk) - c * chunk) * dt.size;
+        if (chunk_checksum(data + c * chunk * dt.size, bytes) !=
+            get_le(f + sums + 8 * c, 8))
+          ok = false;
+      }
+    };
+    ThreadPool* pool = tensor_pool_for(n);
+    if (pool != nullptr)
+      parallel_for(*pool, 0, chunks, 1, verify);
+    else
+      verify(0, chunks);
+    if (!ok) return Tensor<T>();
+  }
+  return tensor_from_file<T>(std::move(map), data, dt, std::move(dims),
+                             false, mapped);
+}
+
+}  // namespace kl
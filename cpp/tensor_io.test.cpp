@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "tensor_io.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+#include "utils.h"
+
+using kl::Shape;
+using kl::Tensor;
+
+Rand rng(82 + time(nullptr));
+
+template <typename T>
+Tensor<T> random_tensor(std::vector<uint64_t> dims) {
+  std::vector<T> v(Shape(dims).size());
+  for (auto& x : v) x = static_cast<T>(rng.uniform<int32_t>(-99, 99));
+  return Tensor<T>(Shape(std::move(dims)), v);
+}
+
+template <typename T, typename S>
+Tensor<T> cast(const Tensor<S>& t) {
+  const Tensor<S> c = t.contiguous();
+  Tensor<T> res(Shape(t.shape()));
+  T* dst = res.data();
+  for (uint64_t i = 0; i < t.size(); ++i)
+    dst[i] = static_cast<T>(c.data()[i]);
+  return res;
+}
+
+static std::string temp_path(const std::string& name) {
+  return ::testing::TempDir() + "kl_tensor_io_" + name;
+}
+
+static std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+static void write_file(const std::string& path, const std::string& s) {
+  std::ofstream(path, std::ios::binary) << s;
+}
+
+template <typename T>
+void round_trip(const Tensor<T>& t) {
+  const std::string npy = temp_path("t.npy"), kl = temp_path("t.klt");
+  ASSERT_TRUE(kl::save_npy(npy, t));
+  ASSERT_TRUE(kl::save_tensor(kl, t, 40));
+  for (bool mapped : {false, true}) {
+    EXPECT_EQ(kl::load_npy<T>(npy, mapped), t);
+    EXPECT_EQ(kl::load_tensor<T>(kl, mapped), t);
+    EXPECT_EQ(kl::load_npy<T>(npy, mapped).is_read_only(), mapped);
+  }
+}
+
+TEST(test_tensor_io, round_trip) {
+  round_trip(random_tensor<double>({3, 4, 5}));
+  round_trip(random_tensor<float>({7}));
+  round_trip(random_tensor<int>({2, 1, 9}));
+  round_trip(random_tensor<uint8_t>({13, 3}));
+  round_trip(random_tensor<int64_t>({4, 4}).transpose());
+  round_trip(random_tensor<double>({6, 8}).slice(1, 1, 7, 2));
+  round_trip(cast<bool>(Tensor<int>(Shape({2, 3}), {1, 0, 0, 1, 1, 0})));
+  round_trip(Tensor<std::complex<double>>(Shape({2}), {{1, 2}, {-3, 0.5}}));
+
+  // numpy's layout of the header
+  auto t = random_tensor<int>({2, 3});
+  const std::string path = temp_path("h.npy");
+  ASSERT_TRUE(kl::save_npy(path, t));
+  const std::string s = read_file(path);
+  ASSERT_EQ(s.size(), 128u + 6 * 4);
+  EXPECT_EQ(s.substr(0, 8), std::string("\x93NUMPY\x01\x00", 8));
+  EXPECT_EQ(s.substr(10, 50),
+            "{'descr': '<i4', 'fortran_order': False, 'shape': ");
+  EXPECT_EQ(s[127], '\n');
+
+  // version 1 as long as the padded header length fits in 16 bits
+  for (const uint64_t rank : {21824, 21825}) {
+    Tensor<double> u(Shape(std::vector<uint64_t>(rank, 1)), {2.5});
+    ASSERT_TRUE(kl::save_npy(path, u));
+    const std::string h = read_file(path);
+    const size_t pre = (rank == 21824) ? 10 : 12;
+    EXPECT_EQ(h[6], pre == 10 ? 1 : 2);
+    EXPECT_EQ(h.size(), pre == 10 ? 65536u + 8 : 65600u + 8);
+    EXPECT_EQ(h[h.size() - 9], '\n');
+    EXPECT_EQ(kl::load_npy<double>(path), u);
+  }
+};
+
+TEST(test_tensor_io, npy_layouts) {
+  // a big endian, Fortran ordered (2, 3) array of 1..6 in row major order
+  std::string h =
+      "{'descr': '>i4', 'fortran_order': True, 'shape': (2, 3), }";
+  h.append(128 - 10 - h.size() - 1, ' ');
+  h += '\n';
+  std::string s = std::string("\x93NUMPY\x01\x00", 8) +
+                  static_cast<char>(h.size()) + '\0' + h;
+  for (int v : {1, 4, 2, 5, 3, 6}) s += std::string("\0\0\0", 3) + char(v);
+  const std::string path = temp_path("be.npy");
+  write_file(path, s);
+
+  const Tensor<int> want(Shape({2, 3}), {1, 2, 3, 4, 5, 6});
+  for (bool mapped : {false, true}) {
+    auto a = kl::load_npy<int>(path, mapped);
+    EXPECT_EQ(a, want);
+    EXPECT_TRUE(a.is_contiguous());
+    EXPECT_FALSE(a.is_read_only());
+    EXPECT_EQ(kl::load_npy<double>(path, mapped), cast<double>(want));
+  }
+
+  // the same as little endian, mapped as a column major view
+  s[10 + 11] = '<';
+  for (size_t i = 128; i < s.size(); i += 4)
+    std::reverse(s.begin() + i, s.begin() + i + 4);
+  write_file(path, s);
+  auto b = kl::load_npy<int>(path, true);
+  EXPECT_EQ(b, want);
+  EXPECT_TRUE(b.is_read_only());
+  EXPECT_EQ(b.strides(), std::vector<int64_t>({1, 2}));
+
+  // no conversion from complex, nor from a truncated file
+  EXPECT_TRUE(kl::load_npy<double>(path + ".none").is_none());
+  write_file(path, s.substr(0, s.size() - 1));
+  EXPECT_TRUE(kl::load_npy<int>(path).is_none());
+  auto c = Tensor<std::complex<float>>(Shape({1}), {{1, 1}});
+  ASSERT_TRUE(kl::save_npy(path, c));
+  EXPECT_TRUE(kl::load_npy<float>(path).is_none());
+};
+
+TEST(test_tensor_io, mapped_copy_on_write) {
+  auto t = random_tensor<double>({100, 30});
+  const std::string path = temp_path("cow.klt");
+  ASSERT_TRUE(kl::save_tensor(path, t, 1000));
+
+  auto a = kl::load_tensor<double>(path, true);
+  ASSERT_TRUE(a.is_read_only());
+  Tensor<double> v = a.slice(0, 10, 20);
+  EXPECT_EQ(v, t.slice(0, 10, 20));
+  a += 1.0;
+  v *= 2.0;
+  EXPECT_FALSE(a.is_read_only());
+  EXPECT_EQ(a, t + 1.0);
+  EXPECT_EQ(v, t.slice(0, 10, 20) * 2.0);
+  Tensor<double> w = kl::load_tensor<double>(path, true) * 3.0;
+  EXPECT_EQ(w, t * 3.0);
+  EXPECT_EQ(kl::load_tensor<double>(path), t);
+  EXPECT_EQ(kl::load_tensor<float>(path, true), cast<float>(t));
+
+  // a corrupt chunk fails the checks of a copy, not the mapped view
+  std::string s = read_file(path);
+  s[s.size() - 100] ^= 1;
+  write_file(path, s);
+  EXPECT_TRUE(kl::load_tensor<double>(path).is_none());
+  EXPECT_FALSE(kl::load_tensor<double>(path, true).is_none());
+  write_file(path, s.substr(0, s.size() - 8));
+  EXPECT_TRUE(kl::load_tensor<double>(path, true).is_none());
+
+  // a chunk longer than the data is one chunk, its checksum still checked
+  ASSERT_TRUE(kl::save_tensor(path, t));
+  s = read_file(path);
+  s.replace(24, 8, std::string(8, '\xff'));
+  write_file(path, s);
+  EXPECT_EQ(kl::load_tensor<double>(path), t);
+  s[s.size() - 100] ^= 1;
+  write_file(path, s);
+  EXPECT_TRUE(kl::load_tensor<double>(path).is_none());
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
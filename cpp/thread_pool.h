@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kl {
+// work-stealing thread pool
+// a pool of size n runs n - 1 worker threads, the thread waiting on a job
+// is the n-th one and executes queued tasks while it waits, so a pool of size
+// 1 runs everything serially on the calling thread
+class ThreadPool final {
+ public:
+  typedef std::function<void()> task_type;
+
+  explicit ThreadPool(size_t num_threads = std::thread::hardware_concurrency())
+      : size_{num_threads > 0 ? num_threads : 1}, stop_{false}, pending_{0} {
+    for (size_t i = 0; i < size_; ++i)
+      queues_.emplace_back(std::make_unique<Queue>());
+    for (size_t i = 1; i < size_; ++i)
+      workers_.emplace_back([this, i] { this->work(i); });
+  }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lk(sleep_m_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_) w.join();
+  }
+
+  size_t size() const noexcept { return size_; }
+
+  // a worker pushes onto its own queue, any other thread onto queue 0
+  void submit(task_type task) {
+    Queue& q = *queues_[self()];
+    {
+      std::lock_guard<std::mutex> lk(q.m);
+      q.tasks.push_back(std::move(task));
+    }
+    pending_.fetch_add(1, std::memory_order_release);
+    { std::lock_guard<std::mutex> lk(sleep_m_); }
+    cv_.notify_one();
+  }
+
+  // pop own work LIFO, otherwise steal the oldest task of another queue
+  bool run_one() {
+    const size_t me = self();
+    task_type task;
+    for (size_t k = 0; k < size_; ++k) {
+      Queue& q = *queues_[(me + k) % size_];
+      std::lock_guard<std::mutex> lk(q.m);
+      if (q.tasks.empty()) continue;
+      if (k == 0) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+      break;
+    }
+    if (!task) return false;
+    pending_.fetch_sub(1, std::memory_order_acq_rel);
+    task();
+    return true;
+  }
+
+  // help with queued tasks until done() holds
+  template <typename Pred>
+  void wait_until(Pred done) {
+    while (!done()) {
+      if (!run_one()) std::this_thread::yield();
+    }
+  }
+
+ private:
+  struct Queue {
+    std::mutex m;
+    std::deque<task_type> tasks;
+  };
+
+  size_t self() const noexcept {
+    return (owner() == this) ? index() : 0;
+  }
+  static const ThreadPool*& owner() {
+    static thread_local const ThreadPool* pool = nullptr;
+    return pool;
+  }
+  static size_t& index() {
+    static thread_local size_t idx = 0;
+    return idx;
+  }
+
+  void work(size_t idx) {
+    owner() = this;
+    index() = idx;
+    while (true) {
+      if (run_one()) continue;
+      std::unique_lock<std::mutex> lk(sleep_m_);
+      cv_.wait(lk, [this] {
+        return stop_ || pending_.load(std::memory_order_acquire) > 0;
+      });
+      if (stop_) return;
+    }
+  }
+
+  const size_t size_;
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+  bool stop_;
+  std::atomic<size_t> pending_;
+  std::mutex sleep_m_;
+  std::condition_variable cv_;
+};
+
+// a DAG of tasks, a task is scheduled as soon as all of its dependencies
+// finished; the first exception thrown by a task is rethrown by run(), and
+// the tasks that depend on a failed task, directly or not, are skipped
+class TaskGraph final {
+ public:
+  typedef size_t task_id;
+
+  task_id add(std::function<void()> fn,
+              std::initializer_list<task_id> deps = {}) {
+    return this->add(std::move(fn), std::vector<task_id>(deps));
+  }
+
+  task_id add(std::function<void()> fn, const std::vector<task_id>& deps) {
+    const task_id id = nodes_.size();
+    nodes_.emplace_back();
+    Node& node = nodes_.back();
+    node.fn = std::move(fn);
+    node.num_deps = deps.size();
+    for (auto d : deps) nodes_[d].succ.push_back(id);
+    return id;
+  }
+
+  size_t size() const noexcept { return nodes_.size(); }
+
+  void run(ThreadPool& pool) {
+    std::atomic<size_t> done{0};
+    std::exception_ptr err;
+    std::mutex err_m;
+    for (auto& node : nodes_) {
+      node.pending.store(node.num_deps);
+      node.skipped.store(false);
+    }
+
+    std::function<void(task_id)> launch = [&](task_id id) {
+      pool.submit([&, id] {
+        Node& node = nodes_[id];
+        bool failed = node.skipped.load(std::memory_order_relaxed);
+        if (!failed) {
+          try {
+            node.fn();
+          } catch (...) {
+            failed = true;
+            std::lock_guard<std::mutex> lk(err_m);
+            if (!err) err = std::current_exception();
+          }
+        }
+        for (auto s : node.succ) {
+          // published to s by the acq_rel decrement below
+          if (failed) nodes_[s].skipped.store(true, std::memory_order_relaxed);
+          if (nodes_[s].pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            launch(s);
+        }
+        done.fetch_add(1, std::memory_order_release);
+      });
+    };
+    for (task_id id = 0; id < nodes_.size(); ++id) {
+      if (nodes_[id].num_deps == 0) launch(id);
+    }
+    pool.wait_until([&] {
+      return done.load(std::memory_order_acquire) == nodes_.size();
+    });
+    if (err) std::rethrow_exception(err);
+  }
+
+ private:
+  struct Node {
+    std::function<void()> fn;
+    std::vector<task_id> succ;
+    size_t num_deps = 0;
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> skipped{false};
+  };
+  std::deque<Node> nodes_;
+};
+
+// call f(lo, hi) on consecutive chunks of [begin, end) of at most grain items
+// the chunking only depends on grain, never on which thread runs a chunk
+template <typename F>
+void parallel_for(ThreadPool& pool, size_t begin, size_t end, size_t grain,
+                  F&& f) {
+  if (end <= begin) return;
+  if (grain < 1) grain = 1;
+  const size_t num_chunks = (end - begin + grain - 1) / grain;
+  if (num_chunks < 2 || pool.size() < 2) {
+    for (size_t lo = begin; lo < end; lo += grain)
+      f(lo, std::min(lo + grain, end));
+    return;
+  }
+  std::atomic<size_t> done{0};
+  std::exception_ptr err;
+  std::mutex err_m;
+  for (size_t c = 0; c < num_chunks; ++c) {
+    const size_t lo = begin + c * grain, hi = std::min(lo + grain, end);
+    pool.submit([&, lo, hi] {
+      try {
+        f(lo, hi);
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(err_m);
+        if (!err) err = std::current_exception();
+      }
+      done.fetch_add(1, std::memory_order_release);
+    });
+  }
+  pool.wait_until(
+      [&] { return done.load(std::memory_order_acquire) == num_chunks; });
+  if (err) std::rethrow_exception(err);
+}
+
+}  // namespace kl
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) [2023] Minh v. Duong; dvminh82@gmail.com
+ *
+ * You are free to use, modify, re-distribute this code at your own risk.
+ */
+#include "thread_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+using kl::TaskGraph;
+using kl::ThreadPool;
+
+TEST(test_graph, respects_dependencies) {
+  ThreadPool pool(4);
+  for (int rep = 0; rep < 20; ++rep) {
+    const int n = 64;
+    std::vector<int> order(n, -1);
+    std::atomic<int> clock{0};
+    TaskGraph graph;
+    // a chain of fans: task i depends on task i - 1 and i - 2
+    for (int i = 0; i < n; ++i) {
+      std::vector<TaskGraph::task_id> deps;
+      if (i > 0) deps.push_back(i - 1);
+      if (i > 1) deps.push_back(i - 2);
+      graph.add([&, i] { order[i] = clock++; }, deps);
+    }
+    graph.run(pool);
+    for (int i = 1; i < n; ++i) ASSERT_LT(order[i - 1], order[i]);
+  }
+};
+
+TEST(test_graph, rethrows) {
+  ThreadPool pool(2);
+  TaskGraph graph;
+  std::atomic<int> ran{0};
+  auto a = graph.add([] { throw std::runtime_error("boom"); });
+  auto b = graph.add([&] { ran += 1; }, {a});
+  graph.add([&] { ran += 10; }, {b});  // skipped through b
+  auto c = graph.add([&] { ran += 100; });
+  graph.add([&] { ran += 1000; }, {c});
+  EXPECT_THROW(graph.run(pool), std::runtime_error);
+  EXPECT_EQ(ran, 1100);  // only the tasks that do not depend on a
+};
+
+TEST(test_parallel_for, covers_range) {
+  for (size_t nt : {1, 3, 8}) {
+    ThreadPool pool(nt);
+    std::vector<int> hit(1000, 0);
+    kl::parallel_for(pool, 0, hit.size(), 7, [&](size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; ++i) hit[i] += 1;
+    });
+    EXPECT_EQ(std::accumulate(hit.begin(), hit.end(), 0), 1000);
+  }
+};
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
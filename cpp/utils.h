@@ -5,23 +5,550 @@
  */
 #pragma once
 
-#include <random>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <type_traits>
+
+#include "simd.h"
+
+namespace kl {
+inline uint64_t splitmix64(uint64_t& x) {
+  uint64_t z = (x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+// xoshiro256++ of Blackman and Vigna: 256 bits of state, a period of
+// 2^256 - 1; jump() and long_jump() skip 2^128 and 2^192 values, which
+// splits the period into independent streams
+class Xoshiro256pp final {
+ public:
+  typedef uint64_t result_type;
+  typedef std::array<uint64_t, 4> state_type;
+
+  explicit Xoshiro256pp(uint64_t seed = 0) noexcept {
+    for (auto& s : s_) s = splitmix64(seed);
+  }
+  // a state of all zeros is not allowed
+  explicit Xoshiro256pp(const state_type& s) noexcept : s_(s) {}
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return ~uint64_t(0); }
+
+  uint64_t operator()() noexcept {
+    const uint64_t res = rotl(s_[0] + s_[3], 23) + s_[0];
+    const uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+    return res;
+  }
+
+  void jump() noexcept {
+    this->apply({0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa,
+                 0x39abdc4529b1661c});
+  }
+  void long_jump() noexcept {
+    this->apply({0x76e15d3efefdcbbf, 0xc5004e441c522fb3, 0x77710069854ee241,
+                 0x39109bb02acbe635});
+  }
+
+  const state_type& state() const noexcept { return s_; }
+
+ private:
+  static uint64_t rotl(uint64_t x, int k) noexcept {
+    return (x << k) | (x >> (64 - k));
+  }
+  // the state after 2^k steps is a polynomial in the transition matrix
+  void apply(const state_type& poly) noexcept {
+    state_type t{0, 0, 0, 0};
+    for (uint64_t p : poly) {
+      for (int b = 0; b < 64; ++b) {
+        if ((p >> b) & 1)
+          for (int k = 0; k < 4; ++k) t[k] ^= s_[k];
+        (*this)();
+      }
+    }
+    s_ = t;
+  }
+
+  state_type s_;
+};
+
+// Philox4x32-10 of Salmon et al.: the i-th block of 128 bits is a keyed
+// bijection of the counter (i, stream), so any position of any stream is
+// reached in O(1); the key is the seed
+class Philox4x32 final {
+ public:
+  typedef uint64_t result_type;
+  typedef std::array<uint32_t, 4> ctr_type;
+  typedef std::array<uint32_t, 2> key_type;
+
+  static constexpr uint32_t M0 = 0xd2511f53, M1 = 0xcd9e8d57;
+  static constexpr uint32_t W0 = 0x9e3779b9, W1 = 0xbb67ae85;
+
+  static ctr_type block(ctr_type c, key_type k) noexcept {
+    for (int r = 0; r < 10; ++r) {
+      if (r > 0) k[0] += W0, k[1] += W1;
+      const uint64_t p0 = uint64_t(M0) * c[0], p1 = uint64_t(M1) * c[2];
+      c = {uint32_t(p1 >> 32) ^ c[1] ^ k[0], uint32_t(p1),
+           uint32_t(p0 >> 32) ^ c[3] ^ k[1], uint32_t(p0)};
+    }
+    return c;
+  }
+
+  explicit Philox4x32(uint64_t seed = 0, uint64_t stream = 0) noexcept
+      : seed_{seed}, stream_{stream}, pos_{0} {}
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return ~uint64_t(0); }
+
+  // two values per block, the low then the high 64 bits
+  uint64_t operator()() noexcept {
+    if (pos_ % 2 == 0) buf_ = this->block_at(pos_ / 2);
+    const uint64_t h = pos_++ % 2;
+    return uint64_t(buf_[2 * h + 1]) << 32 | buf_[2 * h];
+  }
+  void discard(uint64_t n) noexcept {
+    pos_ += n;
+    if (pos_ % 2 == 1) buf_ = this->block_at(pos_ / 2);
+  }
+  uint64_t position() const noexcept { return pos_; }
+
+ private:
+  ctr_type block_at(uint64_t i) const noexcept {
+    return block({uint32_t(i), uint32_t(i >> 32), uint32_t(stream_),
+                  uint32_t(stream_ >> 32)},
+                 {uint32_t(seed_), uint32_t(seed_ >> 32)});
+  }
+
+  uint64_t seed_, stream_, pos_;
+  ctr_type buf_{};
+};
+
+// Bulk generation runs eight generators side by side in the lanes of a
+// 512 bit vector, compiled for AVX-512 and AVX2 (as two halves) and picked
+// at runtime like the kernels of simd.h; the values drawn do not depend on
+// the ISA. Integers in [0, n) come from Lemire's multiply and shift, which
+// rejects the few products that would bias the result; the threshold costs
+// one division per call, not one per value. Normals come from Box-Muller
+// in pairs.
+
+#define KL_RAND_INLINE inline __attribute__((always_inline))
+
+// as in simd.h, vectors go in and out of functions by reference
+
+typedef simd::vec<uint64_t, 64>::type u64x8;
+typedef simd::vec<int64_t, 64>::type i64x8;
+typedef simd::vec<double, 64>::type f64x8;
+
+// eight xoshiro256++ streams, lane k starting k + 1 jumps after the
+// generator it is made from
+struct XoshiroLanes {
+  uint64_t s[4][8];
+
+  XoshiroLanes() = default;
+  explicit XoshiroLanes(Xoshiro256pp g) noexcept {
+    for (int k = 0; k < 8; ++k) {
+      g.jump();
+      for (int j = 0; j < 4; ++j) s[j][k] = g.state()[j];
+    }
+  }
+
+  struct Vec {
+    u64x8 s0, s1, s2, s3;
+    explicit Vec(const XoshiroLanes& l) noexcept {
+      memcpy(&s0, l.s[0], 64);
+      memcpy(&s1, l.s[1], 64);
+      memcpy(&s2, l.s[2], 64);
+      memcpy(&s3, l.s[3], 64);
+    }
+    void store(XoshiroLanes& l) const noexcept {
+      memcpy(l.s[0], &s0, 64);
+      memcpy(l.s[1], &s1, 64);
+      memcpy(l.s[2], &s2, 64);
+      memcpy(l.s[3], &s3, 64);
+    }
+    KL_RAND_INLINE void next(u64x8& res) noexcept {
+      const u64x8 a = s0 + s3;
+      res = ((a << 23) | (a >> 41)) + s0;
+      const u64x8 t = s1 << 17;
+      s2 ^= s0;
+      s3 ^= s1;
+      s1 ^= s2;
+      s0 ^= s3;
+      s2 ^= t;
+      s3 = (s3 << 45) | (s3 >> 19);
+    }
+  };
+};
+
+// philox4x32 on eight consecutive blocks of a stream per step; lane k
+// first gives the low, then the high 64 bits of block `block + k`
+struct PhiloxLanes {
+  uint64_t seed = 0, stream = 0, block = 0;
+
+  struct Vec {
+    uint64_t seed, stream, block;
+    u64x8 high{};
+    bool pending = false;
+    explicit Vec(const PhiloxLanes& l) noexcept
+        : seed{l.seed}, stream{l.stream}, block{l.block} {}
+    void store(PhiloxLanes& l) const noexcept { l.block = block; }
+    KL_RAND_INLINE void next(u64x8& res) noexcept {
+      if (pending) {
+        pending = false;
+        res = high;
+        return;
+      }
+      const u64x8 lo = u64x8{} + uint64_t(0xffffffff);
+      const u64x8 ctr = u64x8{0, 1, 2, 3, 4, 5, 6, 7} + block;
+      block += 8;
+      u64x8 c0 = ctr & lo, c1 = ctr >> 32;
+      u64x8 c2 = u64x8{} + (stream & 0xffffffff);
+      u64x8 c3 = u64x8{} + (stream >> 32);
+      uint32_t k0 = uint32_t(seed), k1 = uint32_t(seed >> 32);
+#pragma GCC unroll 10
+      for (int r = 0; r < 10; ++r) {
+        if (r > 0) k0 += Philox4x32::W0, k1 += Philox4x32::W1;
+        const u64x8 p0 = c0 * uint64_t(Philox4x32::M0);
+        const u64x8 p1 = c2 * uint64_t(Philox4x32::M1);
+        c0 = (p1 >> 32) ^ c1 ^ uint64_t(k0);
+        c1 = p1 & lo;
+        c2 = (p0 >> 32) ^ c3 ^ uint64_t(k1);
+        c3 = p0 & lo;
+      }
+      high = c2 | (c3 << 32);
+      pending = true;
+      res = c0 | (c1 << 32);
+    }
+  };
+};
+
+// o[0, n) = v, converted, the first n lanes of v
+template <typename T, typename V>
+KL_RAND_INLINE void store_lanes(T* o, const V& v, size_t n) {
+  typedef typename simd::vec<T, 8 * sizeof(T)>::type TV;
+  const TV c = __builtin_convertvector(v, TV);
+  if (n == 8)
+    memcpy(o, &c, sizeof(c));
+  else
+    memcpy(o, &c, n * sizeof(T));
+}
+
+// 53 random bits as a double in [0, 1)
+KL_RAND_INLINE void unit_lanes(const u64x8& v, f64x8& u) {
+  u = __builtin_convertvector((i64x8)(v >> 11), f64x8) * 0x1.0p-53;
+}
+
+// sqrt(x) for x >= 0 by Newton's iteration on 1 / sqrt(x) from a guess
+// out of the exponent bits, to a few ulp; std::sqrt sets errno and so stays
+// a scalar call
+KL_RAND_INLINE void sqrt_lanes(const f64x8& x, f64x8& r) {
+  f64x8 y = (f64x8)(0x5fe6eb50c7b537a9 - ((i64x8)x >> 1));
+  const f64x8 h = 0.5 * x;
+#pragma GCC unroll 4
+  for (int k = 0; k < 4; ++k) y = y * (1.5 - h * y * y);
+  r = x * y;
+}
+
+// sin and cos of 2 pi t for t in [0, 1): t = q / 4 + f with |f| <= 1 / 8
+// and the Taylor series of 2 pi f on [-pi / 4, pi / 4]
+KL_RAND_INLINE void sincos_2pi(const f64x8& t, f64x8& s, f64x8& c) {
+  const i64x8 q = __builtin_convertvector(t * 4.0 + 0.5, i64x8);
+  const f64x8 x = (t - __builtin_convertvector(q, f64x8) * 0.25) *
+                  6.283185307179586;
+  const f64x8 z = x * x;
+  // (-1)^k / (2k + 1)! and (-1)^k / (2k)! from k = 8 down to 0
+  constexpr double cs[] = {1 / 355687428096000.0, -1 / 1307674368000.0,
+                           1 / 6227020800.0,      -1 / 39916800.0,
+                           1 / 362880.0,          -1 / 5040.0,
+                           1 / 120.0,             -1 / 6.0,
+                           1.0};
+  constexpr double cc[] = {1 / 20922789888000.0, -1 / 87178291200.0,
+                           1 / 479001600.0,      -1 / 3628800.0,
+                           1 / 40320.0,          -1 / 720.0,
+                           1 / 24.0,             -1 / 2.0,
+                           1.0};
+  f64x8 ps = f64x8{} + cs[0], pc = f64x8{} + cc[0];
+#pragma GCC unroll 8
+  for (int k = 1; k < 9; ++k) {
+    ps = ps * z + cs[k];
+    pc = pc * z + cc[k];
+  }
+  const f64x8 sx = ps * x, cx = pc;
+  const i64x8 m = q & 3;
+  s = (m == 0) ? sx : (m == 1) ? cx : (m == 2) ? -sx : -cx;
+  c = (m == 0) ? cx : (m == 1) ? -sx : (m == 2) ? -cx : sx;
+}
+
+struct BitsKernel {
+  uint64_t* o;
+  size_t n;
+  template <typename G>
+  KL_RAND_INLINE void operator()(G& g) const {
+    u64x8 v;
+    for (size_t i = 0; i < n; i += 8) {
+      g.next(v);
+      store_lanes(o + i, v, std::min<size_t>(8, n - i));
+    }
+  }
+};
+
+// lo + [0, bound) for 0 < bound
+template <typename T>
+struct UniformIntKernel {
+  T* o;
+  size_t n;
+  T lo;
+  uint64_t bound;
+  template <typename G>
+  KL_RAND_INLINE void operator()(G& g) const {
+    if (bound > (uint64_t(1) << 32)) return this->wide(g);
+    const u64x8 mask = u64x8{} + uint64_t(0xffffffff);
+    const u64x8 t = u64x8{} + ((uint64_t(1) << 32) - bound) % bound;
+    size_t i = 0;
+    u64x8 v;
+    while (i < n) {
+      g.next(v);
+      const u64x8 m0 = (v & mask) * bound, m1 = (v >> 32) * bound;
+      const u64x8 r0 = (m0 >> 32) + uint64_t(lo);
+      const u64x8 r1 = (m1 >> 32) + uint64_t(lo);
+      // the top bit of l - t is set where the low half l is below t
+      u64x8 bad = ((m0 & mask) - t) | ((m1 & mask) - t);
+      bad |= __builtin_shuffle(bad, u64x8{4, 5, 6, 7, 0, 1, 2, 3});
+      bad |= __builtin_shuffle(bad, u64x8{2, 3, 0, 1, 6, 7, 4, 5});
+      bad |= __builtin_shuffle(bad, u64x8{1, 0, 3, 2, 5, 4, 7, 6});
+      if ((bad[0] >> 63) == 0 && i + 16 <= n) {
+        store_lanes(o + i, r0, 8);
+        store_lanes(o + i + 8, r1, 8);
+        i += 16;
+        continue;
+      }
+      for (int k = 0; k < 8 && i < n; ++k)
+        if ((m0[k] & 0xffffffff) >= t[0]) o[i++] = T(r0[k]);
+      for (int k = 0; k < 8 && i < n; ++k)
+        if ((m1[k] & 0xffffffff) >= t[0]) o[i++] = T(r1[k]);
+    }
+  }
+  // a 128 bit product per value
+  template <typename G>
+  KL_RAND_INLINE void wide(G& g) const {
+    const uint64_t t = (0 - bound) % bound;
+    uint64_t buf[8];
+    size_t j = 8;
+    for (size_t i = 0; i < n; ++i) {
+      unsigned __int128 m;
+      do {
+        if (j == 8) {
+          u64x8 v;
+          g.next(v);
+          memcpy(buf, &v, 64);
+          j = 0;
+        }
+        m = static_cast<unsigned __int128>(buf[j++]) * bound;
+      } while (static_cast<uint64_t>(m) < t);
+      o[i] = T(static_cast<uint64_t>(m >> 64) + uint64_t(lo));
+    }
+  }
+};
+
+// lo + (hi - lo) u for u uniform in [0, 1)
+template <typename T>
+struct UniformRealKernel {
+  T* o;
+  size_t n;
+  double lo, hi;
+  template <typename G>
+  KL_RAND_INLINE void operator()(G& g) const {
+    u64x8 v;
+    f64x8 u;
+    for (size_t i = 0; i < n; i += 8) {
+      g.next(v);
+      unit_lanes(v, u);
+      store_lanes(o + i, lo + (hi - lo) * u, std::min<size_t>(8, n - i));
+    }
+  }
+};
+
+template <typename T>
+struct NormalKernel {
+  T* o;
+  size_t n;
+  double mean, stddev;
+  template <typename G>
+  KL_RAND_INLINE void operator()(G& g) const {
+    u64x8 v;
+    f64x8 u, l, r, s, c;
+    for (size_t i = 0; i < n; i += 16) {
+      g.next(v);
+      unit_lanes(v, u);
+      simd::vlog<f64x8, double>(u + 0x1.0p-53, l);  // of (0, 1]
+      sqrt_lanes(-2.0 * l, r);
+      r *= stddev;
+      g.next(v);
+      unit_lanes(v, u);
+      sincos_2pi(u, s, c);
+      store_lanes(o + i, mean + r * c, std::min<size_t>(8, n - i));
+      if (i + 8 < n)
+        store_lanes(o + i + 8, mean + r * s, std::min<size_t>(8, n - i - 8));
+    }
+  }
+};
+
+template <typename S, typename K>
+KL_RAND_INLINE void run_lanes(S& src, const K& kernel) {
+  typename S::Vec g(src);
+  const K k = kernel;  // a local copy, the outputs cannot alias it
+  k(g);
+  g.store(src);
+}
+
+template <typename S, typename K>
+void run_lanes_default(S& src, const K& kernel) {
+  run_lanes(src, kernel);
+}
+#if defined(__x86_64__) || defined(__i386__)
+template <typename S, typename K>
+__attribute__((target("avx2,fma"))) void run_lanes_avx2(S& src,
+                                                       const K& kernel) {
+  run_lanes(src, kernel);
+}
+template <typename S, typename K>
+__attribute__((target("avx512f,avx512dq,fma"))) void run_lanes_avx512(
+    S& src, const K& kernel) {
+  run_lanes(src, kernel);
+}
+#endif
+
+template <typename S, typename K>
+void dispatch_lanes(S& src, const K& kernel) {
+  switch (simd::active_isa()) {
+#if defined(__x86_64__) || defined(__i386__)
+    case simd::Isa::avx512:
+      return run_lanes_avx512(src, kernel);
+    case simd::Isa::avx2:
+      return run_lanes_avx2(src, kernel);
+#endif
+    default:
+      return run_lanes_default(src, kernel);
+  }
+}
+
+#undef KL_RAND_INLINE
+
+// p[0, n) = random bits from the lanes src, XoshiroLanes or PhiloxLanes;
+// a call draws a multiple of 8 values and drops the ones past n
+template <typename S>
+void fill_bits(S& src, uint64_t* p, size_t n) {
+  dispatch_lanes(src, BitsKernel{p, n});
+}
+
+// p[0, n) uniform in [lo, hi), lo < hi, for integer and floating point T
+template <typename S, typename T>
+void fill_uniform(S& src, T* p, size_t n, T lo, T hi) {
+  if constexpr (std::is_integral<T>::value) {
+    typedef std::make_unsigned_t<T> U;
+    const uint64_t bound =
+        static_cast<U>(static_cast<U>(hi) - static_cast<U>(lo));
+    dispatch_lanes(src, UniformIntKernel<T>{p, n, lo, bound});
+  } else {
+    dispatch_lanes(src, UniformRealKernel<T>{p, n, double(lo), double(hi)});
+  }
+}
+
+// p[0, n) normal with the given mean and standard deviation
+template <typename S, typename T>
+void fill_normal(S& src, T* p, size_t n, T mean = 0, T stddev = 1) {
+  static_assert(std::is_floating_point<T>::value, "normals are real");
+  dispatch_lanes(src, NormalKernel<T>{p, n, double(mean), double(stddev)});
+}
+}  // namespace kl
 
 class Rand {
 private:
-  std::mt19937_64 gen_;
+  kl::Xoshiro256pp gen_;
+  kl::XoshiroLanes lanes_;  // of the bulk fills, set up on first use
+  bool has_lanes_ = false, has_spare_ = false;
+  double spare_ = 0;
+
+  kl::XoshiroLanes& lanes() {
+    if (!has_lanes_) {
+      lanes_ = kl::XoshiroLanes(gen_);
+      has_lanes_ = true;
+    }
+    return lanes_;
+  }
+  // in [0, n) by Lemire's multiply and shift, n > 0
+  uint64_t bounded(uint64_t n) {
+    unsigned __int128 m = static_cast<unsigned __int128>(gen_()) * n;
+    if (static_cast<uint64_t>(m) < n) {
+      const uint64_t t = (0 - n) % n;
+      while (static_cast<uint64_t>(m) < t)
+        m = static_cast<unsigned __int128>(gen_()) * n;
+    }
+    return static_cast<uint64_t>(m >> 64);
+  }
+
 public:
   explicit Rand(uint64_t s) : gen_(s) {}
+  // the stream-th of independent streams of seed s, 2^192 values apart,
+  // for one generator per thread
+  Rand(uint64_t s, uint64_t stream) : gen_(s) {
+    while (stream-- > 0) gen_.long_jump();
+  }
+
   int64_t int64() { return gen_(); }
   uint64_t uint64() { return gen_(); }
-  uint32_t uint32(uint32_t n = 0xffffFFFF) { return static_cast<uint32_t>(gen_() % n); }
+  // in [0, n), n > 0
+  uint32_t uint32(uint32_t n = 0xffffFFFF) {
+    return static_cast<uint32_t>(this->bounded(n));
+  }
   int32_t int32() { return static_cast<int32_t>(gen_()); }
-  double_t doub() { return static_cast<double_t>(gen_()) / 0xffffffffFFFFFFFF; }
+  // in [0, 1)
+  double_t doub() { return static_cast<double_t>(gen_() >> 11) * 0x1.0p-53; }
+  // standard normal
+  double normal() {
+    if (has_spare_) {
+      has_spare_ = false;
+      return spare_;
+    }
+    const double u = 1.0 - this->doub(), v = 6.283185307179586 * this->doub();
+    const double r = std::sqrt(-2.0 * std::log(u));
+    spare_ = r * std::sin(v);
+    has_spare_ = true;
+    return r * std::cos(v);
+  }
+  // in [from, to), from < to
   template <typename T>
   T uniform(T from, T to) {
-    T gap = to - from;
-    T val = static_cast<T>(gen_()) % gap;
-    if (val < 0) val += gap;
-    return from + val;
+    if constexpr (std::is_integral<T>::value) {
+      typedef std::make_unsigned_t<T> U;
+      return static_cast<T>(static_cast<U>(from) +
+                            this->bounded(static_cast<U>(to) -
+                                          static_cast<U>(from)));
+    } else {
+      return from + (to - from) * static_cast<T>(this->doub());
+    }
+  }
+
+  // bulk versions, vectorized, from streams of their own
+  void fill(uint64_t* p, size_t n) { kl::fill_bits(this->lanes(), p, n); }
+  template <typename T>
+  void fill_uniform(T* p, size_t n, T from, T to) {
+    kl::fill_uniform(this->lanes(), p, n, from, to);
+  }
+  template <typename T>
+  void fill_normal(T* p, size_t n, T mean = 0, T stddev = 1) {
+    kl::fill_normal(this->lanes(), p, n, mean, stddev);
   }
-};
\ No newline at end of file
+};
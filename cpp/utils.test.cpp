@@ -6,14 +6,133 @@
 
 #include "utils.h"
 
+#include <gtest/gtest.h>
+
 #include <time.h>
 
-#include <iostream>
+#include <vector>
+
+Rand rng(82 + time(nullptr));
+
+TEST(test_rand, engines) {
+  kl::Xoshiro256pp x({1, 2, 3, 4});
+  EXPECT_EQ(x(), (uint64_t(5) << 23) + 1);
+
+  // lane k of the bulk generators is k + 1 jumps ahead
+  kl::Xoshiro256pp g(rng.uint64());
+  kl::XoshiroLanes lanes(g);
+  std::vector<uint64_t> bits(8 * 50);
+  kl::fill_bits(lanes, bits.data(), bits.size());
+  for (int k = 0; k < 8; ++k) {
+    g.jump();
+    kl::Xoshiro256pp h = g;
+    for (size_t i = 0; i < 50; ++i) ASSERT_EQ(bits[8 * i + k], h()) << k;
+  }
+
+  // known answers of the Random123 reference
+  typedef kl::Philox4x32::ctr_type C;
+  EXPECT_EQ(kl::Philox4x32::block({0, 0, 0, 0}, {0, 0}),
+            C({0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+  EXPECT_EQ(kl::Philox4x32::block({0x243f6a88, 0x85a308d3, 0x13198a2e,
+                                   0x03707344},
+                                  {0xa4093822, 0x299f31d0}),
+            C({0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+
+  const uint64_t seed = rng.uint64(), stream = rng.uint64();
+  kl::Philox4x32 p(seed, stream), q(seed, stream);
+  std::vector<uint64_t> seq(64);
+  for (auto& v : seq) v = p();
+  q.discard(37);
+  EXPECT_EQ(q(), seq[37]);
+  EXPECT_EQ(q.position(), 38u);
+
+  // block b + k in lane k, from any position of the stream
+  kl::PhiloxLanes pl{seed, stream, 5};
+  kl::fill_bits(pl, bits.data(), 32);
+  EXPECT_EQ(pl.block, 5u + 16);
+  for (size_t i = 0; i < 32; ++i) {
+    const uint64_t b = 5 + 8 * (i / 16) + i % 8, h = (i / 8) % 2;
+    EXPECT_EQ(bits[i], seq[2 * b + h]) << i;
+  }
+};
+
+TEST(test_rand, bounded_and_isa) {
+  std::vector<int32_t> a(1000);
+  rng.fill_uniform(a.data(), a.size(), -99, 99);
+  for (auto v : a) ASSERT_TRUE(-99 <= v && v < 99) << v;
+  std::vector<uint64_t> b(1000);
+  const uint64_t big = (uint64_t(1) << 62) + 12345;
+  rng.fill_uniform(b.data(), b.size(), uint64_t(0), big);
+  for (auto v : b) ASSERT_LT(v, big);
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_LT(rng.uint32(201), 201u);
+    const int32_t v = rng.uniform<int32_t>(-5, 5);
+    ASSERT_TRUE(-5 <= v && v < 5);
+    const double d = rng.doub();
+    ASSERT_TRUE(0 <= d && d < 1);
+  }
+
+  // every value of a small range about equally often
+  std::vector<uint8_t> c(70000);
+  rng.fill_uniform(c.data(), c.size(), uint8_t(0), uint8_t(7));
+  std::vector<int> hist(7);
+  for (auto v : c) ++hist.at(v);
+  for (int h : hist) EXPECT_NEAR(h, 10000, 500);
+
+  // the same values whatever the kernels
+  const auto isa = kl::simd::active_isa();
+  std::vector<std::vector<uint32_t>> ints;
+  std::vector<std::vector<double>> reals;
+  for (auto i : {kl::simd::Isa::scalar, kl::simd::Isa::avx2,
+                 kl::simd::Isa::avx512}) {
+    kl::simd::set_isa(i);
+    kl::PhiloxLanes src{7, 3, 0};
+    ints.emplace_back(1001);
+    kl::fill_uniform(src, ints.back().data(), 1001, 0u, 1000u);
+    reals.emplace_back(1001);
+    kl::fill_normal(src, reals.back().data(), 1001, 1.0, 2.0);
+  }
+  kl::simd::set_isa(isa);
+  for (size_t i = 1; i < ints.size(); ++i) {
+    EXPECT_EQ(ints[i], ints[0]);
+    for (size_t k = 0; k < 1001; ++k)
+      ASSERT_NEAR(reals[i][k], reals[0][k], 1e-12);
+  }
+};
+
+template <typename T>
+void moments(const std::vector<T>& v, double mean, double var) {
+  double s = 0, s2 = 0;
+  for (T x : v) {
+    s += x;
+    s2 += double(x) * x;
+  }
+  const double n = v.size(), m = s / n;
+  EXPECT_NEAR(m, mean, 5 * std::sqrt(var / n));
+  EXPECT_NEAR(s2 / n - m * m, var, 0.05 * var);
+}
+
+TEST(test_rand, moments) {
+  std::vector<double> u(100000), z(100001);
+  rng.fill_uniform(u.data(), u.size(), -1.0, 3.0);
+  for (double x : u) ASSERT_TRUE(-1 <= x && x < 3);
+  moments(u, 1.0, 16.0 / 12);
+  rng.fill_normal(z.data(), z.size(), 2.0, 3.0);
+  moments(z, 2.0, 9.0);
+  std::vector<float> f(100000);
+  rng.fill_normal(f.data(), f.size());
+  moments(f, 0.0, 1.0);
+  for (double& x : z) x = rng.normal();
+  moments(z, 0.0, 1.0);
 
-int main() {
-  Rand rng(82 + time(nullptr));
-  
-  std::cout << rng.doub() << std::endl;
+  // streams of one seed do not overlap
+  Rand s0(11, 0), s1(11, 1), s1b(11, 1);
+  const uint64_t v = s1.uint64();
+  EXPECT_NE(s0.uint64(), v);
+  EXPECT_EQ(s1b.uint64(), v);
+};
 
-  return 0;
-}
\ No newline at end of file
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}